@@ -0,0 +1,1058 @@
+#include "stdafx.h"
+#include "../Utils/Util.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <float.h>
+#include <xmmintrin.h>
+
+namespace MeshOpt
+{
+	// FIFO cache using timestamps: a vertex is in the cache if it was added in the last CacheSize insertions
+	struct FCacheSimulator
+	{
+		std::vector<uint32> TimeStamps;
+		uint32 Time;
+		uint32 CacheSize;
+
+		FCacheSimulator(uint32 NumVertices, uint32 InCacheSize)
+			: TimeStamps(NumVertices, 0)
+			, Time(InCacheSize + 1)
+			, CacheSize(InCacheSize)
+		{
+		}
+
+		// Returns true on a miss
+		bool Access(uint32 Vertex)
+		{
+			if (Time - TimeStamps[Vertex] > CacheSize)
+			{
+				TimeStamps[Vertex] = Time++;
+				return true;
+			}
+			return false;
+		}
+
+		uint32 AccessTriangle(const uint32* Triangle)
+		{
+			return (Access(Triangle[0]) ? 1 : 0) + (Access(Triangle[1]) ? 1 : 0) + (Access(Triangle[2]) ? 1 : 0);
+		}
+
+		void Flush()
+		{
+			Time += CacheSize + 1;
+		}
+	};
+
+	FCacheStats AnalyzeVertexCache(const uint32* Indices, uint32 NumIndices, uint32 NumVertices, uint32 CacheSize)
+	{
+		check(NumIndices % 3 == 0);
+		FCacheStats Stats;
+		FCacheSimulator Cache(NumVertices, CacheSize);
+		std::vector<bool> Used(NumVertices, false);
+		for (uint32 Index = 0; Index < NumIndices; ++Index)
+		{
+			uint32 Vertex = Indices[Index];
+			check(Vertex < NumVertices);
+			Stats.NumMisses += Cache.Access(Vertex) ? 1 : 0;
+			if (!Used[Vertex])
+			{
+				Used[Vertex] = true;
+				++Stats.NumVertices;
+			}
+		}
+		Stats.NumTriangles = NumIndices / 3;
+		Stats.ACMR = Stats.NumTriangles ? (float)Stats.NumMisses / (float)Stats.NumTriangles : 0.0f;
+		Stats.ATVR = Stats.NumVertices ? (float)Stats.NumMisses / (float)Stats.NumVertices : 0.0f;
+		return Stats;
+	}
+
+	void OptimizeVertexCache(uint32* Indices, uint32 NumIndices, uint32 NumVertices, uint32 CacheSize)
+	{
+		check(NumIndices % 3 == 0);
+		uint32 NumTriangles = NumIndices / 3;
+		if (!NumTriangles)
+		{
+			return;
+		}
+
+		// Vertex to triangle adjacency, packed
+		std::vector<uint32> LiveTriangles(NumVertices, 0);
+		for (uint32 Index = 0; Index < NumIndices; ++Index)
+		{
+			++LiveTriangles[Indices[Index]];
+		}
+
+		std::vector<uint32> Offsets(NumVertices + 1, 0);
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			Offsets[Vertex + 1] = Offsets[Vertex] + LiveTriangles[Vertex];
+		}
+
+		std::vector<uint32> Adjacency(NumIndices);
+		{
+			std::vector<uint32> Fill(Offsets.begin(), Offsets.end() - 1);
+			for (uint32 Index = 0; Index < NumIndices; ++Index)
+			{
+				Adjacency[Fill[Indices[Index]]++] = Index / 3;
+			}
+		}
+
+		std::vector<uint32> CacheTimeStamps(NumVertices, 0);
+		std::vector<bool> Emitted(NumTriangles, false);
+		std::vector<uint32> DeadEndStack;
+		DeadEndStack.reserve(NumIndices);
+		std::vector<uint32> Candidates;
+		std::vector<uint32> Output;
+		Output.reserve(NumIndices);
+		uint32 Time = CacheSize + 1;
+		uint32 Cursor = 0;
+
+		auto GetNextVertex = [&]() -> int32
+		{
+			// Prefer the candidate that will still be in the cache after fanning around it, and among those the oldest one
+			int32 Best = -1;
+			int32 BestPriority = -1;
+			for (uint32 Vertex : Candidates)
+			{
+				if (LiveTriangles[Vertex] > 0)
+				{
+					int32 Priority = 0;
+					if (Time - CacheTimeStamps[Vertex] + 2 * LiveTriangles[Vertex] <= CacheSize)
+					{
+						Priority = (int32)(Time - CacheTimeStamps[Vertex]);
+					}
+
+					if (Priority > BestPriority)
+					{
+						Best = (int32)Vertex;
+						BestPriority = Priority;
+					}
+				}
+			}
+
+			if (Best != -1)
+			{
+				return Best;
+			}
+
+			// Dead end; go back to the most recently used vertex that still has triangles
+			while (!DeadEndStack.empty())
+			{
+				uint32 Vertex = DeadEndStack.back();
+				DeadEndStack.pop_back();
+				if (LiveTriangles[Vertex] > 0)
+				{
+					return (int32)Vertex;
+				}
+			}
+
+			// Otherwise the next vertex in input order
+			while (Cursor < NumVertices)
+			{
+				if (LiveTriangles[Cursor] > 0)
+				{
+					return (int32)Cursor;
+				}
+				++Cursor;
+			}
+
+			return -1;
+		};
+
+		int32 Fanning = (int32)Indices[0];
+		while (Fanning >= 0)
+		{
+			Candidates.clear();
+			for (uint32 Adjacent = Offsets[Fanning]; Adjacent < Offsets[Fanning + 1]; ++Adjacent)
+			{
+				uint32 Triangle = Adjacency[Adjacent];
+				if (!Emitted[Triangle])
+				{
+					Emitted[Triangle] = true;
+					for (uint32 Corner = 0; Corner < 3; ++Corner)
+					{
+						uint32 Vertex = Indices[Triangle * 3 + Corner];
+						Output.push_back(Vertex);
+						DeadEndStack.push_back(Vertex);
+						Candidates.push_back(Vertex);
+						--LiveTriangles[Vertex];
+						if (Time - CacheTimeStamps[Vertex] > CacheSize)
+						{
+							CacheTimeStamps[Vertex] = Time++;
+						}
+					}
+				}
+			}
+
+			Fanning = GetNextVertex();
+		}
+
+		check(Output.size() == NumIndices);
+		memcpy(Indices, &Output[0], NumIndices * sizeof(uint32));
+	}
+
+	void OptimizeOverdraw(uint32* Indices, uint32 NumIndices, const float* Positions, uint32 PositionStride, uint32 NumVertices, float Threshold, uint32 CacheSize)
+	{
+		check(NumIndices % 3 == 0);
+		uint32 NumTriangles = NumIndices / 3;
+		if (!NumTriangles)
+		{
+			return;
+		}
+
+		// Hard boundaries are where the cache got flushed anyway (all three vertices miss), so they cost nothing to split at
+		std::vector<uint32> HardClusters;
+		{
+			FCacheSimulator Cache(NumVertices, CacheSize);
+			for (uint32 Triangle = 0; Triangle < NumTriangles; ++Triangle)
+			{
+				if (Cache.AccessTriangle(Indices + Triangle * 3) == 3 || Triangle == 0)
+				{
+					HardClusters.push_back(Triangle);
+				}
+			}
+			HardClusters.push_back(NumTriangles);
+		}
+
+		// Soft boundaries split a hard cluster as soon as the triangles so far have an ACMR close enough to the whole cluster's
+		std::vector<uint32> Clusters;
+		{
+			FCacheSimulator Cache(NumVertices, CacheSize);
+			for (size_t HardIndex = 0; HardIndex + 1 < HardClusters.size(); ++HardIndex)
+			{
+				uint32 Start = HardClusters[HardIndex];
+				uint32 End = HardClusters[HardIndex + 1];
+
+				Cache.Flush();
+				uint32 ClusterMisses = 0;
+				for (uint32 Triangle = Start; Triangle < End; ++Triangle)
+				{
+					ClusterMisses += Cache.AccessTriangle(Indices + Triangle * 3);
+				}
+				float MaxACMR = Threshold * (float)ClusterMisses / (float)(End - Start);
+
+				Cache.Flush();
+				Clusters.push_back(Start);
+				uint32 Misses = 0;
+				uint32 Count = 0;
+				for (uint32 Triangle = Start; Triangle < End; ++Triangle)
+				{
+					Misses += Cache.AccessTriangle(Indices + Triangle * 3);
+					++Count;
+					if (Triangle + 1 < End && (float)Misses <= MaxACMR * (float)Count)
+					{
+						Clusters.push_back(Triangle + 1);
+						Cache.Flush();
+						Misses = 0;
+						Count = 0;
+					}
+				}
+			}
+			Clusters.push_back(NumTriangles);
+		}
+
+		auto GetPosition = [&](uint32 Vertex)
+		{
+			const float* Position = (const float*)((const char*)Positions + (size_t)Vertex * PositionStride);
+			return FVector3(Position[0], Position[1], Position[2]);
+		};
+
+		// Area weighted centroid and normal per cluster
+		uint32 NumClusters = (uint32)Clusters.size() - 1;
+		std::vector<FVector3> Centroids(NumClusters, FVector3::GetZero());
+		std::vector<FVector3> Normals(NumClusters, FVector3::GetZero());
+		FVector3 MeshCentroid = FVector3::GetZero();
+		float MeshArea = 0;
+		for (uint32 Cluster = 0; Cluster < NumClusters; ++Cluster)
+		{
+			float ClusterArea = 0;
+			for (uint32 Triangle = Clusters[Cluster]; Triangle < Clusters[Cluster + 1]; ++Triangle)
+			{
+				FVector3 A = GetPosition(Indices[Triangle * 3 + 0]);
+				FVector3 B = GetPosition(Indices[Triangle * 3 + 1]);
+				FVector3 C = GetPosition(Indices[Triangle * 3 + 2]);
+				FVector3 Normal = Cross(B - A, C - A);
+				float Area = Normal.GetLength();
+				Centroids[Cluster] = Centroids[Cluster].Add(A.Add(B).Add(C).Mul(Area / 3.0f));
+				Normals[Cluster] = Normals[Cluster].Add(Normal);
+				ClusterArea += Area;
+			}
+			MeshCentroid = MeshCentroid.Add(Centroids[Cluster]);
+			MeshArea += ClusterArea;
+			Centroids[Cluster] = ClusterArea > 0 ? Centroids[Cluster].Mul(1.0f / ClusterArea) : GetPosition(Indices[Clusters[Cluster] * 3]);
+			Normals[Cluster].Normalize();
+		}
+		MeshCentroid = MeshArea > 0 ? MeshCentroid.Mul(1.0f / MeshArea) : MeshCentroid;
+
+		// Clusters further out along their own normal are more likely to occlude the rest, so draw them first
+		std::vector<float> SortKeys(NumClusters);
+		std::vector<uint32> Order(NumClusters);
+		for (uint32 Cluster = 0; Cluster < NumClusters; ++Cluster)
+		{
+			FVector3 Offset = Centroids[Cluster] - MeshCentroid;
+			SortKeys[Cluster] = Offset.x * Normals[Cluster].x + Offset.y * Normals[Cluster].y + Offset.z * Normals[Cluster].z;
+			Order[Cluster] = Cluster;
+		}
+		std::stable_sort(Order.begin(), Order.end(), [&](uint32 A, uint32 B) { return SortKeys[A] > SortKeys[B]; });
+
+		std::vector<uint32> Output;
+		Output.reserve(NumIndices);
+		for (uint32 Cluster : Order)
+		{
+			Output.insert(Output.end(), Indices + Clusters[Cluster] * 3, Indices + Clusters[Cluster + 1] * 3);
+		}
+		memcpy(Indices, &Output[0], NumIndices * sizeof(uint32));
+	}
+
+	uint32 OptimizeVertexFetch(void* Vertices, uint32 VertexSize, uint32 NumVertices, uint32* Indices, uint32 NumIndices)
+	{
+		std::vector<uint32> Remap(NumVertices, UINT32_MAX);
+		uint32 NumUsed = 0;
+		for (uint32 Index = 0; Index < NumIndices; ++Index)
+		{
+			uint32& Vertex = Indices[Index];
+			check(Vertex < NumVertices);
+			if (Remap[Vertex] == UINT32_MAX)
+			{
+				Remap[Vertex] = NumUsed++;
+			}
+			Vertex = Remap[Vertex];
+		}
+
+		if (NumVertices)
+		{
+			std::vector<char> Original((char*)Vertices, (char*)Vertices + (size_t)NumVertices * VertexSize);
+			for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+			{
+				if (Remap[Vertex] != UINT32_MAX)
+				{
+					memcpy((char*)Vertices + (size_t)Remap[Vertex] * VertexSize, &Original[(size_t)Vertex * VertexSize], VertexSize);
+				}
+			}
+		}
+
+		return NumUsed;
+	}
+
+	static inline const float* GetStrided(const float* Data, uint32 Stride, uint32 Index)
+	{
+		return (const float*)((const char*)Data + (size_t)Index * Stride);
+	}
+
+	// OutGroups[Vertex] is the lowest numbered vertex at the same position
+	static void BuildPositionGroups(const float* Positions, uint32 PositionStride, uint32 NumVertices, std::vector<uint32>& OutGroups)
+	{
+		OutGroups.resize(NumVertices);
+		std::vector<uint32> Sorted(NumVertices);
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			Sorted[Vertex] = Vertex;
+		}
+		auto Less = [&](uint32 A, uint32 B)
+		{
+			const float* PA = GetStrided(Positions, PositionStride, A);
+			const float* PB = GetStrided(Positions, PositionStride, B);
+			return PA[0] != PB[0] ? PA[0] < PB[0] : (PA[1] != PB[1] ? PA[1] < PB[1] : (PA[2] != PB[2] ? PA[2] < PB[2] : A < B));
+		};
+		std::sort(Sorted.begin(), Sorted.end(), Less);
+		for (uint32 Index = 0; Index < NumVertices; ++Index)
+		{
+			const float* Previous = Index > 0 ? GetStrided(Positions, PositionStride, Sorted[Index - 1]) : nullptr;
+			const float* Current = GetStrided(Positions, PositionStride, Sorted[Index]);
+			bool bSameAsPrevious = Previous && Previous[0] == Current[0] && Previous[1] == Current[1] && Previous[2] == Current[2];
+			OutGroups[Sorted[Index]] = bSameAsPrevious ? OutGroups[Sorted[Index - 1]] : Sorted[Index];
+		}
+	}
+
+	void GenerateSmoothNormals(const float* Positions, uint32 PositionStride, float* Normals, uint32 NormalStride, uint32 NumVertices, const uint32* Indices, uint32 NumIndices)
+	{
+		check(NumIndices % 3 == 0);
+		uint32 NumTriangles = NumIndices / 3;
+		if (!NumTriangles)
+		{
+			return;
+		}
+
+		// Flat SoA copy of the positions
+		std::vector<float> X(NumVertices);
+		std::vector<float> Y(NumVertices);
+		std::vector<float> Z(NumVertices);
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			const float* Position = GetStrided(Positions, PositionStride, Vertex);
+			X[Vertex] = Position[0];
+			Y[Vertex] = Position[1];
+			Z[Vertex] = Position[2];
+		}
+
+		// Vertices at the same position accumulate into the same normal
+		std::vector<uint32> Groups;
+		BuildPositionGroups(Positions, PositionStride, NumVertices, Groups);
+
+		std::vector<float> AccumX(NumVertices, 0.0f);
+		std::vector<float> AccumY(NumVertices, 0.0f);
+		std::vector<float> AccumZ(NumVertices, 0.0f);
+
+		// Four triangles at a time; the last batch repeats its final triangle but only scatters the real ones
+		for (uint32 First = 0; First < NumTriangles; First += 4)
+		{
+			uint32 Corners[3][4];
+			for (uint32 Lane = 0; Lane < 4; ++Lane)
+			{
+				uint32 Triangle = First + Lane < NumTriangles ? First + Lane : NumTriangles - 1;
+				Corners[0][Lane] = Indices[Triangle * 3 + 0];
+				Corners[1][Lane] = Indices[Triangle * 3 + 1];
+				Corners[2][Lane] = Indices[Triangle * 3 + 2];
+			}
+
+			__m128 P[3][3];
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
+			{
+				const uint32* C = Corners[Corner];
+				P[Corner][0] = _mm_setr_ps(X[C[0]], X[C[1]], X[C[2]], X[C[3]]);
+				P[Corner][1] = _mm_setr_ps(Y[C[0]], Y[C[1]], Y[C[2]], Y[C[3]]);
+				P[Corner][2] = _mm_setr_ps(Z[C[0]], Z[C[1]], Z[C[2]], Z[C[3]]);
+			}
+
+			// Edges AB, AC and BC
+			__m128 E[3][3];
+			for (uint32 Axis = 0; Axis < 3; ++Axis)
+			{
+				E[0][Axis] = _mm_sub_ps(P[1][Axis], P[0][Axis]);
+				E[1][Axis] = _mm_sub_ps(P[2][Axis], P[0][Axis]);
+				E[2][Axis] = _mm_sub_ps(P[2][Axis], P[1][Axis]);
+			}
+
+			// Cross(AC, AB); its length is twice the area, which is the area weighting
+			__m128 NX = _mm_sub_ps(_mm_mul_ps(E[1][1], E[0][2]), _mm_mul_ps(E[1][2], E[0][1]));
+			__m128 NY = _mm_sub_ps(_mm_mul_ps(E[1][2], E[0][0]), _mm_mul_ps(E[1][0], E[0][2]));
+			__m128 NZ = _mm_sub_ps(_mm_mul_ps(E[1][0], E[0][1]), _mm_mul_ps(E[1][1], E[0][0]));
+
+			auto Dot = [](const __m128* A, const __m128* B)
+			{
+				return _mm_add_ps(_mm_add_ps(_mm_mul_ps(A[0], B[0]), _mm_mul_ps(A[1], B[1])), _mm_mul_ps(A[2], B[2]));
+			};
+			__m128 Length2[3] = { Dot(E[0], E[0]), Dot(E[1], E[1]), Dot(E[2], E[2]) };
+
+			// Cosine of the angle at each corner: A between AB and AC, B between BA and BC, C between CA and CB
+			const __m128 Epsilon = _mm_set1_ps(1e-30f);
+			__m128 Cosines[3];
+			Cosines[0] = _mm_div_ps(Dot(E[0], E[1]), _mm_max_ps(_mm_sqrt_ps(_mm_mul_ps(Length2[0], Length2[1])), Epsilon));
+			Cosines[1] = _mm_div_ps(_mm_sub_ps(_mm_setzero_ps(), Dot(E[0], E[2])), _mm_max_ps(_mm_sqrt_ps(_mm_mul_ps(Length2[0], Length2[2])), Epsilon));
+			Cosines[2] = _mm_div_ps(Dot(E[1], E[2]), _mm_max_ps(_mm_sqrt_ps(_mm_mul_ps(Length2[1], Length2[2])), Epsilon));
+
+			float FaceX[4];
+			float FaceY[4];
+			float FaceZ[4];
+			float Cos[3][4];
+			_mm_storeu_ps(FaceX, NX);
+			_mm_storeu_ps(FaceY, NY);
+			_mm_storeu_ps(FaceZ, NZ);
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
+			{
+				_mm_storeu_ps(Cos[Corner], _mm_min_ps(_mm_max_ps(Cosines[Corner], _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f)));
+			}
+
+			uint32 NumLanes = NumTriangles - First < 4 ? NumTriangles - First : 4;
+			for (uint32 Lane = 0; Lane < NumLanes; ++Lane)
+			{
+				for (uint32 Corner = 0; Corner < 3; ++Corner)
+				{
+					float Angle = acosf(Cos[Corner][Lane]);
+					uint32 Group = Groups[Corners[Corner][Lane]];
+					AccumX[Group] += FaceX[Lane] * Angle;
+					AccumY[Group] += FaceY[Lane] * Angle;
+					AccumZ[Group] += FaceZ[Lane] * Angle;
+				}
+			}
+		}
+
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			float* Normal = (float*)GetStrided(Normals, NormalStride, Vertex);
+			if (Normal[0] == 0 && Normal[1] == 0 && Normal[2] == 0)
+			{
+				uint32 Group = Groups[Vertex];
+				FVector3 N(AccumX[Group], AccumY[Group], AccumZ[Group]);
+				N.Normalize();
+				Normal[0] = N.x;
+				Normal[1] = N.y;
+				Normal[2] = N.z;
+			}
+		}
+	}
+
+	void GenerateTangents(const float* Positions, uint32 PositionStride, const float* Normals, uint32 NormalStride, const float* UVs, uint32 UVStride, uint32 NumVertices, const uint32* Indices, uint32 NumIndices, float* OutTangents)
+	{
+		check(NumIndices % 3 == 0);
+		std::vector<FVector3> Tangents(NumVertices, FVector3::GetZero());
+		std::vector<FVector3> Bitangents(NumVertices, FVector3::GetZero());
+		for (uint32 Index = 0; Index < NumIndices; Index += 3)
+		{
+			uint32 V[3] = { Indices[Index + 0], Indices[Index + 1], Indices[Index + 2] };
+			const float* P0 = GetStrided(Positions, PositionStride, V[0]);
+			const float* P1 = GetStrided(Positions, PositionStride, V[1]);
+			const float* P2 = GetStrided(Positions, PositionStride, V[2]);
+			const float* UV0 = GetStrided(UVs, UVStride, V[0]);
+			const float* UV1 = GetStrided(UVs, UVStride, V[1]);
+			const float* UV2 = GetStrided(UVs, UVStride, V[2]);
+
+			FVector3 E1(P1[0] - P0[0], P1[1] - P0[1], P1[2] - P0[2]);
+			FVector3 E2(P2[0] - P0[0], P2[1] - P0[1], P2[2] - P0[2]);
+			float DU1 = UV1[0] - UV0[0];
+			float DV1 = UV1[1] - UV0[1];
+			float DU2 = UV2[0] - UV0[0];
+			float DV2 = UV2[1] - UV0[1];
+			float Determinant = DU1 * DV2 - DU2 * DV1;
+			if (Determinant == 0)
+			{
+				continue;
+			}
+
+			// Not normalized, so bigger triangles weigh more
+			float R = 1.0f / Determinant;
+			FVector3 T = E1.Mul(DV2 * R).Add(E2.Mul(-DV1 * R));
+			FVector3 B = E2.Mul(DU1 * R).Add(E1.Mul(-DU2 * R));
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
+			{
+				Tangents[V[Corner]] = Tangents[V[Corner]].Add(T);
+				Bitangents[V[Corner]] = Bitangents[V[Corner]].Add(B);
+			}
+		}
+
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			const float* NormalData = GetStrided(Normals, NormalStride, Vertex);
+			FVector3 N(NormalData[0], NormalData[1], NormalData[2]);
+			FVector3 T = Tangents[Vertex];
+
+			// Gram-Schmidt
+			float NdotT = N.x * T.x + N.y * T.y + N.z * T.z;
+			T = T - N.Mul(NdotT);
+			if (T.GetSquaredLength() < 1e-20f)
+			{
+				// No UV gradient; any vector orthogonal to N will do
+				T = Cross(fabsf(N.x) < 0.9f ? FVector3(1, 0, 0) : FVector3(0, 1, 0), N);
+			}
+			T.Normalize();
+
+			FVector3 B = Bitangents[Vertex];
+			FVector3 NcrossT = Cross(N, T);
+			float Handedness = NcrossT.x * B.x + NcrossT.y * B.y + NcrossT.z * B.z < 0 ? -1.0f : 1.0f;
+
+			float* Out = OutTangents + Vertex * 4;
+			Out[0] = T.x;
+			Out[1] = T.y;
+			Out[2] = T.z;
+			Out[3] = Handedness;
+		}
+	}
+
+	static void ComputeMeshletBounds(const uint32* Indices, const float* Positions, uint32 PositionStride, FMeshlet& Meshlet)
+	{
+		const uint32* MeshletIndices = Indices + Meshlet.FirstIndex;
+		FVector3 Min(FLT_MAX, FLT_MAX, FLT_MAX);
+		FVector3 Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (uint32 Index = 0; Index < Meshlet.NumIndices; ++Index)
+		{
+			const float* P = GetStrided(Positions, PositionStride, MeshletIndices[Index]);
+			Min = FVector3(P[0] < Min.x ? P[0] : Min.x, P[1] < Min.y ? P[1] : Min.y, P[2] < Min.z ? P[2] : Min.z);
+			Max = FVector3(P[0] > Max.x ? P[0] : Max.x, P[1] > Max.y ? P[1] : Max.y, P[2] > Max.z ? P[2] : Max.z);
+		}
+
+		// Box center instead of a minimal sphere; good enough for clusters this small
+		FVector3 Center = Min.Add(Max).Mul(0.5f);
+		float RadiusSquared = 0;
+		for (uint32 Index = 0; Index < Meshlet.NumIndices; ++Index)
+		{
+			const float* P = GetStrided(Positions, PositionStride, MeshletIndices[Index]);
+			FVector3 Delta(P[0] - Center.x, P[1] - Center.y, P[2] - Center.z);
+			float DistanceSquared = Delta.GetSquaredLength();
+			RadiusSquared = DistanceSquared > RadiusSquared ? DistanceSquared : RadiusSquared;
+		}
+		Meshlet.Center[0] = Center.x;
+		Meshlet.Center[1] = Center.y;
+		Meshlet.Center[2] = Center.z;
+		Meshlet.Radius = sqrtf(RadiusSquared);
+	}
+
+	void BuildMeshlets(const uint32* Indices, uint32 NumIndices, const float* Positions, uint32 PositionStride, uint32 NumVertices, std::vector<FMeshlet>& OutMeshlets, uint32 MaxVertices, uint32 MaxTriangles)
+	{
+		check(NumIndices % 3 == 0);
+		check(MaxVertices >= 3 && MaxTriangles > 0 && MaxTriangles <= MaxMeshletTriangles);
+		OutMeshlets.clear();
+		OutMeshlets.reserve(NumIndices / 3 / MaxTriangles + 1);
+
+		// Meshlet number + 1 that last used each vertex, so the per meshlet vertex set never needs clearing
+		std::vector<uint32> LastMeshlet(NumVertices, 0);
+		FMeshlet Meshlet;
+		MemZero(Meshlet);
+		uint32 NumMeshletVertices = 0;
+		for (uint32 Index = 0; Index < NumIndices; Index += 3)
+		{
+			uint32 Stamp = (uint32)OutMeshlets.size() + 1;
+			const uint32* Triangle = Indices + Index;
+			uint32 NumNew = (LastMeshlet[Triangle[0]] != Stamp ? 1 : 0) + (LastMeshlet[Triangle[1]] != Stamp ? 1 : 0) + (LastMeshlet[Triangle[2]] != Stamp ? 1 : 0);
+			// A repeated vertex in a degenerate triangle is counted twice; that only makes the meshlet end slightly early
+			if (Meshlet.NumIndices > 0 && (NumMeshletVertices + NumNew > MaxVertices || Meshlet.NumIndices / 3 == MaxTriangles))
+			{
+				ComputeMeshletBounds(Indices, Positions, PositionStride, Meshlet);
+				OutMeshlets.push_back(Meshlet);
+				MemZero(Meshlet);
+				Meshlet.FirstIndex = Index;
+				NumMeshletVertices = 0;
+				Stamp = (uint32)OutMeshlets.size() + 1;
+			}
+
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
+			{
+				if (LastMeshlet[Triangle[Corner]] != Stamp)
+				{
+					LastMeshlet[Triangle[Corner]] = Stamp;
+					++NumMeshletVertices;
+				}
+			}
+			Meshlet.NumIndices += 3;
+		}
+
+		if (Meshlet.NumIndices > 0)
+		{
+			ComputeMeshletBounds(Indices, Positions, PositionStride, Meshlet);
+			OutMeshlets.push_back(Meshlet);
+		}
+	}
+
+	// Sum of squared distances to a set of planes, each weighted by the area of its triangle (Garland & Heckbert 1997)
+	struct FQuadric
+	{
+		// Symmetric 3x3 matrix, vector and constant of the quadratic form
+		double A00, A11, A22, A01, A02, A12;
+		double B0, B1, B2;
+		double C;
+		double Weight;
+
+		void AddPlane(double X, double Y, double Z, double D, double InWeight)
+		{
+			A00 += InWeight * X * X;
+			A11 += InWeight * Y * Y;
+			A22 += InWeight * Z * Z;
+			A01 += InWeight * X * Y;
+			A02 += InWeight * X * Z;
+			A12 += InWeight * Y * Z;
+			B0 += InWeight * X * D;
+			B1 += InWeight * Y * D;
+			B2 += InWeight * Z * D;
+			C += InWeight * D * D;
+			Weight += InWeight;
+		}
+
+		void Add(const FQuadric& Q)
+		{
+			A00 += Q.A00;
+			A11 += Q.A11;
+			A22 += Q.A22;
+			A01 += Q.A01;
+			A02 += Q.A02;
+			A12 += Q.A12;
+			B0 += Q.B0;
+			B1 += Q.B1;
+			B2 += Q.B2;
+			C += Q.C;
+			Weight += Q.Weight;
+		}
+
+		// Weighted mean of the squared distances to the planes
+		double Evaluate(const float* P) const
+		{
+			double X = P[0];
+			double Y = P[1];
+			double Z = P[2];
+			double Sum = A00 * X * X + A11 * Y * Y + A22 * Z * Z + 2 * (A01 * X * Y + A02 * X * Z + A12 * Y * Z) + 2 * (B0 * X + B1 * Y + B2 * Z) + C;
+			return Weight > 0 ? (Sum > 0 ? Sum : 0) / Weight : 0;
+		}
+	};
+
+	static FVector3 GetTriangleNormal(const float* A, const float* B, const float* C)
+	{
+		return Cross(FVector3(C[0] - A[0], C[1] - A[1], C[2] - A[2]), FVector3(B[0] - A[0], B[1] - A[1], B[2] - A[2]));
+	}
+
+	// Per pass classification of each position group, see Simplify()
+	enum class EVertexKind : uint8
+	{
+		// One copy, can collapse onto any neighbour
+		Manifold,
+		// Two copies on a single seam line; they move together, and only along the seam
+		Seam,
+		// Borders, seam ends and corners where more than two copies meet
+		Locked,
+	};
+
+	// Plane through the edge AB and perpendicular to its triangle, so seam vertices pay for leaving the seam line
+	static void AddEdgePlane(FQuadric& Q, const float* A, const float* B, const FVector3& TriangleNormal)
+	{
+		FVector3 Edge(B[0] - A[0], B[1] - A[1], B[2] - A[2]);
+		FVector3 N = Cross(Edge, TriangleNormal);
+		float Length = N.GetLength();
+		if (Length <= 0)
+		{
+			return;
+		}
+		N = N.Mul(1.0f / Length);
+		double D = -(N.x * A[0] + N.y * A[1] + N.z * A[2]);
+		Q.AddPlane(N.x, N.y, N.z, D, Dot(Edge, Edge));
+	}
+
+	uint32 Simplify(const uint32* Indices, uint32 NumIndices, const float* Positions, uint32 PositionStride, uint32 NumVertices, uint32 TargetNumIndices, float TargetError, uint32* OutIndices, float* OutError)
+	{
+		check(NumIndices % 3 == 0);
+		memcpy(OutIndices, Indices, NumIndices * sizeof(uint32));
+
+		// UV seams and hard normals split a position into several vertices; those are handled as one, so the quadrics
+		// and the collapses work on the group. NextCopy links the vertices of each group in a ring
+		std::vector<uint32> Groups;
+		BuildPositionGroups(Positions, PositionStride, NumVertices, Groups);
+		std::vector<uint32> NextCopy(NumVertices);
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			NextCopy[Vertex] = Vertex;
+		}
+		for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+		{
+			uint32 Group = Groups[Vertex];
+			if (Group != Vertex)
+			{
+				NextCopy[Vertex] = NextCopy[Group];
+				NextCopy[Group] = Vertex;
+			}
+		}
+
+		// Directed edges between vertices and between positions. A vertex edge without its opposite is on a seam when the
+		// position edge has one, and on a border otherwise
+		std::vector<uint64> VertexEdges;
+		std::vector<uint64> PositionEdges;
+		auto FindEdges = [&](uint32 Count)
+		{
+			VertexEdges.clear();
+			PositionEdges.clear();
+			for (uint32 Index = 0; Index < Count; Index += 3)
+			{
+				for (uint32 Corner = 0; Corner < 3; ++Corner)
+				{
+					uint32 From = OutIndices[Index + Corner];
+					uint32 To = OutIndices[Index + (Corner + 1) % 3];
+					VertexEdges.push_back((uint64)From << 32 | To);
+					PositionEdges.push_back((uint64)Groups[From] << 32 | Groups[To]);
+				}
+			}
+			std::sort(VertexEdges.begin(), VertexEdges.end());
+			std::sort(PositionEdges.begin(), PositionEdges.end());
+		};
+		auto IsOpen = [](const std::vector<uint64>& Edges, uint32 From, uint32 To)
+		{
+			return !std::binary_search(Edges.begin(), Edges.end(), (uint64)To << 32 | From);
+		};
+
+		std::vector<FQuadric> Quadrics(NumVertices);
+		memset(&Quadrics[0], 0, NumVertices * sizeof(FQuadric));
+		FindEdges(NumIndices);
+		for (uint32 Index = 0; Index < NumIndices; Index += 3)
+		{
+			const float* A = GetStrided(Positions, PositionStride, Indices[Index + 0]);
+			const float* B = GetStrided(Positions, PositionStride, Indices[Index + 1]);
+			const float* C = GetStrided(Positions, PositionStride, Indices[Index + 2]);
+			FVector3 N = GetTriangleNormal(A, B, C);
+			float DoubleArea = N.GetLength();
+			if (DoubleArea <= 0)
+			{
+				continue;
+			}
+			N = N.Mul(1.0f / DoubleArea);
+			double D = -(N.x * A[0] + N.y * A[1] + N.z * A[2]);
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
+			{
+				Quadrics[Groups[Indices[Index + Corner]]].AddPlane(N.x, N.y, N.z, D, DoubleArea * 0.5f);
+			}
+
+			// Collapsing along a seam is free as long as it stays straight; cutting its corners would slide the texture
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
+			{
+				uint32 From = Indices[Index + Corner];
+				uint32 To = Indices[Index + (Corner + 1) % 3];
+				if (IsOpen(VertexEdges, From, To) && !IsOpen(PositionEdges, Groups[From], Groups[To]))
+				{
+					const float* P0 = GetStrided(Positions, PositionStride, From);
+					const float* P1 = GetStrided(Positions, PositionStride, To);
+					AddEdgePlane(Quadrics[Groups[From]], P0, P1, N);
+					AddEdgePlane(Quadrics[Groups[To]], P0, P1, N);
+				}
+			}
+		}
+
+		struct FCollapse
+		{
+			uint32 From;
+			uint32 To;
+			double Error;
+		};
+		std::vector<FCollapse> Collapses;
+		std::vector<uint32> TriangleOffsets(NumVertices + 1);
+		std::vector<uint32> VertexTriangles;
+		std::vector<uint8> NumCopies(NumVertices);
+		std::vector<uint8> NumSeamEdges(NumVertices);
+		std::vector<uint8> bBorder(NumVertices);
+		std::vector<EVertexKind> Kinds(NumVertices);
+		std::vector<uint64> SeamEdges;
+		std::vector<uint8> bTouched(NumVertices);
+		std::vector<uint32> Remap(NumVertices);
+		std::vector<uint32> Targets;
+		double TargetErrorSquared = (double)TargetError * TargetError;
+		double MaxError = 0;
+		uint32 Count = NumIndices;
+		while (Count > TargetNumIndices)
+		{
+			// Triangles around each vertex
+			std::fill(TriangleOffsets.begin(), TriangleOffsets.end(), 0);
+			for (uint32 Index = 0; Index < Count; ++Index)
+			{
+				++TriangleOffsets[OutIndices[Index] + 1];
+			}
+			for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+			{
+				TriangleOffsets[Vertex + 1] += TriangleOffsets[Vertex];
+			}
+			VertexTriangles.resize(Count);
+			{
+				std::vector<uint32> Fill(TriangleOffsets.begin(), TriangleOffsets.end() - 1);
+				for (uint32 Index = 0; Index < Count; ++Index)
+				{
+					VertexTriangles[Fill[OutIndices[Index]]++] = Index / 3;
+				}
+			}
+			auto IsUsed = [&](uint32 Vertex)
+			{
+				return TriangleOffsets[Vertex + 1] > TriangleOffsets[Vertex];
+			};
+
+			// Previous passes (and LODs) leave unused vertices in the groups, so only count the ones still referenced
+			if (Count < NumIndices)
+			{
+				FindEdges(Count);
+			}
+			std::fill(NumCopies.begin(), NumCopies.end(), 0);
+			std::fill(NumSeamEdges.begin(), NumSeamEdges.end(), 0);
+			std::fill(bBorder.begin(), bBorder.end(), 0);
+			for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+			{
+				if (IsUsed(Vertex) && NumCopies[Groups[Vertex]] < 255)
+				{
+					++NumCopies[Groups[Vertex]];
+				}
+			}
+			SeamEdges.clear();
+			for (uint64 Edge : VertexEdges)
+			{
+				uint32 From = (uint32)(Edge >> 32);
+				uint32 To = (uint32)Edge;
+				if (IsOpen(VertexEdges, From, To))
+				{
+					uint32 GroupFrom = Groups[From];
+					uint32 GroupTo = Groups[To];
+					if (IsOpen(PositionEdges, GroupFrom, GroupTo))
+					{
+						bBorder[GroupFrom] = 1;
+						bBorder[GroupTo] = 1;
+					}
+					else
+					{
+						SeamEdges.push_back(GroupFrom < GroupTo ? (uint64)GroupFrom << 32 | GroupTo : (uint64)GroupTo << 32 | GroupFrom);
+					}
+				}
+			}
+			// Each side of a seam finds it once
+			std::sort(SeamEdges.begin(), SeamEdges.end());
+			SeamEdges.erase(std::unique(SeamEdges.begin(), SeamEdges.end()), SeamEdges.end());
+			for (uint64 Edge : SeamEdges)
+			{
+				uint32 GroupA = (uint32)(Edge >> 32);
+				uint32 GroupB = (uint32)Edge;
+				NumSeamEdges[GroupA] = NumSeamEdges[GroupA] < 255 ? NumSeamEdges[GroupA] + 1 : 255;
+				NumSeamEdges[GroupB] = NumSeamEdges[GroupB] < 255 ? NumSeamEdges[GroupB] + 1 : 255;
+			}
+			for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+			{
+				bool bManifold = NumCopies[Vertex] == 1 && NumSeamEdges[Vertex] == 0;
+				bool bSeam = NumCopies[Vertex] == 2 && NumSeamEdges[Vertex] == 2;
+				Kinds[Vertex] = bBorder[Vertex] ? EVertexKind::Locked : (bManifold ? EVertexKind::Manifold : (bSeam ? EVertexKind::Seam : EVertexKind::Locked));
+			}
+			auto CanCollapse = [&](uint32 GroupFrom, uint32 GroupTo)
+			{
+				EVertexKind Kind = Kinds[GroupFrom];
+				return Kind == EVertexKind::Manifold ||
+					(Kind == EVertexKind::Seam && std::binary_search(SeamEdges.begin(), SeamEdges.end(), GroupFrom < GroupTo ? (uint64)GroupFrom << 32 | GroupTo : (uint64)GroupTo << 32 | GroupFrom));
+			};
+
+			// Vertices only move onto a neighbour, so no new vertices (and attributes) are needed
+			Collapses.clear();
+			for (uint32 Index = 0; Index < Count; Index += 3)
+			{
+				for (uint32 Corner = 0; Corner < 3; ++Corner)
+				{
+					uint32 V0 = OutIndices[Index + Corner];
+					uint32 V1 = OutIndices[Index + (Corner + 1) % 3];
+					uint32 G0 = Groups[V0];
+					uint32 G1 = Groups[V1];
+					FQuadric Q = Quadrics[G0];
+					Q.Add(Quadrics[G1]);
+					if (CanCollapse(G0, G1))
+					{
+						FCollapse Collapse = { V0, V1, Q.Evaluate(GetStrided(Positions, PositionStride, V1)) };
+						Collapses.push_back(Collapse);
+					}
+					if (CanCollapse(G1, G0))
+					{
+						FCollapse Collapse = { V1, V0, Q.Evaluate(GetStrided(Positions, PositionStride, V0)) };
+						Collapses.push_back(Collapse);
+					}
+				}
+			}
+			std::sort(Collapses.begin(), Collapses.end(), [](const FCollapse& A, const FCollapse& B) { return A.Error < B.Error; });
+
+			// Cheapest first, and at most one collapse per neighbourhood per pass so the flip test below stays valid
+			for (uint32 Vertex = 0; Vertex < NumVertices; ++Vertex)
+			{
+				Remap[Vertex] = Vertex;
+			}
+			std::fill(bTouched.begin(), bTouched.end(), 0);
+			uint32 NumRemoved = 0;
+			uint32 NumCollapsed = 0;
+			for (const FCollapse& Collapse : Collapses)
+			{
+				if (Collapse.Error > TargetErrorSquared || Count - NumRemoved <= TargetNumIndices)
+				{
+					break;
+				}
+				uint32 GroupFrom = Groups[Collapse.From];
+				uint32 GroupTo = Groups[Collapse.To];
+				if (bTouched[GroupFrom] || bTouched[GroupTo])
+				{
+					continue;
+				}
+
+				// Every copy of From moves onto the copy of To it shares an edge with, so each side of a seam keeps its
+				// attributes; give up if a copy doesn't have exactly one
+				bool bValid = true;
+				Targets.clear();
+				uint32 Copy = GroupFrom;
+				do
+				{
+					uint32 Target = ~0u;
+					for (uint32 Entry = TriangleOffsets[Copy]; Entry < TriangleOffsets[Copy + 1]; ++Entry)
+					{
+						const uint32* Triangle = &OutIndices[VertexTriangles[Entry] * 3];
+						for (uint32 Corner = 0; Corner < 3; ++Corner)
+						{
+							if (Groups[Triangle[Corner]] == GroupTo)
+							{
+								bValid = bValid && (Target == ~0u || Target == Triangle[Corner]);
+								Target = Triangle[Corner];
+							}
+						}
+					}
+					bValid = bValid && (!IsUsed(Copy) || Target != ~0u);
+					Targets.push_back(Target);
+					Copy = NextCopy[Copy];
+				}
+				while (Copy != GroupFrom && bValid);
+				if (!bValid)
+				{
+					continue;
+				}
+
+				bool bFlips = false;
+				uint32 NumShared = 0;
+				const float* To = GetStrided(Positions, PositionStride, Collapse.To);
+				Copy = GroupFrom;
+				do
+				{
+					for (uint32 Entry = TriangleOffsets[Copy]; Entry < TriangleOffsets[Copy + 1] && !bFlips; ++Entry)
+					{
+						const uint32* Triangle = &OutIndices[VertexTriangles[Entry] * 3];
+						if (Groups[Triangle[0]] == GroupTo || Groups[Triangle[1]] == GroupTo || Groups[Triangle[2]] == GroupTo)
+						{
+							++NumShared;
+							continue;
+						}
+
+						const float* P[3];
+						const float* Moved[3];
+						for (uint32 Corner = 0; Corner < 3; ++Corner)
+						{
+							P[Corner] = GetStrided(Positions, PositionStride, Triangle[Corner]);
+							Moved[Corner] = Triangle[Corner] == Copy ? To : P[Corner];
+						}
+						FVector3 Before = GetTriangleNormal(P[0], P[1], P[2]);
+						FVector3 After = GetTriangleNormal(Moved[0], Moved[1], Moved[2]);
+						bFlips = Before.x * After.x + Before.y * After.y + Before.z * After.z <= 0;
+					}
+					Copy = NextCopy[Copy];
+				}
+				while (Copy != GroupFrom && !bFlips);
+				if (bFlips || NumShared == 0)
+				{
+					continue;
+				}
+
+				uint32 TargetIndex = 0;
+				Copy = GroupFrom;
+				do
+				{
+					for (uint32 Entry = TriangleOffsets[Copy]; Entry < TriangleOffsets[Copy + 1]; ++Entry)
+					{
+						const uint32* Triangle = &OutIndices[VertexTriangles[Entry] * 3];
+						bTouched[Groups[Triangle[0]]] = 1;
+						bTouched[Groups[Triangle[1]]] = 1;
+						bTouched[Groups[Triangle[2]]] = 1;
+					}
+					if (IsUsed(Copy))
+					{
+						Remap[Copy] = Targets[TargetIndex];
+					}
+					++TargetIndex;
+					Copy = NextCopy[Copy];
+				}
+				while (Copy != GroupFrom);
+				Quadrics[GroupTo].Add(Quadrics[GroupFrom]);
+				MaxError = Collapse.Error > MaxError ? Collapse.Error : MaxError;
+				NumRemoved += NumShared * 3;
+				++NumCollapsed;
+			}
+
+			if (!NumCollapsed)
+			{
+				break;
+			}
+
+			uint32 NewCount = 0;
+			for (uint32 Index = 0; Index < Count; Index += 3)
+			{
+				uint32 A = Remap[OutIndices[Index + 0]];
+				uint32 B = Remap[OutIndices[Index + 1]];
+				uint32 C = Remap[OutIndices[Index + 2]];
+				if (A != B && B != C && C != A)
+				{
+					OutIndices[NewCount++] = A;
+					OutIndices[NewCount++] = B;
+					OutIndices[NewCount++] = C;
+				}
+			}
+			Count = NewCount;
+		}
+
+		if (OutError)
+		{
+			*OutError = (float)sqrt(MaxError);
+		}
+		return Count;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+namespace MeshOpt
+{
+	enum
+	{
+		// Post transform cache entries assumed by the optimizer and the stats
+		DefaultCacheSize = 16,
+
+		// Cluster limits; 124 triangles keeps the index data of a meshlet a multiple of 4
+		MaxMeshletVertices = 64,
+		MaxMeshletTriangles = 124,
+	};
+
+	// A run of consecutive triangles in an index buffer with the bounds needed to cull it as a whole
+	struct FMeshlet
+	{
+		// Bounding sphere
+		float Center[3];
+		float Radius;
+
+		uint32 FirstIndex;
+		uint32 NumIndices;
+	};
+
+	struct FCacheStats
+	{
+		// Vertex shader invocations per triangle, best case 0.5
+		float ACMR = 0;
+		// Vertex shader invocations per vertex, best case 1.0
+		float ATVR = 0;
+		uint32 NumMisses = 0;
+		uint32 NumTriangles = 0;
+		uint32 NumVertices = 0;
+	};
+
+	// Simulates a FIFO post transform cache over a triangle list
+	FCacheStats AnalyzeVertexCache(const uint32* Indices, uint32 NumIndices, uint32 NumVertices, uint32 CacheSize = DefaultCacheSize);
+
+	// Reorders triangles in place using Tipsify (Sander, Nehab & Barczak 2007)
+	void OptimizeVertexCache(uint32* Indices, uint32 NumIndices, uint32 NumVertices, uint32 CacheSize = DefaultCacheSize);
+
+	// Splits the (vertex cache optimized) triangles into clusters that barely raise the ACMR and sorts those so clusters facing
+	// outwards draw first; Threshold is how much worse than the original ACMR each cluster is allowed to get
+	void OptimizeOverdraw(uint32* Indices, uint32 NumIndices, const float* Positions, uint32 PositionStride, uint32 NumVertices, float Threshold = 1.05f, uint32 CacheSize = DefaultCacheSize);
+
+	// Area and angle weighted normals, shared by all vertices at the same position so UV seams stay smooth. Only vertices
+	// whose normal is all zeroes get written. Normals face along Cross(C - A, B - A) to match the OBJ importer
+	void GenerateSmoothNormals(const float* Positions, uint32 PositionStride, float* Normals, uint32 NormalStride, uint32 NumVertices, const uint32* Indices, uint32 NumIndices);
+
+	// Per vertex tangents (xyz) orthogonal to the normal, with the bitangent sign in w; OutTangents has 4 floats per vertex
+	void GenerateTangents(const float* Positions, uint32 PositionStride, const float* Normals, uint32 NormalStride, const float* UVs, uint32 UVStride, uint32 NumVertices, const uint32* Indices, uint32 NumIndices, float* OutTangents);
+
+	// Reorders vertices in the order the indices first use them and remaps the indices; unused vertices are dropped.
+	// Returns the new number of vertices
+	uint32 OptimizeVertexFetch(void* Vertices, uint32 VertexSize, uint32 NumVertices, uint32* Indices, uint32 NumIndices);
+
+	// Greedily splits the triangles into meshlets in index buffer order, so the index buffer doesn't change and each
+	// meshlet is a plain index range. Run it after the other optimizations so the clusters are spatially coherent
+	void BuildMeshlets(const uint32* Indices, uint32 NumIndices, const float* Positions, uint32 PositionStride, uint32 NumVertices, std::vector<FMeshlet>& OutMeshlets,
+		uint32 MaxVertices = MaxMeshletVertices, uint32 MaxTriangles = MaxMeshletTriangles);
+
+	// Quadric error edge collapse (Garland & Heckbert 1997) that keeps the vertex buffer: vertices only collapse onto a
+	// neighbour. The copies of a vertex on a UV or hard normal seam move together and only along the seam, which is kept
+	// from bending by extra planes in the quadrics; vertices on borders or where seams meet never move. Stops at
+	// TargetNumIndices or before a collapse whose error is over TargetError. OutIndices needs room for NumIndices and may
+	// not alias Indices. Returns the number of indices written; OutError gets the error of the worst collapse, as a
+	// distance in position units
+	uint32 Simplify(const uint32* Indices, uint32 NumIndices, const float* Positions, uint32 PositionStride, uint32 NumVertices, uint32 TargetNumIndices, float TargetError, uint32* OutIndices, float* OutError = nullptr);
+}
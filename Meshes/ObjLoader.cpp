@@ -54,10 +54,463 @@ namespace Obj
 		return f;
 	}
 
+	static inline bool IsDigit(char C)
+	{
+		return C >= '0' && C <= '9';
+	}
+
+	static inline bool IsBlank(char C)
+	{
+		return C == ' ' || C == '\t' || C == '\r';
+	}
+
+	static inline const char* SkipBlanks(const char* Ptr, const char* End)
+	{
+		while (Ptr < End && IsBlank(*Ptr))
+		{
+			++Ptr;
+		}
+		return Ptr;
+	}
+
+	// Returns nullptr if there's no number at Ptr
+	static inline const char* ParseInt(const char* Ptr, const char* End, int32& Out)
+	{
+		bool bNegative = false;
+		if (Ptr < End && (*Ptr == '-' || *Ptr == '+'))
+		{
+			bNegative = *Ptr == '-';
+			++Ptr;
+		}
+
+		const char* Start = Ptr;
+		int32 Value = 0;
+		while (Ptr < End && IsDigit(*Ptr))
+		{
+			Value = Value * 10 + (*Ptr - '0');
+			++Ptr;
+		}
+
+		Out = bNegative ? -Value : Value;
+		return Ptr != Start ? Ptr : nullptr;
+	}
+
+	// Up to 19 significant digits go into an integer that gets scaled once, which is exact for the usual OBJ
+	// precision and doesn't depend on the locale like atof
+	static inline const char* ParseFloat(const char* Ptr, const char* End, float& Out)
+	{
+		static const double PowersOf10[] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+		};
+
+		bool bNegative = false;
+		if (Ptr < End && (*Ptr == '-' || *Ptr == '+'))
+		{
+			bNegative = *Ptr == '-';
+			++Ptr;
+		}
+
+		const char* Start = Ptr;
+		uint64 Mantissa = 0;
+		int32 NumDigits = 0;
+		int32 Exponent = 0;
+		while (Ptr < End && IsDigit(*Ptr))
+		{
+			if (NumDigits < 19)
+			{
+				Mantissa = Mantissa * 10 + (*Ptr - '0');
+				NumDigits += Mantissa != 0 ? 1 : 0;
+			}
+			else
+			{
+				++Exponent;
+			}
+			++Ptr;
+		}
+
+		if (Ptr < End && *Ptr == '.')
+		{
+			++Ptr;
+			while (Ptr < End && IsDigit(*Ptr))
+			{
+				if (NumDigits < 19)
+				{
+					Mantissa = Mantissa * 10 + (*Ptr - '0');
+					NumDigits += Mantissa != 0 ? 1 : 0;
+					--Exponent;
+				}
+				++Ptr;
+			}
+		}
+
+		if (Ptr == Start || (Ptr == Start + 1 && *Start == '.'))
+		{
+			return nullptr;
+		}
+
+		if (Ptr < End && (*Ptr == 'e' || *Ptr == 'E'))
+		{
+			int32 ExponentValue = 0;
+			const char* ExponentEnd = ParseInt(Ptr + 1, End, ExponentValue);
+			if (ExponentEnd)
+			{
+				Exponent += ExponentValue;
+				Ptr = ExponentEnd;
+			}
+		}
+
+		double Value = (double)Mantissa;
+		if (Exponent < 0)
+		{
+			Value = -Exponent <= 22 ? Value / PowersOf10[-Exponent] : Value * pow(10.0, Exponent);
+		}
+		else if (Exponent > 0)
+		{
+			Value = Exponent <= 22 ? Value * PowersOf10[Exponent] : Value * pow(10.0, Exponent);
+		}
+
+		Out = (float)(bNegative ? -Value : Value);
+		return Ptr;
+	}
+
+	static inline bool MatchKeyword(const char* Ptr, const char* End, const char* Keyword, size_t Length)
+	{
+		return (size_t)(End - Ptr) > Length && !memcmp(Ptr, Keyword, Length) && IsBlank(Ptr[Length]);
+	}
+
+	// What one thread parsed out of its part of the file. Negative indices can only be resolved against the start of
+	// the chunk, so those corners are listed in RelativeCorners and fixed up once the sizes of all chunks are known
+	struct FChunk
+	{
+		const char* Begin = nullptr;
+		const char* End = nullptr;
+
+		FObj Obj;
+
+		enum
+		{
+			CornerPos,
+			CornerUV,
+			CornerNormal,
+		};
+		// (Face * 3 + Corner) * 3 + Component
+		std::vector<uint32> RelativeCorners;
+
+		// Material of the faces before the first usemtl in this chunk comes from the previous chunks
+		bool bHasUseMaterial = false;
+		int32 LastMaterial = -1;
+
+		bool bError = false;
+		uint32 ErrorLine = 0;
+	};
+
+	// Parses 'Pos[/UV[/Normal]]' or 'Pos//Normal'; bit N of OutRelative is set when component N was a negative index,
+	// which is resolved against the counts of the chunk so far
+	static inline const char* ParseCorner(const char* Ptr, const char* End, const FObj& Obj, FFace::FCorner& OutCorner, uint8& OutRelative)
+	{
+		int32* Components[3] = { &OutCorner.Pos, &OutCorner.UV, &OutCorner.Normal };
+		int32 Counts[3] = { (int32)Obj.Vs.size(), (int32)Obj.VTs.size(), (int32)Obj.VNs.size() };
+		OutCorner.Pos = OutCorner.UV = OutCorner.Normal = -1;
+		OutRelative = 0;
+		for (uint32 Component = 0; Component < 3; ++Component)
+		{
+			int32 Value = 0;
+			const char* Next = ParseInt(Ptr, End, Value);
+			if (Next)
+			{
+				if (Value < 0)
+				{
+					*Components[Component] = Counts[Component] + Value;
+					OutRelative |= 1 << Component;
+				}
+				else if (Value > 0)
+				{
+					*Components[Component] = Value - 1;
+				}
+				Ptr = Next;
+			}
+			else if (Component == 0)
+			{
+				return nullptr;
+			}
+
+			if (Component == 2 || Ptr == End || *Ptr != '/')
+			{
+				break;
+			}
+			++Ptr;
+		}
+
+		return Ptr;
+	}
+
+	static void ParseChunk(FChunk& Chunk)
+	{
+		FObj& Obj = Chunk.Obj;
+		std::map<std::string, int32> MaterialLookup;
+		int32 CurrentMaterial = -1;
+		uint32 LineNumber = 0;
+		const char* Line = Chunk.Begin;
+		while (Line < Chunk.End)
+		{
+			const char* LineEnd = (const char*)memchr(Line, '\n', Chunk.End - Line);
+			LineEnd = LineEnd ? LineEnd : Chunk.End;
+			++LineNumber;
+
+			const char* Ptr = SkipBlanks(Line, LineEnd);
+			bool bValid = true;
+			if (Ptr == LineEnd || *Ptr == '#')
+			{
+			}
+			else if (MatchKeyword(Ptr, LineEnd, "v", 1) || MatchKeyword(Ptr, LineEnd, "vn", 2))
+			{
+				bool bNormal = Ptr[1] == 'n';
+				Ptr += bNormal ? 2 : 1;
+				FVector3 V;
+				Ptr = ParseFloat(SkipBlanks(Ptr, LineEnd), LineEnd, V.x);
+				Ptr = Ptr ? ParseFloat(SkipBlanks(Ptr, LineEnd), LineEnd, V.y) : nullptr;
+				Ptr = Ptr ? ParseFloat(SkipBlanks(Ptr, LineEnd), LineEnd, V.z) : nullptr;
+				bValid = Ptr != nullptr;
+				(bNormal ? Obj.VNs : Obj.Vs).push_back(V);
+			}
+			else if (MatchKeyword(Ptr, LineEnd, "vt", 2))
+			{
+				FVector2 V;
+				Ptr = ParseFloat(SkipBlanks(Ptr + 2, LineEnd), LineEnd, V.x);
+				bValid = Ptr != nullptr;
+				V.y = 0;
+				if (Ptr)
+				{
+					// v is optional
+					const char* Next = ParseFloat(SkipBlanks(Ptr, LineEnd), LineEnd, V.y);
+					V.y = Next ? V.y : 0;
+				}
+				Obj.VTs.push_back(V);
+			}
+			else if (MatchKeyword(Ptr, LineEnd, "f", 1))
+			{
+				const uint32 MaxCorners = 64;
+				FFace::FCorner Polygon[MaxCorners];
+				uint8 Relative[MaxCorners];
+				uint32 NumCorners = 0;
+				Ptr += 1;
+				while (bValid)
+				{
+					Ptr = SkipBlanks(Ptr, LineEnd);
+					if (Ptr == LineEnd)
+					{
+						break;
+					}
+
+					bValid = NumCorners < MaxCorners;
+					Ptr = bValid ? ParseCorner(Ptr, LineEnd, Obj, Polygon[NumCorners], Relative[NumCorners]) : nullptr;
+					bValid = Ptr != nullptr;
+					++NumCorners;
+				}
+				bValid = bValid && NumCorners >= 3;
+
+				// Triangulate as a fan
+				for (uint32 Index = 2; bValid && Index < NumCorners; ++Index)
+				{
+					const uint32 Corners[3] = { 0, Index - 1, Index };
+					FFace Face;
+					Face.Material = CurrentMaterial;
+					for (uint32 Corner = 0; Corner < 3; ++Corner)
+					{
+						Face.Corners[Corner] = Polygon[Corners[Corner]];
+						for (uint32 Component = 0; Component < 3; ++Component)
+						{
+							if (Relative[Corners[Corner]] & (1 << Component))
+							{
+								Chunk.RelativeCorners.push_back(((uint32)Obj.Faces.size() * 3 + Corner) * 3 + Component);
+							}
+						}
+					}
+					Obj.Faces.push_back(Face);
+				}
+			}
+			else if (MatchKeyword(Ptr, LineEnd, "usemtl", 6))
+			{
+				const char* Name = SkipBlanks(Ptr + 6, LineEnd);
+				const char* NameEnd = LineEnd;
+				while (NameEnd > Name && IsBlank(NameEnd[-1]))
+				{
+					--NameEnd;
+				}
+
+				std::string Material(Name, NameEnd);
+				auto Found = MaterialLookup.find(Material);
+				if (Found == MaterialLookup.end())
+				{
+					Found = MaterialLookup.insert(std::make_pair(Material, (int32)Obj.Materials.size())).first;
+					Obj.Materials.push_back(Material);
+				}
+				CurrentMaterial = Found->second;
+				Chunk.bHasUseMaterial = true;
+			}
+			else if (MatchKeyword(Ptr, LineEnd, "mtllib", 6))
+			{
+				const char* Name = SkipBlanks(Ptr + 6, LineEnd);
+				const char* NameEnd = LineEnd;
+				while (NameEnd > Name && IsBlank(NameEnd[-1]))
+				{
+					--NameEnd;
+				}
+				Obj.MaterialLibrary.assign(Name, NameEnd);
+			}
+			// Groups, objects, smoothing groups, etc are ignored
+
+			if (!bValid && !Chunk.bError)
+			{
+				Chunk.bError = true;
+				Chunk.ErrorLine = LineNumber;
+			}
+
+			Line = LineEnd + 1;
+		}
+
+		Chunk.LastMaterial = CurrentMaterial;
+	}
+
 	bool Load(const char* Filename, FObj& OutObj)
 	{
-		FILE* File = nullptr;
-		fopen_s(&File, Filename, "r");
+		FileUtils::FMappedFile File;
+		if (!File.Open(Filename))
+		{
+			return false;
+		}
+
+		// Split on line boundaries; small files end up in a single chunk
+		const size_t MinChunkSize = 256 * 1024;
+		uint32 NumThreads = std::thread::hardware_concurrency();
+		NumThreads = NumThreads > 0 ? NumThreads : 1;
+		size_t NumChunks = File.Size / MinChunkSize + 1;
+		NumChunks = NumChunks < NumThreads ? NumChunks : NumThreads;
+
+		std::vector<FChunk> Chunks;
+		const char* FileEnd = File.Data + File.Size;
+		const char* Begin = File.Data;
+		for (size_t Index = 0; Index < NumChunks && Begin < FileEnd; ++Index)
+		{
+			const char* End = Index + 1 == NumChunks ? FileEnd : Begin + File.Size / NumChunks;
+			End = End < FileEnd ? End : FileEnd;
+			const char* NewLine = (const char*)memchr(End, '\n', FileEnd - End);
+			End = NewLine ? NewLine + 1 : FileEnd;
+
+			FChunk Chunk;
+			Chunk.Begin = Begin;
+			Chunk.End = End;
+			Chunks.push_back(Chunk);
+			Begin = End;
+		}
+
+		ParallelFor((uint32)Chunks.size(), [&](uint32 Index)
+		{
+			ParseChunk(Chunks[Index]);
+		});
+
+		// Offsets of each chunk in the merged arrays, and the global index of its materials
+		struct FChunkBase
+		{
+			size_t Vs = 0;
+			size_t VTs = 0;
+			size_t VNs = 0;
+			size_t Faces = 0;
+			int32 InheritedMaterial = -1;
+			std::vector<int32> Materials;
+		};
+		std::vector<FChunkBase> Bases(Chunks.size());
+		std::map<std::string, int32> MaterialLookup;
+		FChunkBase Total;
+		for (size_t Index = 0; Index < Chunks.size(); ++Index)
+		{
+			FChunk& Chunk = Chunks[Index];
+			if (Chunk.bError)
+			{
+				char Error[256];
+				sprintf_s(Error, "*** Error parsing %s around line %u of chunk %u\n", Filename, Chunk.ErrorLine, (uint32)Index);
+				::OutputDebugStringA(Error);
+				return false;
+			}
+
+			FChunkBase& Base = Bases[Index];
+			Base.Vs = Total.Vs;
+			Base.VTs = Total.VTs;
+			Base.VNs = Total.VNs;
+			Base.Faces = Total.Faces;
+			Base.InheritedMaterial = Total.InheritedMaterial;
+			for (auto& Material : Chunk.Obj.Materials)
+			{
+				auto Found = MaterialLookup.find(Material);
+				if (Found == MaterialLookup.end())
+				{
+					Found = MaterialLookup.insert(std::make_pair(Material, (int32)OutObj.Materials.size())).first;
+					OutObj.Materials.push_back(Material);
+				}
+				Base.Materials.push_back(Found->second);
+			}
+
+			if (!Chunk.Obj.MaterialLibrary.empty())
+			{
+				OutObj.MaterialLibrary = Chunk.Obj.MaterialLibrary;
+			}
+
+			Total.Vs += Chunk.Obj.Vs.size();
+			Total.VTs += Chunk.Obj.VTs.size();
+			Total.VNs += Chunk.Obj.VNs.size();
+			Total.Faces += Chunk.Obj.Faces.size();
+			if (Chunk.bHasUseMaterial)
+			{
+				Total.InheritedMaterial = Base.Materials[Chunk.LastMaterial];
+			}
+		}
+
+		OutObj.Vs.resize(Total.Vs);
+		OutObj.VTs.resize(Total.VTs);
+		OutObj.VNs.resize(Total.VNs);
+		OutObj.Faces.resize(Total.Faces);
+
+		ParallelFor((uint32)Chunks.size(), [&](uint32 Index)
+		{
+			FObj& Obj = Chunks[Index].Obj;
+			const FChunkBase& Base = Bases[Index];
+			std::copy(Obj.Vs.begin(), Obj.Vs.end(), OutObj.Vs.begin() + Base.Vs);
+			std::copy(Obj.VTs.begin(), Obj.VTs.end(), OutObj.VTs.begin() + Base.VTs);
+			std::copy(Obj.VNs.begin(), Obj.VNs.end(), OutObj.VNs.begin() + Base.VNs);
+
+			// Positive indices are already absolute
+			for (uint32 Relative : Chunks[Index].RelativeCorners)
+			{
+				FFace::FCorner& Corner = Obj.Faces[Relative / 9].Corners[(Relative / 3) % 3];
+				switch (Relative % 3)
+				{
+				case FChunk::CornerPos:		Corner.Pos += (int32)Base.Vs; break;
+				case FChunk::CornerUV:		Corner.UV += (int32)Base.VTs; break;
+				case FChunk::CornerNormal:	Corner.Normal += (int32)Base.VNs; break;
+				default: break;
+				}
+			}
+
+			FFace* OutFace = &OutObj.Faces[Base.Faces];
+			for (FFace& Face : Obj.Faces)
+			{
+				Face.Material = Face.Material == -1 ? Base.InheritedMaterial : Base.Materials[Face.Material];
+				*OutFace++ = Face;
+			}
+		});
+
+		return true;
+	}
+
+	bool LoadLegacy(const char* Filename, FObj& OutObj)
+	{
+		FILE* File = OpenFile(Filename, "r");
+		if (!File)
+		{
+			return false;
+		}
 
 		while (!feof(File))
 		{
@@ -117,6 +570,7 @@ namespace Obj
 				{
 					const char* Ptr = Line + 2;
 					FFace Face;
+					Face.Material = -1;
 					for (uint32 Index = 0; Index < 3; ++Index)
 					{
 						{
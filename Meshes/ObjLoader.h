@@ -4,6 +4,7 @@ namespace Obj
 {
 	struct FFace
 	{
+		// Zero based; -1 when the face doesn't have that attribute
 		struct FCorner
 		{
 			int32 Pos;
@@ -11,6 +12,9 @@ namespace Obj
 			int32 Normal;
 		};
 		FCorner Corners[3];
+
+		// Index into FObj::Materials, -1 before the first usemtl
+		int32 Material;
 	};
 
 	struct FObj
@@ -19,7 +23,13 @@ namespace Obj
 		std::vector<FVector2> VTs;
 		std::vector<FVector3> VNs;
 		std::vector<FFace> Faces;
+		std::vector<std::string> Materials;
+		std::string MaterialLibrary;
 	};
 
+	// Maps the file and parses line aligned chunks of it in parallel; polygons are triangulated as fans
 	bool Load(const char* Filename, FObj& OutObj);
+
+	// The original fgets based loader; only handles v/vt/vn triangles. Kept to benchmark against
+	bool LoadLegacy(const char* Filename, FObj& OutObj);
 }
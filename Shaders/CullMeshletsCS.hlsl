@@ -0,0 +1,100 @@
+cbuffer ViewUB : register(b0)
+{
+	float4x4 ViewMtx;
+	float4x4 ProjectionMtx;
+};
+
+cbuffer ObjUB : register(b1)
+{
+	float4x4 ObjMtx;
+	float4 Tint;
+};
+
+// Meshlets of the LOD being drawn
+cbuffer CullUB : register(b2)
+{
+	uint FirstMeshlet;
+	uint NumMeshlets;
+};
+
+// See FMesh::FGPUMeshlet
+struct FMeshlet
+{
+	float4 Sphere;
+	uint FirstIndex;
+	uint NumIndices;
+	uint Batch;
+	uint Padding;
+};
+
+StructuredBuffer<FMeshlet> Meshlets : register(t3);
+StructuredBuffer<uint> InIndices : register(t4);
+RWStructuredBuffer<uint> OutIndices : register(u5);
+
+// VkDrawIndexedIndirectCommand, one per batch
+struct FDrawIndexedIndirect
+{
+	uint IndexCount;
+	uint InstanceCount;
+	uint FirstIndex;
+	int VertexOffset;
+	uint FirstInstance;
+};
+RWStructuredBuffer<FDrawIndexedIndirect> Draws : register(u6);
+
+bool IsSphereVisible(float3 Center, float Radius)
+{
+	// Clip space is -w <= x,y <= w and 0 <= z <= w, so the planes come straight from the projection rows
+	float4 Planes[6] =
+	{
+		ProjectionMtx[3] + ProjectionMtx[0],
+		ProjectionMtx[3] - ProjectionMtx[0],
+		ProjectionMtx[3] + ProjectionMtx[1],
+		ProjectionMtx[3] - ProjectionMtx[1],
+		ProjectionMtx[2],
+		ProjectionMtx[3] - ProjectionMtx[2],
+	};
+
+	for (int Index = 0; Index < 6; ++Index)
+	{
+		float Distance = dot(Planes[Index], float4(Center, 1)) / length(Planes[Index].xyz);
+		if (Distance < -Radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+[numthreads(64, 1, 1)]
+void Main(uint3 GlobalInvocationID : SV_DispatchThreadID)
+{
+	if (GlobalInvocationID.x >= NumMeshlets)
+	{
+		return;
+	}
+
+	FMeshlet Meshlet = Meshlets[FirstMeshlet + GlobalInvocationID.x];
+
+	// Everything in view space, where the eye is the origin
+	float3 Center = mul(ViewMtx, mul(ObjMtx, float4(Meshlet.Sphere.xyz, 1))).xyz;
+	float3 AxisX = mul(ViewMtx, mul(ObjMtx, float4(1, 0, 0, 0))).xyz;
+	float3 AxisY = mul(ViewMtx, mul(ObjMtx, float4(0, 1, 0, 0))).xyz;
+	float3 AxisZ = mul(ViewMtx, mul(ObjMtx, float4(0, 0, 1, 0))).xyz;
+	float Scale = sqrt(max(dot(AxisX, AxisX), max(dot(AxisY, AxisY), dot(AxisZ, AxisZ))));
+	float Radius = Meshlet.Sphere.w * Scale;
+
+	if (!IsSphereVisible(Center, Radius))
+	{
+		return;
+	}
+
+	uint Offset;
+	InterlockedAdd(Draws[Meshlet.Batch].IndexCount, Meshlet.NumIndices, Offset);
+	uint Dest = Draws[Meshlet.Batch].FirstIndex + Offset;
+	for (uint Index = 0; Index < Meshlet.NumIndices; ++Index)
+	{
+		OutIndices[Dest + Index] = InIndices[Meshlet.FirstIndex + Index];
+	}
+}
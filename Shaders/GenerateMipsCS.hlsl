@@ -0,0 +1,157 @@
+// Builds the whole mip chain in one dispatch, along the lines of AMD's single pass downsampler: each group box filters a
+// 64x64 tile of mip 0 down to one texel of mip 6 in groupshared memory, and the last group to finish carries on from mip 6
+// down to mip 12. See GenerateMips()
+
+// Written with vkCmdUpdateBuffer() before every dispatch
+cbuffer MipsUB : register(b0)
+{
+	// Of mip 0
+	uint2 Size;
+	uint NumMips;
+	uint NumGroups;
+};
+
+Texture2D<float4> InMip0 : register(t1);
+RWTexture2D<float4> OutMip1 : register(u2);
+RWTexture2D<float4> OutMip2 : register(u3);
+RWTexture2D<float4> OutMip3 : register(u4);
+RWTexture2D<float4> OutMip4 : register(u5);
+RWTexture2D<float4> OutMip5 : register(u6);
+RWTexture2D<float4> OutMip6 : register(u7);
+RWTexture2D<float4> OutMip7 : register(u8);
+RWTexture2D<float4> OutMip8 : register(u9);
+RWTexture2D<float4> OutMip9 : register(u10);
+RWTexture2D<float4> OutMip10 : register(u11);
+RWTexture2D<float4> OutMip11 : register(u12);
+RWTexture2D<float4> OutMip12 : register(u13);
+
+// Mip 6 again, 64x64 at most, so the last group can read it back without a storage image load
+globallycoherent RWStructuredBuffer<float4> Mip6 : register(u14);
+// Groups done so far; the last one puts it back to 0 for the next dispatch
+globallycoherent RWStructuredBuffer<uint> Counter : register(u15);
+
+groupshared float4 Tile[32 * 32];
+groupshared uint bLastGroup;
+
+void StoreMip(uint Mip, uint2 Pos, float4 Value)
+{
+	uint2 MipSize = max(Size >> Mip, 1);
+	if (Mip >= NumMips || any(Pos >= MipSize))
+	{
+		return;
+	}
+
+	switch (Mip)
+	{
+	case 1: OutMip1[Pos] = Value; break;
+	case 2: OutMip2[Pos] = Value; break;
+	case 3: OutMip3[Pos] = Value; break;
+	case 4: OutMip4[Pos] = Value; break;
+	case 5: OutMip5[Pos] = Value; break;
+	case 6: OutMip6[Pos] = Value; break;
+	case 7: OutMip7[Pos] = Value; break;
+	case 8: OutMip8[Pos] = Value; break;
+	case 9: OutMip9[Pos] = Value; break;
+	case 10: OutMip10[Pos] = Value; break;
+	case 11: OutMip11[Pos] = Value; break;
+	case 12: OutMip12[Pos] = Value; break;
+	}
+}
+
+float4 LoadMip0(int2 Pos)
+{
+	return InMip0.Load(int3(min(Pos, int2(Size) - 1), 0));
+}
+
+float4 LoadMip6(int2 Pos)
+{
+	int2 Mip6Size = max(Size >> 6, 1);
+	Pos = min(Pos, Mip6Size - 1);
+	return Mip6[Pos.y * 64 + Pos.x];
+}
+
+// Tile has the 32x32 texels of mip FirstMip at Origin; halves it five times, down to one texel of mip FirstMip + 5 in Tile[0]
+void ReduceTile(uint LocalIndex, uint FirstMip, uint2 Origin)
+{
+	uint Mip = FirstMip + 1;
+	for (uint TileSize = 16; TileSize >= 1; TileSize /= 2, ++Mip)
+	{
+		bool bActive = LocalIndex < TileSize * TileSize;
+		uint2 Pos = uint2(LocalIndex % TileSize, LocalIndex / TileSize);
+		float4 Value = 0;
+		if (bActive)
+		{
+			uint Stride = TileSize * 2;
+			uint Index = Pos.y * 2 * Stride + Pos.x * 2;
+			Value = (Tile[Index] + Tile[Index + 1] + Tile[Index + Stride] + Tile[Index + Stride + 1]) * 0.25;
+		}
+		GroupMemoryBarrierWithGroupSync();
+
+		if (bActive)
+		{
+			Tile[LocalIndex] = Value;
+			StoreMip(Mip, (Origin >> (Mip - FirstMip)) + Pos, Value);
+		}
+		GroupMemoryBarrierWithGroupSync();
+	}
+}
+
+[numthreads(256, 1, 1)]
+void Main(uint3 GroupID : SV_GroupID, uint LocalIndex : SV_GroupIndex)
+{
+	uint2 Origin = GroupID.xy * 32;
+
+	// Mip 1 straight from mip 0, 4 texels per thread
+	for (uint Quad = 0; Quad < 4; ++Quad)
+	{
+		uint Index = LocalIndex + Quad * 256;
+		uint2 Pos = uint2(Index % 32, Index / 32);
+		int2 Src = (Origin + Pos) * 2;
+		float4 Value = (LoadMip0(Src) + LoadMip0(Src + int2(1, 0)) + LoadMip0(Src + int2(0, 1)) + LoadMip0(Src + int2(1, 1))) * 0.25;
+		Tile[Index] = Value;
+		StoreMip(1, Origin + Pos, Value);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	ReduceTile(LocalIndex, 1, Origin);
+
+	if (NumMips <= 7)
+	{
+		return;
+	}
+
+	if (LocalIndex == 0)
+	{
+		Mip6[GroupID.y * 64 + GroupID.x] = Tile[0];
+		DeviceMemoryBarrier();
+
+		uint Previous;
+		InterlockedAdd(Counter[0], 1, Previous);
+		bLastGroup = Previous == NumGroups - 1 ? 1 : 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (!bLastGroup)
+	{
+		return;
+	}
+
+	if (LocalIndex == 0)
+	{
+		Counter[0] = 0;
+	}
+
+	// Every other group is done with mip 6, so this one goes on from there the same way
+	for (uint Quad = 0; Quad < 4; ++Quad)
+	{
+		uint Index = LocalIndex + Quad * 256;
+		uint2 Pos = uint2(Index % 32, Index / 32);
+		int2 Src = Pos * 2;
+		float4 Value = (LoadMip6(Src) + LoadMip6(Src + int2(1, 0)) + LoadMip6(Src + int2(0, 1)) + LoadMip6(Src + int2(1, 1))) * 0.25;
+		Tile[Index] = Value;
+		StoreMip(7, Pos, Value);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	ReduceTile(LocalIndex, 7, uint2(0, 0));
+}
@@ -0,0 +1,117 @@
+cbuffer ViewUB : register(b0)
+{
+	float4x4 ViewMtx;
+	float4x4 ProjectionMtx;
+};
+
+// See FImpostorUB
+cbuffer ImpostorUB : register(b1)
+{
+	// Object space bounding sphere the frames were baked around
+	float4 Bounds;
+	float4 CameraPos;
+	uint FramesPerSide;
+};
+
+// World position in xyz, rotation around Y in w (same as FMatrix4x4::GetRotationY())
+StructuredBuffer<float4> Instances : register(t2);
+
+SamplerState SS : register(s3);
+Texture2D ColorAtlas : register(t4);
+Texture2D NormalAtlas : register(t5);
+
+// Same subset of ELitMode as Lit.hlsl; everything else draws the albedo
+#define LIT_MODE_TEXTURE		0
+#define LIT_MODE_NORMAL			2
+#define LIT_MODE_N_DOT_L		3
+
+[[vk::constant_id(0)]] const int LitMode = LIT_MODE_TEXTURE;
+
+struct FVSOut
+{
+	float4 Pos : SV_POSITION;
+	float3 WorldPos : WORLDPOS;
+	float2 UVs : TEXCOORD0;
+	float Yaw : YAW;
+};
+
+float2 EncodeOctahedral(float3 N)
+{
+	float2 E = N.xy / (abs(N.x) + abs(N.y) + abs(N.z));
+	if (N.z < 0)
+	{
+		float2 Signs = float2(E.x >= 0 ? 1.0 : -1.0, E.y >= 0 ? 1.0 : -1.0);
+		E = (1 - abs(E.yx)) * Signs;
+	}
+	return E;
+}
+
+float3 DecodeOctahedral(float2 E)
+{
+	float3 N = float3(E.xy, 1 - abs(E.x) - abs(E.y));
+	if (N.z < 0)
+	{
+		float2 Signs = float2(N.x >= 0 ? 1.0 : -1.0, N.y >= 0 ? 1.0 : -1.0);
+		N.xy = (1 - abs(N.yx)) * Signs;
+	}
+	return normalize(N);
+}
+
+float3 RotateY(float3 V, float Yaw)
+{
+	float C = cos(Yaw);
+	float S = sin(Yaw);
+	return float3(V.x * C - V.z * S, V.y, V.x * S + V.z * C);
+}
+
+// Two triangles per instance, no vertex buffer
+FVSOut MainVS(uint VertexID : SV_VertexID, uint InstanceID : SV_InstanceID)
+{
+	static const float2 Corners[6] =
+	{
+		float2(-1, -1), float2(1, -1), float2(1, 1),
+		float2(-1, -1), float2(1, 1), float2(-1, 1),
+	};
+	float2 Corner = Corners[VertexID];
+
+	float4 Instance = Instances[InstanceID];
+	float3 Center = Instance.xyz + RotateY(Bounds.xyz, Instance.w);
+
+	// Pick the frame baked closest to the direction towards the camera, in object space
+	float3 ToCamera = RotateY(normalize(CameraPos.xyz - Center), -Instance.w);
+	float2 Frame = round((EncodeOctahedral(ToCamera) * 0.5 + 0.5) * (FramesPerSide - 1));
+	float3 FrameDir = DecodeOctahedral(Frame / (FramesPerSide - 1) * 2 - 1);
+
+	// Same basis as GetImpostorFrameView(), so the quad lines up with what the frame saw
+	float3 Up = abs(FrameDir.y) < 0.999 ? float3(0, 1, 0) : float3(0, 0, 1);
+	float3 X = normalize(cross(Up, FrameDir));
+	float3 Y = cross(FrameDir, X);
+	float3 Offset = (X * Corner.x + Y * Corner.y) * Bounds.w;
+
+	FVSOut Out;
+	Out.WorldPos = Center + RotateY(Offset, Instance.w);
+	Out.Pos = mul(ProjectionMtx, mul(ViewMtx, float4(Out.WorldPos, 1)));
+	Out.UVs = (Frame + Corner * 0.5 + 0.5) / FramesPerSide;
+	Out.Yaw = Instance.w;
+	return Out;
+}
+
+float4 MainPS(FVSOut In) : SV_Target
+{
+	float4 Color = ColorAtlas.Sample(SS, In.UVs);
+	clip(Color.a - 0.5);
+
+	float3 N = RotateY(normalize(NormalAtlas.Sample(SS, In.UVs).xyz * 2 - 1), In.Yaw);
+	if (LitMode == LIT_MODE_NORMAL)
+	{
+		return float4(N, 1);
+	}
+	else if (LitMode == LIT_MODE_N_DOT_L)
+	{
+		float3 LightPos = float3(-0.240983188, 6.91799545, -10);
+		float3 L = -normalize(LightPos - In.WorldPos);
+		return float4(max(0, dot(N, L)).xxx, 1);
+	}
+
+	return float4(Color.rgb, 1);
+}
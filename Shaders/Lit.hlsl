@@ -10,12 +10,43 @@ cbuffer ObjUB : register(b1)
 	float4 Tint;
 };
 
+#ifndef QUANTIZED_VERTICES
+#define QUANTIZED_VERTICES 0
+#endif
+
+#if QUANTIZED_VERTICES
+// See FQuantizedPosNormalUVVertex
+cbuffer QuantizationUB : register(b7)
+{
+	float4 PositionMin;
+	float4 PositionScale;
+};
+
+struct FVSIn
+{
+	float4 Position : POSITION;		// UNORM16 inside the batch bounds
+	float2 Normal : NORMAL;			// Octahedral SNORM16
+	float2 UVs : TEXCOORD0;			// Half floats
+};
+
+float3 DecodeOctahedral(float2 E)
+{
+	float3 N = float3(E.xy, 1 - abs(E.x) - abs(E.y));
+	if (N.z < 0)
+	{
+		float2 Signs = float2(N.x >= 0 ? 1.0 : -1.0, N.y >= 0 ? 1.0 : -1.0);
+		N.xy = (1 - abs(N.yx)) * Signs;
+	}
+	return normalize(N);
+}
+#else
 struct FVSIn
 {
 	float3 Position : POSITION;
 	float3 Normal : NORMAL;
 	float2 UVs : TEXCOORD0;
 };
+#endif
 
 struct FVSOut
 {
@@ -26,26 +57,49 @@ struct FVSOut
 	float3 Normal : NORMAL;
 };
 
-#if 0
+// Permutations, see LitPSO in LoadShadersAndGeometry():
+// QUANTIZED_VERTICES is a compile time define for the VS used by LitQuantizedPSO
+// LIT_BRDF is a compile time define that adds the Disney BRDF and its DataUB
+// LitMode is a specialization constant (ELitMode) picking what MainPS outputs
+// IMPOSTOR_BAKE is a compile time define for ImpostorBakePSO; MainPS alpha tests and outputs the albedo, or the normal packed
+// to [0..1] for LIT_MODE_NORMAL, see BakeImpostor()
+#define LIT_MODE_TEXTURE		0
+#define LIT_MODE_NORMAL_TEXTURE	1
+#define LIT_MODE_NORMAL			2
+#define LIT_MODE_N_DOT_L		3
+#define LIT_MODE_BRDF			4
+
+[[vk::constant_id(0)]] const int LitMode = LIT_MODE_TEXTURE;
+
+#ifndef LIT_BRDF
+#define LIT_BRDF 0
+#endif
+
+#ifndef IMPOSTOR_BAKE
+#define IMPOSTOR_BAKE 0
+#endif
+
+#if LIT_BRDF
 // https://github.com/wdas/brdf/blob/master/src/brdfs/disney.brdf
 
+// Defaults are set in FLitDataUB
 cbuffer DataUB : register(b2)
 {
-float3 baseColor = float3(0.82f, 0.67f, 0.16f);
-float metallic = 0;// 0 1
-float subsurface = 0;// 0 1
-float specular = 0.5;// 0 1
-float roughness = 0.5;// 0 1 
-float specularTint = 0; // 0 1
-float anisotropic = 0; //0 1
-float sheen = 0;// 0 1
-float sheenTint = 0.5;// 0 1
-float clearcoat = 0;// 0 1
-float clearcoatGloss = 1;// 0 1
+float3 baseColor;
+float metallic;// 0 1
+float subsurface;// 0 1
+float specular;// 0 1
+float roughness;// 0 1 
+float specularTint; // 0 1
+float anisotropic; //0 1
+float sheen;// 0 1
+float sheenTint;// 0 1
+float clearcoat;// 0 1
+float clearcoatGloss;// 0 1
 };
 
 
-const float PI = 3.14159265358979323846;
+static const float PI = 3.14159265358979323846;
 
 float sqr(float x) { return x*x; }
 
@@ -98,7 +152,7 @@ float3 BRDF( float3 L, float3 V, float3 N, float3 X, float3 Y )
 {
 	float NdotL = dot(N,L);
 	float NdotV = dot(N,V);
-	if (NdotL < 0 || NdotV < 0) return float3(0);
+	if (NdotL < 0 || NdotV < 0) return (float3)0;
 
 	float3 H = normalize(L+V);
 	float NdotH = dot(N,H);
@@ -107,9 +161,9 @@ float3 BRDF( float3 L, float3 V, float3 N, float3 X, float3 Y )
 	float3 Cdlin = mon2lin(baseColor);
 	float Cdlum = .3*Cdlin[0] + .6*Cdlin[1]  + .1*Cdlin[2]; // luminance approx.
 
-	float3 Ctint = Cdlum > 0 ? Cdlin/Cdlum : float3(1); // normalize lum. to isolate hue+sat
-	float3 Cspec0 = lerp(specular*.08*lerp(float3(1), Ctint, specularTint), Cdlin, metallic);
-	float3 Csheen = lerp(float3(1), Ctint, sheenTint);
+	float3 Ctint = Cdlum > 0 ? Cdlin/Cdlum : (float3)1; // normalize lum. to isolate hue+sat
+	float3 Cspec0 = lerp(specular*.08*lerp((float3)1, Ctint, specularTint), Cdlin, metallic);
+	float3 Csheen = lerp((float3)1, Ctint, sheenTint);
 
 	// Diffuse fresnel - go from 1 at normal incidence to .5 at grazing
 	// and mix in diffuse retro-reflection based on roughness
@@ -130,7 +184,7 @@ float3 BRDF( float3 L, float3 V, float3 N, float3 X, float3 Y )
 	float ay = max(.001, sqr(roughness)*aspect);
 	float Ds = GTR2_aniso(NdotH, dot(H, X), dot(H, Y), ax, ay);
 	float FH = SchlickFresnel(LdotH);
-	float3 Fs = lerp(Cspec0, float3(1), FH);
+	float3 Fs = lerp(Cspec0, (float3)1, FH);
 	float Gs;
 	Gs  = smithG_GGX_aniso(NdotL, dot(L, X), dot(L, Y), ax, ay);
 	Gs *= smithG_GGX_aniso(NdotV, dot(V, X), dot(V, Y), ax, ay);
@@ -152,11 +206,18 @@ float3 BRDF( float3 L, float3 V, float3 N, float3 X, float3 Y )
 FVSOut MainVS(FVSIn In)
 {
 	FVSOut Out;
-	float4 Position = mul(ObjMtx, float4(In.Position.xyz, 1.0));
+#if QUANTIZED_VERTICES
+	float3 InPosition = PositionMin.xyz + In.Position.xyz * PositionScale.xyz;
+	float3 InNormal = DecodeOctahedral(In.Normal);
+#else
+	float3 InPosition = In.Position.xyz;
+	float3 InNormal = In.Normal;
+#endif
+	float4 Position = mul(ObjMtx, float4(InPosition, 1.0));
 	Out.WorldPos = Position;
 	Position = mul(ViewMtx, Position);
 
-	Out.Normal = normalize(mul(ObjMtx, float4(In.Normal, 0)));
+	Out.Normal = normalize(mul(ObjMtx, float4(InNormal, 0)));
 
 	Out.UVs = In.UVs;
 	Out.CameraPos = Position;
@@ -169,24 +230,47 @@ Texture2D Tex : register(t4);
 SamplerState SSPoint : register(s5);
 Texture2D NormalTex : register(t6);
 
-float4 MainPS(FVSOut In)
+float4 MainPS(FVSOut In) : SV_Target
 {
-#if 1
-	return Tex.Sample(SSPoint, In.UVs);
-#elif 1
-	return NormalTex.Sample(SSPoint, In.UVs);
-#elif 1
-	return In.Normal.xyzz;
-#elif 1
+#if IMPOSTOR_BAKE
+	float4 Color = Tex.Sample(SS, In.UVs);
+	clip(Color.a - 0.5);
+	if (LitMode == LIT_MODE_NORMAL)
+	{
+		return float4(normalize(In.Normal) * 0.5 + 0.5, 1);
+	}
+	return float4(Color.rgb, 1);
+#endif
+
+	if (LitMode == LIT_MODE_TEXTURE)
+	{
+		return Tex.Sample(SSPoint, In.UVs);
+	}
+	else if (LitMode == LIT_MODE_NORMAL_TEXTURE)
+	{
+		return NormalTex.Sample(SSPoint, In.UVs);
+	}
+	else if (LitMode == LIT_MODE_NORMAL)
+	{
+		return In.Normal.xyzz;
+	}
+
 	float3 LightPos = float3(-0.240983188, 6.91799545, -10);
 	//float3 LightPosInCamSpace = LightPos - ViewMtx[0].xyz;
 
 	//float3 PosInCamSpace = In.CameraPos;
 
 	float3 L = -normalize(LightPos/*InCamSpace*/ - In.WorldPos);
-	//float3 V = -ViewMtx[2].xyz;
 	float3 N = normalize(In.Normal);
+#if LIT_BRDF
+	if (LitMode == LIT_MODE_BRDF)
+	{
+		float3 V = -ViewMtx[2].xyz;
+		float3 X = normalize(cross(abs(N.y) < 0.999 ? float3(0, 1, 0) : float3(1, 0, 0), N));
+		float3 Y = cross(N, X);
+		return float4(BRDF(L, V, N, X, Y) * max(0, dot(N, L)), 1);
+	}
+#endif
 	float NdotL = max(0, dot(N, L));
 	return float4(NdotL.xxx, 1);
-#endif
 }
@@ -203,9 +203,21 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT Message, WPARAM wParam, LPARAM lParam)
 			case 'm':
 				GRequestControl.DoMSAA = !GRequestControl.DoMSAA;
 				break;
+			case 'C':
+			case 'c':
+				GRequestControl.DoClusterCulling = !GRequestControl.DoClusterCulling;
+				break;
+			case 'F':
+			case 'f':
+				GRequestControl.DoCameraPath = !GRequestControl.DoCameraPath;
+				break;
 			case '.':
 				GRequestControl.DoRecompileShaders = true;
 				break;
+			case 'L':
+			case 'l':
+				GRequestControl.LitMode = (ELitMode)(((uint32)GRequestControl.LitMode + 1) % (uint32)ELitMode::Num);
+				break;
 			default:
 				break;
 			}
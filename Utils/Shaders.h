@@ -23,23 +23,31 @@ struct FComputePSO;
 struct FGfxPSO;
 struct FBasePipeline;
 
+// Name/value pairs prepended as #defines when compiling a permutation of a shader
+typedef std::vector<std::pair<std::string, std::string>> FShaderDefines;
+
 struct FShaderInfo
 {
 	FShaderHandle Handle;
 	std::string SourceFile;
+	// Lives in CacheDir and is named after SourceHash, so identical shaders share one binary
 	std::string BinaryFile;
 	std::string AsmFile;
+	std::string CacheDir;
 	std::string Entry;
 	EShaderStage Stage = EShaderStage::Unknown;
+	FShaderDefines Defines;
+
+	// Hash of the preprocessed source (defines included), entry point, stage and compiler flags
+	uint64 SourceHash = 0;
+	std::string PreprocessedSource;
+
+	// SourceFile and every file it includes
+	std::vector<std::string> Dependencies;
 
 	bool NeedsRecompiling()
 	{
-		if (FileUtils::IsNewerThan(SourceFile, BinaryFile))
-		{
-			return true;
-		}
-
-		return false;
+		return SourceHash == 0 || !FileUtils::Exists(BinaryFile);
 	}
 
 	struct IShader* Shader = nullptr;
@@ -61,6 +69,170 @@ struct IShader
 	virtual void Destroy() = 0;
 };
 
+// All the compiled shaders packed into one file that gets mapped at startup, so shader modules can be created
+// straight from the mapping instead of reading every cache entry. Layout:
+//	FHeader
+//	FEntry[NumEntries]
+//	Zero terminated source file and entry point names
+//	SPIR-V for each entry, 4 byte aligned
+struct FShaderArchive
+{
+	enum
+	{
+		Magic = 0x41534b56,	// 'VKSA'
+		Version = 1,
+	};
+
+	struct FHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumEntries;
+		uint32 Padding;
+	};
+
+	struct FEntry
+	{
+		uint64 Hash;
+		uint32 Stage;
+		uint32 NameOffset;
+		uint32 EntryPointOffset;
+		uint32 CodeOffset;
+		uint32 CodeSize;
+		uint32 Padding;
+	};
+
+	bool Open(const std::string& Filename)
+	{
+		Close();
+		if (!File.Open(Filename.c_str()))
+		{
+			return false;
+		}
+
+		const FHeader* Header = (const FHeader*)File.Data;
+		if (File.Size < sizeof(FHeader) || Header->Magic != Magic || Header->Version != Version ||
+			(File.Size - sizeof(FHeader)) / sizeof(FEntry) < Header->NumEntries)
+		{
+			Close();
+			return false;
+		}
+
+		const FEntry* Entries = (const FEntry*)(Header + 1);
+		for (uint32 Index = 0; Index < Header->NumEntries; ++Index)
+		{
+			const FEntry& Entry = Entries[Index];
+			if (Entry.CodeOffset % 4 != 0 || Entry.CodeSize % 4 != 0 || Entry.CodeOffset > File.Size || Entry.CodeSize > File.Size - Entry.CodeOffset)
+			{
+				Close();
+				return false;
+			}
+			Lookup[Entry.Hash] = &Entry;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		Lookup.clear();
+		File.Close();
+	}
+
+	bool IsOpen() const
+	{
+		return File.IsOpen();
+	}
+
+	const FEntry* Find(uint64 Hash) const
+	{
+		auto Found = Lookup.find(Hash);
+		return Found != Lookup.end() ? Found->second : nullptr;
+	}
+
+	const char* GetCode(const FEntry& Entry) const
+	{
+		return File.Data + Entry.CodeOffset;
+	}
+
+	// Packs the cache entries of Infos; shaders sharing a hash are stored once
+	static void Build(const std::vector<FShaderInfo>& Infos, std::vector<char>& OutArchive)
+	{
+		std::vector<FEntry> Entries;
+		std::vector<const FShaderInfo*> EntryInfos;
+		std::vector<std::vector<char>> Binaries;
+		for (auto& Info : Infos)
+		{
+			bool bAlreadyAdded = false;
+			for (auto& Entry : Entries)
+			{
+				bAlreadyAdded = bAlreadyAdded || Entry.Hash == Info.SourceHash;
+			}
+
+			if (Info.SourceHash == 0 || bAlreadyAdded)
+			{
+				continue;
+			}
+
+			std::vector<char> Binary = LoadFile(Info.BinaryFile.c_str());
+			if (Binary.empty() || Binary.size() % 4 != 0)
+			{
+				continue;
+			}
+
+			FEntry Entry;
+			MemZero(Entry);
+			Entry.Hash = Info.SourceHash;
+			Entry.Stage = (uint32)Info.Stage;
+			Entries.push_back(Entry);
+			EntryInfos.push_back(&Info);
+			Binaries.push_back(std::move(Binary));
+		}
+
+		FHeader Header;
+		MemZero(Header);
+		Header.Magic = Magic;
+		Header.Version = Version;
+		Header.NumEntries = (uint32)Entries.size();
+
+		std::string Names;
+		size_t NamesOffset = sizeof(FHeader) + Entries.size() * sizeof(FEntry);
+		for (size_t Index = 0; Index < Entries.size(); ++Index)
+		{
+			Entries[Index].NameOffset = (uint32)(NamesOffset + Names.size());
+			Names.append(EntryInfos[Index]->SourceFile.c_str(), EntryInfos[Index]->SourceFile.size() + 1);
+			Entries[Index].EntryPointOffset = (uint32)(NamesOffset + Names.size());
+			Names.append(EntryInfos[Index]->Entry.c_str(), EntryInfos[Index]->Entry.size() + 1);
+		}
+
+		size_t CodeOffset = Align(NamesOffset + Names.size(), (size_t)4);
+		for (size_t Index = 0; Index < Entries.size(); ++Index)
+		{
+			Entries[Index].CodeOffset = (uint32)CodeOffset;
+			Entries[Index].CodeSize = (uint32)Binaries[Index].size();
+			CodeOffset += Binaries[Index].size();
+		}
+
+		OutArchive.clear();
+		OutArchive.resize(CodeOffset, 0);
+		memcpy(&OutArchive[0], &Header, sizeof(Header));
+		if (!Entries.empty())
+		{
+			memcpy(&OutArchive[sizeof(Header)], &Entries[0], Entries.size() * sizeof(FEntry));
+			memcpy(&OutArchive[NamesOffset], Names.data(), Names.size());
+		}
+
+		for (size_t Index = 0; Index < Entries.size(); ++Index)
+		{
+			memcpy(&OutArchive[Entries[Index].CodeOffset], &Binaries[Index][0], Binaries[Index].size());
+		}
+	}
+
+protected:
+	FileUtils::FMappedFile File;
+	std::map<uint64, const FEntry*> Lookup;
+};
+
 struct FShaderCollection
 {
 	void RegisterGfxPSO(const char* Name, FGfxPSO* PSO, IShader* Vertex, IShader* Pixel)
@@ -73,6 +245,18 @@ struct FShaderCollection
 		}
 	}
 
+	void AddShaderToPSO(IShader* Shader, FPSO* PSO)
+	{
+		if (Shader)
+		{
+			auto& PSOs = ShaderToPSOMap[Shader];
+			if (std::find(PSOs.begin(), PSOs.end(), PSO) == PSOs.end())
+			{
+				PSOs.push_back(PSO);
+			}
+		}
+	}
+
 	void RegisterComputePSO(const char* Name, FComputePSO* PSO, IShader* Compute)
 	{
 		ComputePSOs[Name] = PSO;
@@ -104,38 +288,392 @@ struct FShaderCollection
 	{
 		check(ShadersToDestroy.empty());
 
+		// Only the startup load goes through the archive; anything recompiled afterwards owns its binary
+		if (!bArchiveOpened && !ShaderInfos.empty())
+		{
+			bArchiveOpened = true;
+			ArchiveFile = FileUtils::MakePath(ShaderInfos.front().CacheDir, "Shaders.pak");
+			bArchiveDirty = !Archive.Open(ArchiveFile);
+		}
+
+		std::vector<FShaderInfo*> Candidates;
 		for (auto& ShaderInfo : ShaderInfos)
 		{
-			if (ShaderInfo.NeedsRecompiling())
+			Candidates.push_back(&ShaderInfo);
+		}
+
+		while (!Candidates.empty())
+		{
+			std::vector<FShaderInfo*> StaleShaders;
+			for (auto* Info : Candidates)
 			{
-				DoCompileFromSource(ShaderInfo);
+				UpdateSourceHash(*Info);
+				if (Info->Shader && Info->Shader->Info.SourceHash == Info->SourceHash)
+				{
+					continue;
+				}
+
+				const FShaderArchive::FEntry* ArchiveEntry = Archive.IsOpen() ? Archive.Find(Info->SourceHash) : nullptr;
+				if (ArchiveEntry)
+				{
+					SetBinary(*Info, Archive.GetCode(*ArchiveEntry), ArchiveEntry->CodeSize, true);
+					continue;
+				}
+
+				bArchiveDirty = true;
+				if (Info->NeedsRecompiling())
+				{
+					StaleShaders.push_back(Info);
+				}
+				else
+				{
+					DoCompileFromBinary(*Info);
+				}
 			}
-			else if (!ShaderInfo.Shader)
+
+			// Identical shaders map to the same cache entry, so only compile each of those once
+			std::vector<FShaderInfo*> Jobs;
+			std::vector<size_t> JobForShader;
+			std::map<std::string, size_t> BinaryToJob;
+			for (auto* Info : StaleShaders)
 			{
-				DoCompileFromBinary(ShaderInfo);
+				auto Found = BinaryToJob.find(Info->BinaryFile);
+				if (Info->SourceHash != 0 && Found != BinaryToJob.end())
+				{
+					JobForShader.push_back(Found->second);
+				}
+				else
+				{
+					JobForShader.push_back(Jobs.size());
+					BinaryToJob[Info->BinaryFile] = Jobs.size();
+					Jobs.push_back(Info);
+				}
 			}
+
+			// Running the compiler is the slow part and each shader writes its own output files, so do all of them at once;
+			// creating the modules stays on this thread
+			std::vector<std::string> Errors(Jobs.size());
+			std::vector<std::vector<char>> Binaries(Jobs.size());
+			std::vector<uint8> Compiled(Jobs.size(), 0);
+			ParallelFor((uint32)Jobs.size(), [&](uint32 Index)
+			{
+				if (Jobs[Index]->SourceHash == 0)
+				{
+					Errors[Index] = "Unable to read the source or one of its includes";
+				}
+				else if (DoCompileToBinary(*Jobs[Index], Binaries[Index], Errors[Index]))
+				{
+					Compiled[Index] = 1;
+					if (!WriteCacheEntry(Jobs[Index]->BinaryFile, Binaries[Index]))
+					{
+						// Not fatal, it'll just get compiled again next time
+						Errors[Index] = "Unable to write " + Jobs[Index]->BinaryFile;
+					}
+				}
+			});
+
+			std::vector<FShaderInfo*> FailedShaders;
+			std::string Report;
+			for (size_t Index = 0; Index < StaleShaders.size(); ++Index)
+			{
+				FShaderInfo* Info = StaleShaders[Index];
+				size_t Job = JobForShader[Index];
+				if (Compiled[Job])
+				{
+					SetBinary(*Info, &Binaries[Job][0], Binaries[Job].size(), false);
+				}
+				else
+				{
+					FailedShaders.push_back(Info);
+					if (Jobs[Job] == Info)
+					{
+						Report += Info->SourceFile + " (" + Info->Entry + "):\n";
+						Report += Errors[Job] + "\n";
+					}
+				}
+			}
+
+			if (FailedShaders.empty() || !ReportCompileErrors(Report))
+			{
+				break;
+			}
+
+			Candidates.swap(FailedShaders);
+		}
+
+		for (auto& ShaderInfo : ShaderInfos)
+		{
+			for (auto& Dependency : ShaderInfo.Dependencies)
+			{
+				SourceWatcher.Watch(FileUtils::GetPath(Dependency, true));
+			}
+		}
+
+		// A mapped archive can't be replaced, that waits for CloseArchive()
+		if (!Archive.IsOpen())
+		{
+			SaveArchive();
 		}
 
 		return ProcessPendingDeletions();
 	}
 
+	// Call once every shader created from the archive has been destroyed; writes a new one if it was out of date
+	void CloseArchive()
+	{
+		Archive.Close();
+		SaveArchive();
+		bArchiveOpened = false;
+	}
+
+	void SaveArchive()
+	{
+		if (!bArchiveDirty || ArchiveFile.empty())
+		{
+			return;
+		}
+
+		std::vector<char> Data;
+		FShaderArchive::Build(ShaderInfos, Data);
+		remove(ArchiveFile.c_str());
+		if (WriteCacheEntry(ArchiveFile, Data))
+		{
+			bArchiveDirty = false;
+		}
+	}
+
+	// True when a file in one of the directories holding shader sources or includes was saved
+	bool HaveSourcesChanged()
+	{
+		return SourceWatcher.HasChanged();
+	}
+
+	// Hashes the preprocessed source and points BinaryFile at its cache entry; returns false if a file couldn't be read
+	bool UpdateSourceHash(FShaderInfo& Info)
+	{
+		std::string Source;
+		for (auto& Define : Info.Defines)
+		{
+			Source += "#define " + Define.first + " " + Define.second + "\n";
+		}
+
+		Info.Dependencies.clear();
+		if (!PreprocessSource(Info.SourceFile, Source, Info.Dependencies))
+		{
+			Info.SourceHash = 0;
+			Info.BinaryFile.clear();
+			return false;
+		}
+
+		uint32 Stage = (uint32)Info.Stage;
+		uint64 Hash = Hash64(Source);
+		Hash = Hash64(Info.Entry, Hash);
+		Hash = Hash64(&Stage, sizeof(Stage), Hash);
+		Hash = Hash64(GetCompilerFlags(), Hash);
+
+		Info.SourceHash = Hash;
+		Info.PreprocessedSource.swap(Source);
+		Info.BinaryFile = FileUtils::MakePath(Info.CacheDir, ToHexString(Hash) + ".spv");
+		return true;
+	}
+
+	static bool WriteCacheEntry(const std::string& Filename, const std::vector<char>& Binary)
+	{
+		// Write to a temp file first so a crash can't leave a truncated entry behind
+		std::string TempFile = Filename + ".tmp";
+		if (!SaveFile(TempFile.c_str(), Binary.data(), Binary.size()))
+		{
+			return false;
+		}
+
+		if (rename(TempFile.c_str(), Filename.c_str()) != 0)
+		{
+			remove(TempFile.c_str());
+			return FileUtils::Exists(Filename);
+		}
+
+		return true;
+	}
+
+	// Inlines #includes (relative to the including file) and drops comments so the output only changes when the code does;
+	// #line directives keep compiler messages pointing at the original files
+	static bool PreprocessSource(const std::string& Filename, std::string& OutSource, std::vector<std::string>& OutDependencies, uint32 Depth = 0)
+	{
+		std::vector<char> File = LoadFile(Filename.c_str());
+		if (File.empty() || Depth > 32)
+		{
+			return false;
+		}
+
+		if (std::find(OutDependencies.begin(), OutDependencies.end(), Filename) == OutDependencies.end())
+		{
+			OutDependencies.push_back(Filename);
+		}
+
+		std::string LineFilename = Filename;
+		std::replace(LineFilename.begin(), LineFilename.end(), '\\', '/');
+		OutSource += "#line 1 \"" + LineFilename + "\"\n";
+
+		std::string Source = StripComments(File);
+		std::string Path = FileUtils::GetPath(Filename, true);
+		uint32 LineNumber = 0;
+		size_t Start = 0;
+		while (Start < Source.size())
+		{
+			size_t End = Source.find('\n', Start);
+			if (End == std::string::npos)
+			{
+				End = Source.size();
+			}
+
+			std::string Line = Source.substr(Start, End - Start);
+			Start = End + 1;
+			++LineNumber;
+
+			std::string Included;
+			if (ParseInclude(Line, Included))
+			{
+				if (!PreprocessSource(FileUtils::MakePath(Path, Included), OutSource, OutDependencies, Depth + 1))
+				{
+					return false;
+				}
+				OutSource += "#line " + std::to_string(LineNumber + 1) + " \"" + LineFilename + "\"\n";
+			}
+			else
+			{
+				OutSource += Line;
+				OutSource += '\n';
+			}
+		}
+
+		return true;
+	}
+
+	// Removes comments and carriage returns but keeps every line break
+	static std::string StripComments(const std::vector<char>& Text)
+	{
+		std::string Out;
+		Out.reserve(Text.size());
+		for (size_t Index = 0; Index < Text.size(); ++Index)
+		{
+			char Next = Index + 1 < Text.size() ? Text[Index + 1] : 0;
+			if (Text[Index] == '/' && Next == '/')
+			{
+				while (Index + 1 < Text.size() && Text[Index + 1] != '\n')
+				{
+					++Index;
+				}
+			}
+			else if (Text[Index] == '/' && Next == '*')
+			{
+				for (Index += 2; Index < Text.size() && !(Text[Index] == '*' && Index + 1 < Text.size() && Text[Index + 1] == '/'); ++Index)
+				{
+					if (Text[Index] == '\n')
+					{
+						Out += '\n';
+					}
+				}
+				++Index;
+			}
+			else if (Text[Index] != '\r' && Text[Index] != 0)
+			{
+				Out += Text[Index];
+			}
+		}
+		return Out;
+	}
+
+	static bool ParseInclude(const std::string& Line, std::string& OutFilename)
+	{
+		size_t Hash = Line.find_first_not_of(" \t");
+		if (Hash == std::string::npos || Line[Hash] != '#')
+		{
+			return false;
+		}
+
+		size_t Directive = Line.find_first_not_of(" \t", Hash + 1);
+		if (Directive == std::string::npos || Line.compare(Directive, 7, "include") != 0)
+		{
+			return false;
+		}
+
+		size_t Open = Line.find_first_of("\"<", Directive + 7);
+		size_t Close = Open == std::string::npos ? std::string::npos : Line.find_first_of("\">", Open + 1);
+		if (Close == std::string::npos)
+		{
+			return false;
+		}
+
+		OutFilename = Line.substr(Open + 1, Close - Open - 1);
+		return true;
+	}
+
+	// Filled in by ProcessPendingDeletions() with the PSOs that used a replaced shader; they have to be registered
+	// again and anything caching them must drop its references
+	std::set<FPSO*> InvalidatedPSOs;
+	std::vector<std::string> InvalidatedGfxPSOs;
+	std::vector<std::string> InvalidatedComputePSOs;
+
 	bool ProcessPendingDeletions()
 	{
+		InvalidatedPSOs.clear();
+		InvalidatedGfxPSOs.clear();
+		InvalidatedComputePSOs.clear();
+
 		// Gather Pipelines
-		std::set<FPSO*> PSOsToDestroy;
 		for (auto* Shader : ShadersToDestroy)
 		{
-			for (auto PSO : ShaderToPSOMap[Shader])
+			auto Found = ShaderToPSOMap.find(Shader);
+			if (Found != ShaderToPSOMap.end())
+			{
+				InvalidatedPSOs.insert(Found->second.begin(), Found->second.end());
+				ShaderToPSOMap.erase(Found);
+			}
+		}
+
+		// The other shader of a gfx PSO can stay, so remove the PSO from its list too
+		for (auto& Pair : ShaderToPSOMap)
+		{
+			auto& PSOs = Pair.second;
+			PSOs.erase(std::remove_if(PSOs.begin(), PSOs.end(), [&](FPSO* PSO) { return InvalidatedPSOs.count(PSO) != 0; }), PSOs.end());
+		}
+
+		for (auto It = GfxPSOs.begin(); It != GfxPSOs.end();)
+		{
+			if (InvalidatedPSOs.count((FPSO*)It->second))
+			{
+				InvalidatedGfxPSOs.push_back(It->first);
+				It = GfxPSOs.erase(It);
+			}
+			else
+			{
+				++It;
+			}
+		}
+
+		for (auto It = ComputePSOs.begin(); It != ComputePSOs.end();)
+		{
+			if (InvalidatedPSOs.count((FPSO*)It->second))
+			{
+				InvalidatedComputePSOs.push_back(It->first);
+				It = ComputePSOs.erase(It);
+			}
+			else
 			{
-				PSOsToDestroy.insert(PSO);
+				++It;
 			}
 		}
 
-		for (auto* PSO : PSOsToDestroy)
+		for (auto* PSO : InvalidatedPSOs)
 		{
 			DestroyAndDelete(PSO);
 		}
 
+		for (auto* Shader : ShadersToDestroy)
+		{
+			DestroyAndDelete(Shader);
+		}
+
 		bool bDeleted = !ShadersToDestroy.empty();
 		ShadersToDestroy.clear();
 		return bDeleted;
@@ -154,27 +692,75 @@ struct FShaderCollection
 		return Shader->Info.Entry;
 	}
 
-	FShaderHandle Register(const char* HlslFilename, EShaderStage InStage, const char* EntryPoint)
+	// Each distinct set of Defines is a separate permutation; registering the same one twice returns the same handle
+	FShaderHandle Register(const char* HlslFilename, EShaderStage InStage, const char* EntryPoint, const FShaderDefines& Defines = FShaderDefines())
 	{
 		//#todo: Mutex
 		FShaderInfo Info;
 		Info.Handle.ID = (int32_t)ShaderInfos.size();
 		Info.Entry = EntryPoint;
 		Info.Stage = InStage;
+		Info.Defines = Defines;
 		SetupFilenames(HlslFilename, Info);
 
+		for (auto& Existing : ShaderInfos)
+		{
+			if (Existing.SourceFile == Info.SourceFile && Existing.Entry == Info.Entry && Existing.Stage == Info.Stage && Existing.Defines == Info.Defines)
+			{
+				return Existing.Handle;
+			}
+		}
+
 		ShaderInfos.push_back(Info);
 		return Info.Handle;
 	}
 
-	virtual IShader* CreateShader(FShaderInfo& Info, std::vector<char>& Data) = 0;
+	// bPersistent means Code stays valid for the lifetime of the shader, so it doesn't need a copy
+	virtual IShader* CreateShader(FShaderInfo& Info, const char* Code, size_t CodeSize, bool bPersistent) = 0;
 
 	virtual void SetupFilenames(const std::string& OriginalFilename, FShaderInfo& Info) = 0;
 
-	virtual bool DoCompileFromBinary(FShaderInfo& Info) = 0;
-	virtual bool DoCompileFromSource(FShaderInfo& Info) = 0;
+	bool DoCompileFromBinary(FShaderInfo& Info)
+	{
+		std::vector<char> File = LoadFile(Info.BinaryFile.c_str());
+		if (File.empty())
+		{
+			check(0);
+			return false;
+		}
+
+		return SetBinary(Info, &File[0], File.size(), false);
+	}
+
+	bool SetBinary(FShaderInfo& Info, const char* Code, size_t CodeSize, bool bPersistent)
+	{
+		IShader* NewShader = CreateShader(Info, Code, CodeSize, bPersistent);
+		if (!NewShader)
+		{
+			// Keep running the previous version
+			return false;
+		}
+
+		// The old one goes away with the PSOs using it in ProcessPendingDeletions()
+		if (Info.Shader)
+		{
+			ShadersToDestroy.push_back(Info.Shader);
+		}
+		Info.Shader = NewShader;
+		return true;
+	}
+
+	// Everything besides the source that changes the generated code; part of the cache key
+	virtual std::string GetCompilerFlags() = 0;
+
+	// Compiles Info.PreprocessedSource; called from worker threads
+	virtual bool DoCompileToBinary(const FShaderInfo& Info, std::vector<char>& OutBinary, std::string& OutErrors) = 0;
+
+	// Returns true if the failed shaders should be compiled again
+	virtual bool ReportCompileErrors(const std::string& Errors) = 0;
 
 	virtual void DestroyAndDelete(FPSO* PSO) = 0;
+	virtual void DestroyAndDelete(IShader* Shader) = 0;
 
 	void Destroy(FShaderHandle& Handle)
 	{
@@ -184,4 +770,11 @@ struct FShaderCollection
 	}
 
 	std::vector<FShaderInfo> ShaderInfos;
+
+	FileUtils::FDirectoryWatcher SourceWatcher;
+
+	FShaderArchive Archive;
+	std::string ArchiveFile;
+	bool bArchiveOpened = false;
+	bool bArchiveDirty = false;
 };
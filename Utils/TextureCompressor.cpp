@@ -0,0 +1,485 @@
+#include "stdafx.h"
+#include "Util.h"
+#include "TextureCompressor.h"
+#include <float.h>
+#include <limits.h>
+
+namespace TexCompress
+{
+	// 4x4 texels, RGBA, row by row
+	struct FBlock
+	{
+		uint8 Texels[16][4];
+	};
+
+	static void LoadBlock(const uint8* RGBA, uint32 Width, uint32 Height, uint32 BlockX, uint32 BlockY, FBlock& Out)
+	{
+		for (uint32 Y = 0; Y < 4; ++Y)
+		{
+			uint32 SrcY = BlockY * 4 + Y;
+			SrcY = SrcY < Height ? SrcY : Height - 1;
+			for (uint32 X = 0; X < 4; ++X)
+			{
+				uint32 SrcX = BlockX * 4 + X;
+				SrcX = SrcX < Width ? SrcX : Width - 1;
+				memcpy(Out.Texels[Y * 4 + X], RGBA + ((size_t)SrcY * Width + SrcX) * 4, 4);
+			}
+		}
+	}
+
+	static float Clamp255(float Value)
+	{
+		return Value < 0 ? 0 : (Value > 255 ? 255 : Value);
+	}
+
+	// Ends of the texels' extent along their principal axis, over the first NumChannels channels
+	static void GetPrincipalEndpoints(const FBlock& Block, uint32 NumChannels, float OutMin[4], float OutMax[4])
+	{
+		float Mean[4] = { 0, 0, 0, 0 };
+		for (auto& Texel : Block.Texels)
+		{
+			for (uint32 Channel = 0; Channel < NumChannels; ++Channel)
+			{
+				Mean[Channel] += Texel[Channel] / 16.0f;
+			}
+		}
+
+		float Covariance[4][4] = {};
+		for (auto& Texel : Block.Texels)
+		{
+			for (uint32 Row = 0; Row < NumChannels; ++Row)
+			{
+				for (uint32 Column = 0; Column < NumChannels; ++Column)
+				{
+					Covariance[Row][Column] += (Texel[Row] - Mean[Row]) * (Texel[Column] - Mean[Column]);
+				}
+			}
+		}
+
+		// Power iteration, starting from the column of the channel that varies the most so it can't start orthogonal to the axis
+		uint32 Largest = 0;
+		for (uint32 Channel = 1; Channel < NumChannels; ++Channel)
+		{
+			Largest = Covariance[Channel][Channel] > Covariance[Largest][Largest] ? Channel : Largest;
+		}
+
+		float Axis[4] = { 0, 0, 0, 0 };
+		for (uint32 Channel = 0; Channel < NumChannels; ++Channel)
+		{
+			Axis[Channel] = Covariance[Channel][Largest];
+		}
+
+		for (uint32 Iteration = 0; Iteration < 8; ++Iteration)
+		{
+			float NewAxis[4] = { 0, 0, 0, 0 };
+			float Length = 0;
+			for (uint32 Row = 0; Row < NumChannels; ++Row)
+			{
+				for (uint32 Column = 0; Column < NumChannels; ++Column)
+				{
+					NewAxis[Row] += Covariance[Row][Column] * Axis[Column];
+				}
+				Length += NewAxis[Row] * NewAxis[Row];
+			}
+
+			if (Length < 1e-12f)
+			{
+				break;
+			}
+
+			Length = sqrtf(Length);
+			for (uint32 Channel = 0; Channel < NumChannels; ++Channel)
+			{
+				Axis[Channel] = NewAxis[Channel] / Length;
+			}
+		}
+
+		float MinT = 0;
+		float MaxT = 0;
+		for (auto& Texel : Block.Texels)
+		{
+			float T = 0;
+			for (uint32 Channel = 0; Channel < NumChannels; ++Channel)
+			{
+				T += (Texel[Channel] - Mean[Channel]) * Axis[Channel];
+			}
+			MinT = T < MinT ? T : MinT;
+			MaxT = T > MaxT ? T : MaxT;
+		}
+
+		for (uint32 Channel = 0; Channel < 4; ++Channel)
+		{
+			OutMin[Channel] = Channel < NumChannels ? Clamp255(Mean[Channel] + Axis[Channel] * MinT) : 255;
+			OutMax[Channel] = Channel < NumChannels ? Clamp255(Mean[Channel] + Axis[Channel] * MaxT) : 255;
+		}
+	}
+
+	static uint16 ToRGB565(const float Color[4])
+	{
+		auto Quantize = [](float Value, int Max)
+		{
+			int Quantized = (int)(Value * Max / 255.0f + 0.5f);
+			return Quantized < 0 ? 0 : (Quantized > Max ? Max : Quantized);
+		};
+		return (uint16)((Quantize(Color[0], 31) << 11) | (Quantize(Color[1], 63) << 5) | Quantize(Color[2], 31));
+	}
+
+	static void FromRGB565(uint16 Color, int Out[3])
+	{
+		int R = (Color >> 11) & 31;
+		int G = (Color >> 5) & 63;
+		int B = Color & 31;
+		Out[0] = (R << 3) | (R >> 2);
+		Out[1] = (G << 2) | (G >> 4);
+		Out[2] = (B << 3) | (B >> 2);
+	}
+
+	// Always the 4 color mode (Color0 > Color1), so BC3 can use it as is
+	static void CompressBC1Block(const FBlock& Block, uint8* Out)
+	{
+		float Min[4];
+		float Max[4];
+		GetPrincipalEndpoints(Block, 3, Min, Max);
+		uint16 Color0 = ToRGB565(Max);
+		uint16 Color1 = ToRGB565(Min);
+		if (Color0 < Color1)
+		{
+			uint16 Temp = Color0;
+			Color0 = Color1;
+			Color1 = Temp;
+		}
+
+		// Equal endpoints decode as the 3 color mode, where index 0 is still Color0
+		uint32 Indices = 0;
+		if (Color0 != Color1)
+		{
+			int Palette[4][3];
+			FromRGB565(Color0, Palette[0]);
+			FromRGB565(Color1, Palette[1]);
+			for (uint32 Channel = 0; Channel < 3; ++Channel)
+			{
+				Palette[2][Channel] = (2 * Palette[0][Channel] + Palette[1][Channel]) / 3;
+				Palette[3][Channel] = (Palette[0][Channel] + 2 * Palette[1][Channel]) / 3;
+			}
+
+			for (uint32 Index = 0; Index < 16; ++Index)
+			{
+				const uint8* Texel = Block.Texels[Index];
+				uint32 Best = 0;
+				int BestError = INT_MAX;
+				for (uint32 Entry = 0; Entry < 4; ++Entry)
+				{
+					int Error = 0;
+					for (uint32 Channel = 0; Channel < 3; ++Channel)
+					{
+						int Delta = Texel[Channel] - Palette[Entry][Channel];
+						Error += Delta * Delta;
+					}
+					Best = Error < BestError ? Entry : Best;
+					BestError = Error < BestError ? Error : BestError;
+				}
+				Indices |= Best << (Index * 2);
+			}
+		}
+
+		Out[0] = (uint8)Color0;
+		Out[1] = (uint8)(Color0 >> 8);
+		Out[2] = (uint8)Color1;
+		Out[3] = (uint8)(Color1 >> 8);
+		memcpy(Out + 4, &Indices, 4);
+	}
+
+	// One channel of the block into 8 bytes, in the 8 value mode (Value0 > Value1)
+	static void CompressBC4Block(const FBlock& Block, uint32 Channel, uint8* Out)
+	{
+		int Min = 255;
+		int Max = 0;
+		for (auto& Texel : Block.Texels)
+		{
+			Min = Texel[Channel] < Min ? Texel[Channel] : Min;
+			Max = Texel[Channel] > Max ? Texel[Channel] : Max;
+		}
+
+		// Equal values decode as the 6 value mode, where index 0 is still Value0
+		uint64 Indices = 0;
+		if (Max > Min)
+		{
+			int Palette[8];
+			Palette[0] = Max;
+			Palette[1] = Min;
+			for (int Step = 1; Step < 7; ++Step)
+			{
+				Palette[Step + 1] = ((7 - Step) * Max + Step * Min + 3) / 7;
+			}
+
+			for (uint32 Index = 0; Index < 16; ++Index)
+			{
+				int Value = Block.Texels[Index][Channel];
+				uint64 Best = 0;
+				int BestError = INT_MAX;
+				for (uint32 Entry = 0; Entry < 8; ++Entry)
+				{
+					int Error = (Value - Palette[Entry]) * (Value - Palette[Entry]);
+					Best = Error < BestError ? Entry : Best;
+					BestError = Error < BestError ? Error : BestError;
+				}
+				Indices |= Best << (Index * 3);
+			}
+		}
+
+		Out[0] = (uint8)Max;
+		Out[1] = (uint8)Min;
+		for (uint32 Byte = 0; Byte < 6; ++Byte)
+		{
+			Out[2 + Byte] = (uint8)(Indices >> (Byte * 8));
+		}
+	}
+
+	static const int BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Mode 6 endpoints are 7 bits per channel plus a p-bit shared by the channels, which becomes the low bit
+	struct FBC7Endpoint
+	{
+		int Quantized[4];
+		int PBit;
+		int Expanded[4];
+	};
+
+	static void QuantizeBC7Endpoint(const float Color[4], FBC7Endpoint& Out)
+	{
+		float BestError = FLT_MAX;
+		for (int PBit = 0; PBit < 2; ++PBit)
+		{
+			FBC7Endpoint Endpoint;
+			Endpoint.PBit = PBit;
+			float Error = 0;
+			for (uint32 Channel = 0; Channel < 4; ++Channel)
+			{
+				int Quantized = (int)((Clamp255(Color[Channel]) - PBit) / 2 + 0.5f);
+				Quantized = Quantized < 0 ? 0 : (Quantized > 127 ? 127 : Quantized);
+				Endpoint.Quantized[Channel] = Quantized;
+				Endpoint.Expanded[Channel] = (Quantized << 1) | PBit;
+				float Delta = Endpoint.Expanded[Channel] - Color[Channel];
+				Error += Delta * Delta;
+			}
+
+			if (Error < BestError)
+			{
+				BestError = Error;
+				Out = Endpoint;
+			}
+		}
+	}
+
+	// Returns the squared error of the block with the best index for each texel
+	static uint32 GetBC7Indices(const FBlock& Block, const FBC7Endpoint& Endpoint0, const FBC7Endpoint& Endpoint1, uint8 OutIndices[16])
+	{
+		int Palette[16][4];
+		for (uint32 Entry = 0; Entry < 16; ++Entry)
+		{
+			for (uint32 Channel = 0; Channel < 4; ++Channel)
+			{
+				Palette[Entry][Channel] = ((64 - BC7Weights4[Entry]) * Endpoint0.Expanded[Channel] + BC7Weights4[Entry] * Endpoint1.Expanded[Channel] + 32) >> 6;
+			}
+		}
+
+		uint32 TotalError = 0;
+		for (uint32 Index = 0; Index < 16; ++Index)
+		{
+			const uint8* Texel = Block.Texels[Index];
+			uint8 Best = 0;
+			int BestError = INT_MAX;
+			for (uint8 Entry = 0; Entry < 16; ++Entry)
+			{
+				int Error = 0;
+				for (uint32 Channel = 0; Channel < 4; ++Channel)
+				{
+					int Delta = Texel[Channel] - Palette[Entry][Channel];
+					Error += Delta * Delta;
+				}
+				Best = Error < BestError ? Entry : Best;
+				BestError = Error < BestError ? Error : BestError;
+			}
+			OutIndices[Index] = Best;
+			TotalError += (uint32)BestError;
+		}
+
+		return TotalError;
+	}
+
+	// Least squares endpoints for the given indices; returns false if all the texels use the same weight
+	static bool RefineBC7Endpoints(const FBlock& Block, const uint8 Indices[16], float OutColor0[4], float OutColor1[4])
+	{
+		float A = 0;
+		float B = 0;
+		float C = 0;
+		float D[4] = { 0, 0, 0, 0 };
+		float E[4] = { 0, 0, 0, 0 };
+		for (uint32 Index = 0; Index < 16; ++Index)
+		{
+			float T = BC7Weights4[Indices[Index]] / 64.0f;
+			A += (1 - T) * (1 - T);
+			B += (1 - T) * T;
+			C += T * T;
+			for (uint32 Channel = 0; Channel < 4; ++Channel)
+			{
+				D[Channel] += (1 - T) * Block.Texels[Index][Channel];
+				E[Channel] += T * Block.Texels[Index][Channel];
+			}
+		}
+
+		float Determinant = A * C - B * B;
+		if (fabsf(Determinant) < 1e-6f)
+		{
+			return false;
+		}
+
+		for (uint32 Channel = 0; Channel < 4; ++Channel)
+		{
+			OutColor0[Channel] = Clamp255((C * D[Channel] - B * E[Channel]) / Determinant);
+			OutColor1[Channel] = Clamp255((A * E[Channel] - B * D[Channel]) / Determinant);
+		}
+		return true;
+	}
+
+	struct FBitWriter
+	{
+		uint8* Out;
+		uint32 Bit = 0;
+
+		FBitWriter(uint8* InOut)
+			: Out(InOut)
+		{
+		}
+
+		void Write(uint32 Value, uint32 NumBits)
+		{
+			for (uint32 Index = 0; Index < NumBits; ++Index, ++Bit)
+			{
+				Out[Bit / 8] |= (uint8)(((Value >> Index) & 1) << (Bit % 8));
+			}
+		}
+	};
+
+	static void CompressBC7Block(const FBlock& Block, uint8* Out)
+	{
+		float Color0[4];
+		float Color1[4];
+		GetPrincipalEndpoints(Block, 4, Color0, Color1);
+
+		FBC7Endpoint Endpoint0;
+		FBC7Endpoint Endpoint1;
+		QuantizeBC7Endpoint(Color0, Endpoint0);
+		QuantizeBC7Endpoint(Color1, Endpoint1);
+		uint8 Indices[16];
+		uint32 Error = GetBC7Indices(Block, Endpoint0, Endpoint1, Indices);
+
+		// One least squares pass usually gets the endpoints off the extremes and closer to the clusters
+		if (Error > 0 && RefineBC7Endpoints(Block, Indices, Color0, Color1))
+		{
+			FBC7Endpoint Refined0;
+			FBC7Endpoint Refined1;
+			QuantizeBC7Endpoint(Color0, Refined0);
+			QuantizeBC7Endpoint(Color1, Refined1);
+			uint8 RefinedIndices[16];
+			if (GetBC7Indices(Block, Refined0, Refined1, RefinedIndices) < Error)
+			{
+				Endpoint0 = Refined0;
+				Endpoint1 = Refined1;
+				memcpy(Indices, RefinedIndices, sizeof(Indices));
+			}
+		}
+
+		// The first index is stored without its top bit, so it has to be in the first half of the palette
+		if (Indices[0] >= 8)
+		{
+			FBC7Endpoint Temp = Endpoint0;
+			Endpoint0 = Endpoint1;
+			Endpoint1 = Temp;
+			for (auto& Index : Indices)
+			{
+				Index = 15 - Index;
+			}
+		}
+
+		memset(Out, 0, 16);
+		FBitWriter Writer(Out);
+		Writer.Write(1 << 6, 7);
+		for (uint32 Channel = 0; Channel < 4; ++Channel)
+		{
+			Writer.Write(Endpoint0.Quantized[Channel], 7);
+			Writer.Write(Endpoint1.Quantized[Channel], 7);
+		}
+		Writer.Write(Endpoint0.PBit, 1);
+		Writer.Write(Endpoint1.PBit, 1);
+		for (uint32 Index = 0; Index < 16; ++Index)
+		{
+			Writer.Write(Indices[Index], Index == 0 ? 3 : 4);
+		}
+		check(Writer.Bit == 128);
+	}
+
+	uint32 GetBlockSize(EFormat Format)
+	{
+		return Format == EFormat::BC1 ? 8 : 16;
+	}
+
+	uint64 GetCompressedSize(EFormat Format, uint32 Width, uint32 Height)
+	{
+		return (uint64)((Width + 3) / 4) * ((Height + 3) / 4) * GetBlockSize(Format);
+	}
+
+	void Compress(EFormat Format, const uint8* RGBA, uint32 Width, uint32 Height, uint8* Out)
+	{
+		uint32 BlockSize = GetBlockSize(Format);
+		FBlock Block;
+		for (uint32 BlockY = 0; BlockY < (Height + 3) / 4; ++BlockY)
+		{
+			for (uint32 BlockX = 0; BlockX < (Width + 3) / 4; ++BlockX)
+			{
+				LoadBlock(RGBA, Width, Height, BlockX, BlockY, Block);
+				switch (Format)
+				{
+				case EFormat::BC1:
+					CompressBC1Block(Block, Out);
+					break;
+				case EFormat::BC3:
+					CompressBC4Block(Block, 3, Out);
+					CompressBC1Block(Block, Out + 8);
+					break;
+				case EFormat::BC5:
+					CompressBC4Block(Block, 0, Out);
+					CompressBC4Block(Block, 1, Out + 8);
+					break;
+				case EFormat::BC7:
+					CompressBC7Block(Block, Out);
+					break;
+				default:
+					check(0);
+					break;
+				}
+				Out += BlockSize;
+			}
+		}
+	}
+
+	void Downsample(const uint8* RGBA, uint32 Width, uint32 Height, uint8* Out)
+	{
+		uint32 OutWidth = Width > 1 ? Width / 2 : 1;
+		uint32 OutHeight = Height > 1 ? Height / 2 : 1;
+		for (uint32 Y = 0; Y < OutHeight; ++Y)
+		{
+			const uint8* Row0 = RGBA + (size_t)(Y * 2) * Width * 4;
+			const uint8* Row1 = RGBA + (size_t)(Y * 2 + 1 < Height ? Y * 2 + 1 : Y * 2) * Width * 4;
+			for (uint32 X = 0; X < OutWidth; ++X)
+			{
+				uint32 X0 = X * 2;
+				uint32 X1 = X0 + 1 < Width ? X0 + 1 : X0;
+				for (uint32 Channel = 0; Channel < 4; ++Channel)
+				{
+					*Out++ = (uint8)((Row0[X0 * 4 + Channel] + Row0[X1 * 4 + Channel] + Row1[X0 * 4 + Channel] + Row1[X1 * 4 + Channel] + 2) / 4);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+namespace TexCompress
+{
+	enum class EFormat
+	{
+		// RGB, 1 bit of alpha not used
+		BC1,
+		// BC1 color and BC4 alpha
+		BC3,
+		// Two BC4 channels, R and G; for normal maps
+		BC5,
+		// Mode 6 only: RGBA endpoints, 16 interpolated colors
+		BC7,
+	};
+
+	// Bytes per 4x4 block
+	uint32 GetBlockSize(EFormat Format);
+
+	// Bytes for a Width x Height image, rounded up to whole blocks
+	uint64 GetCompressedSize(EFormat Format, uint32 Width, uint32 Height);
+
+	// Compresses a RGBA8 image into blocks stored left to right, top to bottom. Blocks over the right or bottom edge repeat
+	// the last column or row
+	void Compress(EFormat Format, const uint8* RGBA, uint32 Width, uint32 Height, uint8* Out);
+
+	// 2x2 box filter into a max(1, Width / 2) x max(1, Height / 2) image; the last row or column of an odd size is dropped
+	void Downsample(const uint8* RGBA, uint32 Width, uint32 Height, uint8* Out);
+}
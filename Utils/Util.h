@@ -9,6 +9,24 @@
 #include <iomanip>
 #include <string>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#if !defined(_WIN32)
+#include <climits>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 
 typedef uint8_t uint8;
 typedef uint16_t uint16;
@@ -18,7 +36,11 @@ typedef int32_t int32;
 typedef uint64_t uint64;
 typedef int64_t int64;
 
+#if defined(_WIN32)
 #define check(x) if (!(x)) __debugbreak();
+#else
+#define check(x) if (!(x)) raise(SIGTRAP);
+#endif
 
 #define checkVk(r) check((r) == VK_SUCCESS)
 
@@ -26,27 +48,53 @@ typedef int64_t int64;
 template <typename T>
 inline void MemZero(T& Struct)
 {
-	ZeroMemory(&Struct, sizeof(T));
+	memset(&Struct, 0, sizeof(T));
+}
+
+inline FILE* OpenFile(const char* Filename, const char* Mode)
+{
+	FILE* File = nullptr;
+#if defined(_WIN32)
+	fopen_s(&File, Filename, Mode);
+#else
+	File = fopen(Filename, Mode);
+#endif
+	return File;
 }
 
 inline std::vector<char> LoadFile(const char* Filename)
 {
 	std::vector<char> Data;
 
-	FILE* File = nullptr;
-	fopen_s(&File, Filename, "rb");
+	FILE* File = OpenFile(Filename, "rb");
 	if (File)
 	{
 		fseek(File, 0, SEEK_END);
 		auto Size = ftell(File);
 		fseek(File, 0, SEEK_SET);
 		Data.resize(Size);
-		fread(&Data[0], 1, Size, File);
+		if (Size > 0)
+		{
+			fread(&Data[0], 1, Size, File);
+		}
 		fclose(File);
 	}
 	return Data;
 }
 
+inline bool SaveFile(const char* Filename, const void* Data, size_t Size)
+{
+	FILE* File = OpenFile(Filename, "wb");
+	if (!File)
+	{
+		return false;
+	}
+
+	bool bWritten = fwrite(Data, 1, Size, File) == Size;
+	fclose(File);
+	return bWritten;
+}
+
 inline void TrimWhiteSpace(std::string& S)
 {
 	char* P = &S[0];
@@ -116,6 +164,62 @@ inline std::vector<std::string> LoadFileIntoLines(const char* Filename)
 	return Data;
 }
 
+// 64 bit FNV-1a; pass a previous result as Seed to hash several buffers as one
+inline uint64 Hash64(const void* Data, size_t Size, uint64 Seed = 14695981039346656037ull)
+{
+	const uint8* Bytes = (const uint8*)Data;
+	uint64 Hash = Seed;
+	for (size_t Index = 0; Index < Size; ++Index)
+	{
+		Hash ^= Bytes[Index];
+		Hash *= 1099511628211ull;
+	}
+	return Hash;
+}
+
+inline uint64 Hash64(const std::string& String, uint64 Seed = 14695981039346656037ull)
+{
+	return Hash64(String.c_str(), String.size(), Seed);
+}
+
+inline std::string ToHexString(uint64 Value)
+{
+	char Buffer[32];
+	snprintf(Buffer, sizeof(Buffer), "%016llx", (unsigned long long)Value);
+	return Buffer;
+}
+
+// Calls Func(Index) for every Index in [0, NumItems) spreading the work over the hardware threads; the calling thread
+// takes part and only returns once every item has been processed
+template <typename TFunc>
+inline void ParallelFor(uint32 NumItems, TFunc Func)
+{
+	uint32 NumThreads = std::thread::hardware_concurrency();
+	NumThreads = NumThreads < NumItems ? NumThreads : NumItems;
+
+	std::atomic<uint32> NextItem(0);
+	auto Worker = [&]()
+	{
+		for (uint32 Index = NextItem++; Index < NumItems; Index = NextItem++)
+		{
+			Func(Index);
+		}
+	};
+
+	std::vector<std::thread> Threads;
+	for (uint32 Index = 1; Index < NumThreads; ++Index)
+	{
+		Threads.push_back(std::thread(Worker));
+	}
+
+	Worker();
+
+	for (auto& Thread : Threads)
+	{
+		Thread.join();
+	}
+}
+
 
 struct FVector2
 {
@@ -231,6 +335,11 @@ struct FVector3
 	}
 };
 
+inline float Dot(const FVector3& A, const FVector3& B)
+{
+	return A.x * B.x + A.y * B.y + A.z * B.z;
+}
+
 inline FVector3 Cross(const FVector3& A, const FVector3& B)
 {
 	FVector3 R;
@@ -412,6 +521,15 @@ struct FMatrix4x4
 		return New;
 	}
 
+	// Row vector times matrix, like mul(M, v) in the shaders
+	FVector3 TransformPosition(const FVector3& P) const
+	{
+		return FVector3(
+			P.x * Rows[0].x + P.y * Rows[1].x + P.z * Rows[2].x + Rows[3].x,
+			P.x * Rows[0].y + P.y * Rows[1].y + P.z * Rows[2].y + Rows[3].y,
+			P.x * Rows[0].z + P.y * Rows[1].z + P.z * Rows[2].z + Rows[3].z);
+	}
+
 	static FMatrix4x4 GetZero()
 	{
 		FMatrix4x4 New;
@@ -490,6 +608,70 @@ inline uint32 PackNormalToU32(const FVector3& V)
 	return Out;
 };
 
+// Octahedral encoding of a unit vector as two SNORM16 (x in the low bits), see VK_FORMAT_R16G16_SNORM
+inline uint32 PackNormalOctahedral(const FVector3& V)
+{
+	float L1 = fabsf(V.x) + fabsf(V.y) + fabsf(V.z);
+	float X = L1 > 0 ? V.x / L1 : 0;
+	float Y = L1 > 0 ? V.y / L1 : 0;
+	if (V.z < 0)
+	{
+		float FoldedX = (1.0f - fabsf(Y)) * (X >= 0 ? 1.0f : -1.0f);
+		float FoldedY = (1.0f - fabsf(X)) * (Y >= 0 ? 1.0f : -1.0f);
+		X = FoldedX;
+		Y = FoldedY;
+	}
+
+	auto ToSNorm16 = [](float f)
+	{
+		f = f < -1.0f ? -1.0f : (f > 1.0f ? 1.0f : f);
+		return (uint32)(uint16)(int16)(f * 32767.0f + (f >= 0 ? 0.5f : -0.5f));
+	};
+	return ToSNorm16(X) | (ToSNorm16(Y) << 16);
+}
+
+// Round to nearest even; values too small for a half denormal flush to zero
+inline uint16 FloatToHalf(float f)
+{
+	uint32 Bits;
+	memcpy(&Bits, &f, sizeof(Bits));
+	uint32 Sign = (Bits >> 16) & 0x8000;
+	uint32 Exponent = (Bits >> 23) & 0xff;
+	uint32 Mantissa = Bits & 0x7fffff;
+	if (Exponent == 0xff)
+	{
+		// Inf/NaN
+		return (uint16)(Sign | 0x7c00 | (Mantissa ? 0x200 : 0));
+	}
+
+	int32 HalfExponent = (int32)Exponent - 127 + 15;
+	if (HalfExponent >= 0x1f)
+	{
+		return (uint16)(Sign | 0x7c00);
+	}
+	else if (HalfExponent <= 0)
+	{
+		if (HalfExponent < -10)
+		{
+			return (uint16)Sign;
+		}
+		// Denormal
+		Mantissa |= 0x800000;
+		uint32 Shift = (uint32)(14 - HalfExponent);
+		uint32 Half = Mantissa >> Shift;
+		uint32 Remainder = Mantissa & ((1u << Shift) - 1);
+		uint32 HalfWay = 1u << (Shift - 1);
+		Half += (Remainder > HalfWay || (Remainder == HalfWay && (Half & 1))) ? 1 : 0;
+		return (uint16)(Sign | Half);
+	}
+
+	uint32 Half = ((uint32)HalfExponent << 10) | (Mantissa >> 13);
+	uint32 Remainder = Mantissa & 0x1fff;
+	// Carrying into the exponent is fine, including overflowing to infinity
+	Half += (Remainder > 0x1000 || (Remainder == 0x1000 && (Half & 1))) ? 1 : 0;
+	return (uint16)(Sign | Half);
+}
+
 inline FMatrix4x4 CalculateProjectionMatrix(float FOVRadians, float Aspect, float NearZ, float FarZ)
 {
 	const float HalfTanFOV = (float)tan(FOVRadians / 2.0);
@@ -534,9 +716,16 @@ inline uint32 ToRGB8Color(FVector3 V, uint8 Alpha)
 
 namespace FileUtils
 {
+#if defined(_WIN32)
+	const char PathSeparator = '\\';
+#else
+	const char PathSeparator = '/';
+#endif
+
 	// Returns Extension
 	inline std::string SplitPath(const std::string& FullPathToFilename, std::string& OutPath, std::string& OutFilename, bool bIncludeExtension)
 	{
+#if defined(_WIN32)
 		char Buffer[1024];
 		char* PtrFilename = nullptr;
 		::GetFullPathNameA(FullPathToFilename.c_str(), sizeof(Buffer), Buffer, &PtrFilename);
@@ -546,6 +735,14 @@ namespace FileUtils
 			OutPath.resize(PtrFilename - Buffer);
 			OutFilename = PtrFilename;
 		}
+#else
+		char Buffer[PATH_MAX];
+		// realpath() needs the file to exist; fall back to the path as given
+		OutPath = realpath(FullPathToFilename.c_str(), Buffer) ? Buffer : FullPathToFilename.c_str();
+		auto Separator = OutPath.rfind(PathSeparator);
+		OutFilename = OutPath.substr(Separator == std::string::npos ? 0 : Separator + 1);
+		OutPath.resize(Separator == std::string::npos ? 0 : Separator + 1);
+#endif
 
 		std::string Extension;
 
@@ -595,9 +792,9 @@ namespace FileUtils
 		{
 			Out = Root;
 			RemoveQuotes(Out);
-			if (Root.back() != '\\')
+			if (Root.back() != PathSeparator)
 			{
-				Out += '\\';
+				Out += PathSeparator;
 			}
 		}
 
@@ -605,6 +802,27 @@ namespace FileUtils
 		return Out;
 	}
 
+	// Absolute with . and .. resolved, and lower case on Windows, so two spellings of the same file compare equal
+	inline std::string GetCanonicalPath(const std::string& Filename)
+	{
+#if defined(_WIN32)
+		char Buffer[1024];
+		if (!::GetFullPathNameA(Filename.c_str(), sizeof(Buffer), Buffer, nullptr))
+		{
+			return Filename;
+		}
+		std::string Out = Buffer;
+		for (auto& Char : Out)
+		{
+			Char = Char == '/' ? PathSeparator : (char)tolower(Char);
+		}
+		return Out;
+#else
+		char Buffer[PATH_MAX];
+		return realpath(Filename.c_str(), Buffer) ? Buffer : Filename;
+#endif
+	}
+
 	inline std::string AddQuotes(const std::string& InPath)
 	{
 		std::string Path = InPath;
@@ -621,9 +839,32 @@ namespace FileUtils
 		return Path;
 	}
 
+	inline bool Exists(const std::string& Filename)
+	{
+#if defined(_WIN32)
+		return ::GetFileAttributesA(Filename.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+		struct stat Stat;
+		return stat(Filename.c_str(), &Stat) == 0;
+#endif
+	}
+
 	// Returns true is Src is newer than Dst or if Dst doesn't exist
 	inline bool IsNewerThan(const std::string& Src, const std::string& Dst)
 	{
+#if !defined(_WIN32)
+		struct stat SrcStat, DstStat;
+		if (stat(Src.c_str(), &SrcStat) != 0)
+		{
+			return false;
+		}
+		else if (stat(Dst.c_str(), &DstStat) != 0)
+		{
+			return true;
+		}
+
+		return SrcStat.st_mtime > DstStat.st_mtime;
+#else
 		HANDLE SrcHandle = ::CreateFileA(Src.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
 		if (SrcHandle == INVALID_HANDLE_VALUE)
 		{
@@ -669,7 +910,218 @@ namespace FileUtils
 		::CloseHandle(DstHandle);
 		::CloseHandle(SrcHandle);
 		return bResult;
+#endif
 	}
+
+	// Polls for files being created or written in a set of directories (not recursive); ReadDirectoryChanges-style
+	// change notifications on Windows, inotify elsewhere
+	struct FDirectoryWatcher
+	{
+		void Watch(const std::string& Directory)
+		{
+			if (!Directories.insert(Directory).second)
+			{
+				return;
+			}
+
+#if defined(_WIN32)
+			HANDLE Handle = ::FindFirstChangeNotificationA(Directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+			if (Handle != INVALID_HANDLE_VALUE)
+			{
+				Handles.push_back(Handle);
+			}
+#else
+			if (INotify == -1)
+			{
+				INotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			}
+
+			if (INotify != -1)
+			{
+				inotify_add_watch(INotify, Directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+			}
+#endif
+		}
+
+		// Returns true once something changed and then nothing else did for QuietTimeInMS, so files that are still
+		// being saved aren't picked up half written
+		bool HasChanged(uint32 QuietTimeInMS = 100)
+		{
+			bool bChanged = false;
+#if defined(_WIN32)
+			for (HANDLE Handle : Handles)
+			{
+				if (::WaitForSingleObject(Handle, 0) == WAIT_OBJECT_0)
+				{
+					bChanged = true;
+					::FindNextChangeNotification(Handle);
+				}
+			}
+#else
+			char Buffer[4096];
+			while (INotify != -1 && read(INotify, Buffer, sizeof(Buffer)) > 0)
+			{
+				bChanged = true;
+			}
+#endif
+			auto Now = std::chrono::steady_clock::now();
+			if (bChanged)
+			{
+				bPending = true;
+				LastChange = Now;
+			}
+			else if (bPending && std::chrono::duration_cast<std::chrono::milliseconds>(Now - LastChange).count() >= QuietTimeInMS)
+			{
+				bPending = false;
+				return true;
+			}
+
+			return false;
+		}
+
+		void Destroy()
+		{
+#if defined(_WIN32)
+			for (HANDLE Handle : Handles)
+			{
+				::FindCloseChangeNotification(Handle);
+			}
+			Handles.clear();
+#else
+			if (INotify != -1)
+			{
+				close(INotify);
+				INotify = -1;
+			}
+#endif
+			Directories.clear();
+			bPending = false;
+		}
+
+	protected:
+		std::set<std::string> Directories;
+#if defined(_WIN32)
+		std::vector<HANDLE> Handles;
+#else
+		int INotify = -1;
+#endif
+		bool bPending = false;
+		std::chrono::steady_clock::time_point LastChange;
+	};
+
+	// Read-only view of a whole file; Data stays valid until Close()
+	struct FMappedFile
+	{
+		const char* Data = nullptr;
+		size_t Size = 0;
+
+		bool Open(const char* Filename)
+		{
+			check(!Data);
+#if defined(_WIN32)
+			File = ::CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (File == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+
+			LARGE_INTEGER FileSize;
+			if (!::GetFileSizeEx(File, &FileSize) || FileSize.QuadPart == 0)
+			{
+				Close();
+				return false;
+			}
+
+			Mapping = ::CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!Mapping)
+			{
+				Close();
+				return false;
+			}
+
+			Data = (const char*)::MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!Data)
+			{
+				Close();
+				return false;
+			}
+			Size = (size_t)FileSize.QuadPart;
+#else
+			File = open(Filename, O_RDONLY | O_CLOEXEC);
+			if (File == -1)
+			{
+				return false;
+			}
+
+			struct stat Stat;
+			if (fstat(File, &Stat) != 0 || Stat.st_size == 0)
+			{
+				Close();
+				return false;
+			}
+
+			void* View = mmap(nullptr, (size_t)Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+			if (View == MAP_FAILED)
+			{
+				Close();
+				return false;
+			}
+			Data = (const char*)View;
+			Size = (size_t)Stat.st_size;
+#endif
+			return true;
+		}
+
+		~FMappedFile()
+		{
+			Close();
+		}
+
+		bool IsOpen() const
+		{
+			return Data != nullptr;
+		}
+
+		void Close()
+		{
+#if defined(_WIN32)
+			if (Data)
+			{
+				::UnmapViewOfFile(Data);
+			}
+			if (Mapping)
+			{
+				::CloseHandle(Mapping);
+				Mapping = nullptr;
+			}
+			if (File != INVALID_HANDLE_VALUE)
+			{
+				::CloseHandle(File);
+				File = INVALID_HANDLE_VALUE;
+			}
+#else
+			if (Data)
+			{
+				munmap((void*)Data, Size);
+			}
+			if (File != -1)
+			{
+				close(File);
+				File = -1;
+			}
+#endif
+			Data = nullptr;
+			Size = 0;
+		}
+
+	protected:
+#if defined(_WIN32)
+		HANDLE File = INVALID_HANDLE_VALUE;
+		HANDLE Mapping = nullptr;
+#else
+		int File = -1;
+#endif
+	};
 }
 
 
@@ -2,6 +2,7 @@
 
 #include "stdafx.h"
 #include <chrono>
+#include <float.h>
 #include "Vk.h"
 #include "VkMem.h"
 #include "VkResources.h"
@@ -15,6 +16,16 @@
 
 static FIni GIni;
 static std::string GModelName;
+static bool GBenchmarkObjLoaders = false;
+static bool GBenchmarkTextureLoading = false;
+static bool GQuantizeVertices = false;
+// -nobc keeps mesh textures as uncompressed RGBA8, with mips generated on the GPU
+static bool GCompressTextures = true;
+// -texturebudget=<MB> for the streamed mips of GModel's textures; -nostreaming keeps every mip resident
+static uint32 GTextureBudgetInMB = 256;
+static bool GStreamTextures = true;
+// -forest=N draws GModel N x N times; far instances switch to an impostor, see DrawForest()
+static uint32 GForestSize = 0;
 extern bool GRenderDoc;
 extern bool GVkTrace;
 extern bool GValidation;
@@ -36,8 +47,11 @@ FControl::FControl()
 	: StepDirection{0, 0, 0}
 	, CameraPos{-16, 0, -50, 1}
 	, ViewMode(EViewMode::Solid)
+	, LitMode(ELitMode::Texture)
 	, DoPost(!true)
 	, DoMSAA(false)
+	, DoClusterCulling(true)
+	, DoCameraPath(false)
 {
 }
 
@@ -94,6 +108,19 @@ struct FCamera
 };
 static FCamera GCamera;
 
+// See FControl::DoCameraPath; dollies straight back from the ini camera so every run draws the same frames
+static FCamera GCameraPathStart;
+static uint32 GCameraPathFrame = 0;
+static uint64 GCameraPathTriangles = 0;
+static uint64 GCameraPathTextureSize = 0;
+static uint64 GCameraPathPeakTextureSize = 0;
+static const uint32 CameraPathFrames = 600;
+static const float CameraPathDistance = 2000.0f;
+
+// Before any culling on the GPU
+static uint32 GNumTrianglesDrawn = 0;
+static uint32 GModelLOD = 0;
+
 static FInstance GInstance;
 static FDevice GDevice;
 static FMemManager GMemMgr;
@@ -104,13 +131,20 @@ static FSwapchain GSwapchain;
 static FDescriptorPool GDescriptorPool;
 static FStagingManager GStagingManager;
 static FQueryMgr GQueryMgr;
+static FDeferredDeletionQueue GDeferredDeletion;
+FImageViewCache GImageViewCache;
+static FSamplerCache GSamplerCache;
+static FTextureStreamer GTextureStreamer;
 static FVulkanShaderCollection GShaderCollection;
 
 static FObj GCubeObj;
 static FMesh GCube;
 static std::vector<FMeshInstance> GCubeInstances;
-static FObj GModelObj;
 static FMesh GModel;
+static FAsyncMeshLoader GModelLoader;
+// For the time to first frame
+static std::chrono::high_resolution_clock::time_point GInitStartTime;
+static bool GFirstFrameReported = false;
 static FVertexBuffer GFloorVB;
 static FIndexBuffer GFloorIB;
 struct FCreateFloorUB
@@ -137,6 +171,13 @@ struct FObjUB
 };
 static FUniformBuffer<FObjUB> GIdentityUB;
 
+struct FCullUB
+{
+	uint32 FirstMeshlet;
+	uint32 NumMeshlets;
+};
+static FUniformBuffer<FCullUB> GCullUB;
+
 struct FUIUB
 {
 	uint32 TextPosX;
@@ -147,6 +188,47 @@ struct FUIUB
 };
 static FUniformBuffer<FUIUB> GUIUB;
 
+struct FMipsUB
+{
+	uint32 Width;
+	uint32 Height;
+	uint32 NumMips;
+	uint32 NumGroups;
+};
+
+// Shared by every GenerateMips() call; barriers keep the calls in a command buffer from overlapping
+struct FGenerateMipsBuffers
+{
+	enum
+	{
+		MaxMips = 13,
+		MaxSize = 1 << (MaxMips - 1),
+	};
+
+	// Written with vkCmdUpdateBuffer() so a command buffer can have more than one call
+	FBuffer UB;
+	// 64x64 float4s, one per group
+	FBuffer Mip6;
+	// Groups done; zero at rest, the last group puts it back
+	FBuffer Counter;
+
+	void Create(VkDevice InDevice)
+	{
+		UB.Create(InDevice, sizeof(FMipsUB), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, __FILE__, __LINE__);
+		Mip6.Create(InDevice, 64 * 64 * sizeof(FVector4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, __FILE__, __LINE__);
+		Counter.Create(InDevice, sizeof(uint32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &GMemMgr, __FILE__, __LINE__);
+		*(uint32*)Counter.GetMappedData() = 0;
+	}
+
+	void Destroy()
+	{
+		UB.Destroy();
+		Mip6.Destroy();
+		Counter.Destroy();
+	}
+};
+static FGenerateMipsBuffers GGenerateMipsBuffers;
+
 struct FFontBuffer
 {
 	FBuffer Buffer;
@@ -183,11 +265,59 @@ struct FLitDataUB
 };
 static FUniformBuffer<FLitDataUB> GLitDataUB;
 
+// Octahedral impostor of a mesh, see BakeImpostor(). Frame (X, Y) of the atlases is an orthographic view of Bounds from
+// GetImpostorFrameDirection(X, Y)
+struct FImpostor
+{
+	enum
+	{
+		FramesPerSide = 8,
+		FrameSize = 128,
+		AtlasSize = FramesPerSide * FrameSize,
+		// Down to 8x8 texels per frame, so the coarser mips don't bleed much across frames
+		NumMips = 5,
+	};
+
+	// Albedo and the object space normal packed to [0..1]; alpha is coverage
+	FImage2DWithView Color;
+	FImage2DWithView Normal;
+	FVector4 Bounds;
+
+	void Destroy()
+	{
+		Normal.Destroy();
+		Color.Destroy();
+	}
+};
+static FImpostor GModelImpostor;
+
+struct FImpostorUB
+{
+	FVector4 Bounds;
+	FVector4 CameraPos;
+	uint32 FramesPerSide;
+	uint32 Padding[3];
+};
+static FUniformBuffer<FImpostorUB> GImpostorUB;
+
+struct FForestInstance
+{
+	FUniformBuffer<FObjUB> ObjUB;
+	// What Impostor.hlsl gets for the instance
+	FVector4 PositionAndYaw;
+	uint32 LOD = 0;
+	bool bImpostor = false;
+};
+static std::vector<FForestInstance> GForestInstances;
+// PositionAndYaw of the instances drawn as impostors this frame
+static FBuffer GForestImpostorInstances;
+
 static FImage2DWithView GCheckerboardTexture;
 static FImage2DWithView GHeightMap;
 static FImage2DWithView GGradient;
-static FSampler GTrilinearSampler;
-static FSampler GPointSampler;
+// Both from GSamplerCache
+static FSampler* GTrilinearSampler = nullptr;
+static FSampler* GPointSampler = nullptr;
 static FImageCubeWithView GCubeTest;
 
 struct FRenderTargetPool
@@ -402,6 +532,7 @@ FThread GThread;
 
 FVertexFormat GPosColorUVFormat;
 FVertexFormat GPosNormalUVFormat;
+FVertexFormat GQuantizedPosNormalUVFormat;
 
 bool GQuitting = false;
 
@@ -495,14 +626,14 @@ struct FObjectCache
 		default:
 			break;
 		}
-		NewPipeline->Create(Device->Device, Layout.GfxPSO, Layout.VF, Layout.Width, Layout.Height, Layout.RenderPass);
+		NewPipeline->Create(Device->Device, Layout.GfxPSO, Layout.VF, Layout.Width, Layout.Height, Layout.RenderPass, Layout.PermutationKey);
 		GfxPipelines[Layout] = NewPipeline;
 		return NewPipeline;
 	}
 
-	FGfxPipeline* GetOrCreateGfxPipeline(FGfxPSO* GfxPSO, FVertexFormat* VF, uint32 Width, uint32 Height, FRenderPass* RenderPass, bool bWireframe = false)
+	FGfxPipeline* GetOrCreateGfxPipeline(FGfxPSO* GfxPSO, FVertexFormat* VF, uint32 Width, uint32 Height, FRenderPass* RenderPass, bool bWireframe = false, uint32 PermutationKey = 0)
 	{
-		FGfxPSOLayout Layout(GfxPSO, VF, Width, Height, RenderPass, bWireframe);
+		FGfxPSOLayout Layout(GfxPSO, VF, Width, Height, RenderPass, bWireframe, PermutationKey);
 		return GetOrCreateGfxPipeline(Layout);
 	}
 
@@ -520,6 +651,34 @@ struct FObjectCache
 		return NewPipeline;
 	}
 
+	// The PSOs own their pipelines, so this only forgets about them
+	void EvictPSOs(const std::set<FPSO*>& PSOs)
+	{
+		for (auto It = GfxPipelines.begin(); It != GfxPipelines.end();)
+		{
+			if (PSOs.count((FPSO*)It->first.GfxPSO))
+			{
+				It = GfxPipelines.erase(It);
+			}
+			else
+			{
+				++It;
+			}
+		}
+
+		for (auto It = ComputePipelines.begin(); It != ComputePipelines.end();)
+		{
+			if (PSOs.count((FPSO*)It->first))
+			{
+				It = ComputePipelines.erase(It);
+			}
+			else
+			{
+				++It;
+			}
+		}
+	}
+
 	FRenderPass* GetOrCreateRenderPass(uint32 Width, uint32 Height, uint32 NumColorTargets, VkFormat* ColorFormats, VkFormat DepthStencilFormat = VK_FORMAT_UNDEFINED, VkSampleCountFlagBits InNumSamples = VK_SAMPLE_COUNT_1_BIT, FImage2DWithView* ResolveColorBuffer = nullptr, FImage2DWithView* ResolveDepth = nullptr)
 	{
 		FRenderPassLayout Layout(Width, Height, NumColorTargets, ColorFormats, DepthStencilFormat, InNumSamples, ResolveColorBuffer ? ResolveColorBuffer->GetFormat() : VK_FORMAT_UNDEFINED, ResolveDepth ? ResolveDepth->GetFormat() : VK_FORMAT_UNDEFINED);
@@ -578,28 +737,181 @@ struct FObjectCache
 FObjectCache GObjectCache;
 
 
+// Times Obj::Load against the loader it replaced and against tinyobj (which FMesh uses); best of a few runs each
+static void BenchmarkObjLoaders(const char* Filename)
+{
+	const uint32 NumRuns = 5;
+	auto Measure = [&](const char* Name, std::function<bool()> Load)
+	{
+		double BestTimeInMS = 0;
+		for (uint32 Run = 0; Run < NumRuns; ++Run)
+		{
+			auto Start = std::chrono::high_resolution_clock::now();
+			if (!Load())
+			{
+				return;
+			}
+			std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - Start;
+			BestTimeInMS = (Run == 0 || Time.count() < BestTimeInMS) ? Time.count() : BestTimeInMS;
+		}
+
+		char s[512];
+		sprintf_s(s, "*** %s: %s %.2f ms\n", Filename, Name, BestTimeInMS);
+		::OutputDebugStringA(s);
+	};
+
+	Measure("Obj::Load", [&]()
+	{
+		Obj::FObj Obj;
+		return Obj::Load(Filename, Obj);
+	});
+	Measure("Obj::LoadLegacy", [&]()
+	{
+		Obj::FObj Obj;
+		return Obj::LoadLegacy(Filename, Obj);
+	});
+	Measure("tinyobj", [&]()
+	{
+		FObj Obj;
+		bool bLoaded = Obj.Load(Filename);
+		Obj.Destroy();
+		return bLoaded;
+	});
+}
+
+// Times creating all the model's textures one at a time, each decoded and submitted on its own, against
+// FMesh::SetupTextures(); best of a few runs each
+static void BenchmarkTextureLoading(const char* Filename)
+{
+	FMeshSource Source;
+	if (!Source.Load(Filename))
+	{
+		return;
+	}
+
+	std::set<std::string> Names;
+	for (auto& Data : Source.BatchData)
+	{
+		for (const std::string* Name : { &Data.DiffuseTexture, &Data.BumpTexture })
+		{
+			if (!Name->empty())
+			{
+				Names.insert(*Name);
+			}
+		}
+	}
+
+	const uint32 NumRuns = 3;
+	auto Measure = [&](const char* Name, std::function<void(FMesh&)> Load)
+	{
+		double BestTimeInMS = 0;
+		for (uint32 Run = 0; Run < NumRuns; ++Run)
+		{
+			FMesh Mesh;
+			Mesh.bCompressTextures = GModel.bCompressTextures;
+			auto Start = std::chrono::high_resolution_clock::now();
+			Load(Mesh);
+			std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - Start;
+			BestTimeInMS = (Run == 0 || Time.count() < BestTimeInMS) ? Time.count() : BestTimeInMS;
+			Mesh.Destroy();
+
+			// Everything was waited on, so the next run can reuse the staging buffers
+			GStagingManager.Update();
+		}
+
+		char s[512];
+		sprintf_s(s, "*** %s: %d textures, %s %.2f ms\n", Filename, (int)Names.size(), Name, BestTimeInMS);
+		::OutputDebugStringA(s);
+	};
+
+	Measure("serial", [&](FMesh& Mesh)
+	{
+		for (auto& Name : Names)
+		{
+			std::vector<FDecodedTexture> Textures(1);
+			FMesh::ReadTexture(Source.BaseDir, Name, Mesh.bCompressTextures, Textures[0]);
+			FMesh::DecodeTexture(Textures[0]);
+			Mesh.CreateTextures(Textures, &GDevice, &GGfxCmdBufferMgr, &GStagingManager, &GMemMgr);
+		}
+	});
+	Measure("parallel", [&](FMesh& Mesh)
+	{
+		Mesh.SetupTextures(Source.BaseDir, Names, &GDevice, &GGfxCmdBufferMgr, &GStagingManager, &GMemMgr);
+	});
+}
+
 static bool LoadShadersAndGeometry()
 {
-	FShaderHandle PassThroughVS = GShaderCollection.Register("../Shaders/PassThroughVS.hlsl", EShaderStage::Vertex, "MainVS");
 	FShaderHandle UnlitVS = GShaderCollection.Register("../Shaders/Unlit.hlsl", EShaderStage::Vertex, "MainVS");
 	FShaderHandle UnlitPS = GShaderCollection.Register("../Shaders/Unlit.hlsl", EShaderStage::Pixel, "MainPS");
 	FShaderHandle LitVS = GShaderCollection.Register("../Shaders/Lit.hlsl", EShaderStage::Vertex, "MainVS");
+	FShaderHandle LitQuantizedVS = GShaderCollection.Register("../Shaders/Lit.hlsl", EShaderStage::Vertex, "MainVS", { { "QUANTIZED_VERTICES", "1" } });
 	FShaderHandle LitPS = GShaderCollection.Register("../Shaders/Lit.hlsl", EShaderStage::Pixel, "MainPS");
+	FShaderHandle LitBRDFPS = GShaderCollection.Register("../Shaders/Lit.hlsl", EShaderStage::Pixel, "MainPS", { { "LIT_BRDF", "1" } });
 	FShaderHandle CreateFloorCS = GShaderCollection.Register("../Shaders/CreateFloorCS.hlsl", EShaderStage::Compute, "Main");
 	FShaderHandle TestPostCS = GShaderCollection.Register("../Shaders/TestPostCS.hlsl", EShaderStage::Compute, "Main");
 	FShaderHandle FillTextureCS = GShaderCollection.Register("../Shaders/FillTextureCS.hlsl", EShaderStage::Compute, "Main");
-	FShaderHandle GenerateMipsPS = GShaderCollection.Register("../Shaders/GenerateMipsPS.hlsl", EShaderStage::Pixel, "Main");
+	FShaderHandle GenerateMipsCS = GShaderCollection.Register("../Shaders/GenerateMipsCS.hlsl", EShaderStage::Compute, "Main");
 	FShaderHandle UICS = GShaderCollection.Register("../Shaders/UICS.hlsl", EShaderStage::Compute, "Main");
+	FShaderHandle CullMeshletsCS = GShaderCollection.Register("../Shaders/CullMeshletsCS.hlsl", EShaderStage::Compute, "Main");
+	FShaderHandle ImpostorBakePS = GShaderCollection.Register("../Shaders/Lit.hlsl", EShaderStage::Pixel, "MainPS", { { "IMPOSTOR_BAKE", "1" } });
+	FShaderHandle ImpostorVS = GShaderCollection.Register("../Shaders/Impostor.hlsl", EShaderStage::Vertex, "MainVS");
+	FShaderHandle ImpostorPS = GShaderCollection.Register("../Shaders/Impostor.hlsl", EShaderStage::Pixel, "MainPS");
 
 	GShaderCollection.ReloadShaders();
 
 	GShaderCollection.RegisterComputePSO("SetupFloorPSO", CreateFloorCS);
-	GShaderCollection.RegisterGfxPSO("GenerateMipsPSO", PassThroughVS, GenerateMipsPS);
 	GShaderCollection.RegisterGfxPSO("UnlitPSO", UnlitVS, UnlitPS);
-	GShaderCollection.RegisterGfxPSO("LitPSO", LitVS, LitPS);
+	{
+		// Permutation key is the ELitMode, which also goes in as the LitMode specialization constant
+		auto GetLitPermutations = [&](FShaderHandle VS)
+		{
+			std::map<uint32, FGfxPSOPermutation> LitPermutations;
+			for (uint32 Mode = (uint32)ELitMode::Texture + 1; Mode < (uint32)ELitMode::Num; ++Mode)
+			{
+				FGfxPSOPermutation& Permutation = LitPermutations[Mode];
+				Permutation.VS = VS;
+				Permutation.PS = (ELitMode)Mode == ELitMode::BRDF ? LitBRDFPS : LitPS;
+				Permutation.Constants.Add(0, Mode);
+			}
+			return LitPermutations;
+		};
+		GShaderCollection.RegisterGfxPSO("LitPSO", LitVS, LitPS, GetLitPermutations(LitVS));
+		GShaderCollection.RegisterGfxPSO("LitQuantizedPSO", LitQuantizedVS, LitPS, GetLitPermutations(LitQuantizedVS));
+
+		// Key 0 bakes the albedo and ELitMode::Normal the normals, see BakeImpostor()
+		auto GetImpostorBakePermutations = [&](FShaderHandle VS)
+		{
+			std::map<uint32, FGfxPSOPermutation> BakePermutations;
+			FGfxPSOPermutation& Permutation = BakePermutations[(uint32)ELitMode::Normal];
+			Permutation.VS = VS;
+			Permutation.PS = ImpostorBakePS;
+			Permutation.Constants.Add(0, (uint32)ELitMode::Normal);
+			return BakePermutations;
+		};
+		GShaderCollection.RegisterGfxPSO("ImpostorBakePSO", LitVS, ImpostorBakePS, GetImpostorBakePermutations(LitVS));
+		GShaderCollection.RegisterGfxPSO("ImpostorBakeQuantizedPSO", LitQuantizedVS, ImpostorBakePS, GetImpostorBakePermutations(LitQuantizedVS));
+
+		// Impostor.hlsl only has the normal and N dot L views of ELitMode, see GetImpostorPipeline()
+		std::map<uint32, FGfxPSOPermutation> ImpostorPermutations;
+		for (ELitMode Mode : { ELitMode::Normal, ELitMode::NdotL })
+		{
+			FGfxPSOPermutation& Permutation = ImpostorPermutations[(uint32)Mode];
+			Permutation.VS = ImpostorVS;
+			Permutation.PS = ImpostorPS;
+			Permutation.Constants.Add(0, (uint32)Mode);
+		}
+		GShaderCollection.RegisterGfxPSO("ImpostorPSO", ImpostorVS, ImpostorPS, ImpostorPermutations);
+	}
 	GShaderCollection.RegisterComputePSO("TestPostComputePSO", TestPostCS);
 	GShaderCollection.RegisterComputePSO("FillTexturePSO", FillTextureCS);
 	GShaderCollection.RegisterComputePSO("UIPSO", UICS);
+	GShaderCollection.RegisterComputePSO("CullMeshletsPSO", CullMeshletsCS);
+	GShaderCollection.RegisterComputePSO("GenerateMipsPSO", GenerateMipsCS);
+	// Descriptors are looked up by the names reflected from the SpirV; if the compile options ever strip OpNames again
+	// every Set*() silently does nothing, so catch it here in every config
+	check(!GShaderCollection.GetComputePSO("GenerateMipsPSO")->ReflectionInfo.empty());
+	check(GShaderCollection.GetComputePSO("GenerateMipsPSO")->ReflectionInfo.count("MipsUB") == 1);
 
 	// Setup Vertex Format
 	GPosColorUVFormat.AddVertexBuffer(0, sizeof(FPosColorUVVertex), VK_VERTEX_INPUT_RATE_VERTEX);
@@ -612,80 +924,99 @@ static bool LoadShadersAndGeometry()
 	GPosNormalUVFormat.AddVertexAttribute(0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(FPosNormalUVVertex, nx));
 	GPosNormalUVFormat.AddVertexAttribute(0, 2, VK_FORMAT_R32G32_SFLOAT, offsetof(FPosNormalUVVertex, u));
 
+	GQuantizedPosNormalUVFormat.AddVertexBuffer(0, sizeof(FQuantizedPosNormalUVVertex), VK_VERTEX_INPUT_RATE_VERTEX);
+	GQuantizedPosNormalUVFormat.AddVertexAttribute(0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(FQuantizedPosNormalUVVertex, x));
+	GQuantizedPosNormalUVFormat.AddVertexAttribute(0, 1, VK_FORMAT_R16G16_SNORM, offsetof(FQuantizedPosNormalUVVertex, Normal));
+	GQuantizedPosNormalUVFormat.AddVertexAttribute(0, 2, VK_FORMAT_R16G16_SFLOAT, offsetof(FQuantizedPosNormalUVVertex, u));
+
 	// Load and fill geometry
 //	if (!GCube.Load("../Meshes/testcube/testcube.obj"))
 	if (!GCubeObj.Load("../Meshes/cube/cube.obj"))
 	{
 		return false;
 	}
-	GCube.CreateFromObj(&GCubeObj, &GDevice, &GGfxCmdBufferMgr, &GStagingManager, &GMemMgr);
+	GCube.CreateFromObj(&GCubeObj, &GDevice, &GGfxCmdBufferMgr, &GStagingManager, &GMemMgr, GQuantizeVertices);
 
 	if (!GModelName.empty())
 	{
-		if (!GModelObj.Load(GModelName.c_str()))
+		GModel.bCompressTextures = GCompressTextures && GDevice.DeviceFeatures.textureCompressionBC;
+		GModel.Streamer = GStreamTextures ? &GTextureStreamer : nullptr;
+		if (GBenchmarkObjLoaders)
 		{
-			return false;
+			BenchmarkObjLoaders(GModelName.c_str());
+		}
+		if (GBenchmarkTextureLoading)
+		{
+			BenchmarkTextureLoading(GModelName.c_str());
 		}
 
-		GModel.CreateFromObj(&GModelObj, &GDevice, &GGfxCmdBufferMgr, &GStagingManager, &GMemMgr);
+		// Shows up a piece at a time, see UpdateModelLoading()
+		GModelLoader.Start(&GModel, GModelName.c_str(), GQuantizeVertices);
 	}
 
 	return true;
 }
 
-void GenerateMips(FCmdBuffer* CmdBuffer, FImage2DWithView& Image, std::vector<FImageView*>& OutCreatedImageViews)
+void GenerateMips(FCmdBuffer* CmdBuffer, FImage2DWithView& Image)
 {
-	VkFormat Format = Image.GetFormat();
-	FImageView* SourceImageView = nullptr;
-	FImageView* DestImageView = nullptr;
-
-	auto* RenderPass = GObjectCache.GetOrCreateRenderPass(Image.GetWidth(), Image.GetHeight(), 1, &Format);
-	auto* Pipeline = GObjectCache.GetOrCreateGfxPipeline(GShaderCollection.GetGfxPSO("GenerateMipsPSO"), nullptr, Image.GetWidth(), Image.GetHeight(), RenderPass);
-	VkViewport Viewport;
-	MemZero(Viewport);
-	VkRect2D Scissor;
-	MemZero(Scissor);
-
-	for (uint32 Index = 1; Index < Image.Image.NumMips; ++Index)
+	uint32 NumMips = Image.Image.NumMips;
+	if (NumMips <= 1)
 	{
-		if (DestImageView)
-		{
-			SourceImageView = DestImageView;
-		}
-		else
-		{
-			SourceImageView = new FImageView();
-			SourceImageView->Create(GDevice.Device, Image.Image.Image, VK_IMAGE_VIEW_TYPE_2D, Image.GetFormat(), VK_IMAGE_ASPECT_COLOR_BIT, 1, 1, Index - 1, 0);
-			OutCreatedImageViews.push_back(SourceImageView);
-		}
-		DestImageView = new FImageView();
-		DestImageView->Create(GDevice.Device, Image.Image.Image, VK_IMAGE_VIEW_TYPE_2D, Image.GetFormat(), VK_IMAGE_ASPECT_COLOR_BIT, 1, 1, Index, 0);
-		OutCreatedImageViews.push_back(DestImageView);
-
-		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, Image.GetImage(), VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_ASPECT_COLOR_BIT, 1, Index);
+		return;
+	}
 
-		auto* Framebuffer = GObjectCache.GetOrCreateFramebuffer(RenderPass->RenderPass, DestImageView->ImageView, VK_NULL_HANDLE, Image.GetWidth() >> Index, Image.GetHeight() >> Index);
-		CmdBuffer->BeginRenderPass(RenderPass->RenderPass, *Framebuffer, false);
-		vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipeline->Pipeline);
-		Viewport.width = (float)(Image.GetWidth() >> Index);
-		Viewport.height = (float)(Image.GetHeight() >> Index);
-		Viewport.maxDepth = 1;
-		vkCmdSetViewport(CmdBuffer->CmdBuffer, 0, 1, &Viewport);
-		Scissor.extent.width = Image.GetWidth() >> Index;
-		Scissor.extent.height = Image.GetHeight() >> Index;
-		vkCmdSetScissor(CmdBuffer->CmdBuffer, 0, 1, &Scissor);
+	// One group per 64x64 tile and at most 64x64 of them, see GenerateMipsCS.hlsl
+	check(Image.GetWidth() <= FGenerateMipsBuffers::MaxSize && Image.GetHeight() <= FGenerateMipsBuffers::MaxSize && NumMips <= FGenerateMipsBuffers::MaxMips);
+	auto* Pipeline = GObjectCache.GetOrCreateComputePipeline(GShaderCollection.GetComputePSO("GenerateMipsPSO"));
+
+	FMipsUB MipsUB;
+	MipsUB.Width = Image.GetWidth();
+	MipsUB.Height = Image.GetHeight();
+	MipsUB.NumMips = NumMips;
+	uint32 NumGroupsX = (MipsUB.Width + 63) / 64;
+	uint32 NumGroupsY = (MipsUB.Height + 63) / 64;
+	MipsUB.NumGroups = NumGroupsX * NumGroupsY;
+
+	// The previous call might still be reading the constants or the scratch mip
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, &GGenerateMipsBuffers.UB, VK_ACCESS_UNIFORM_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	vkCmdUpdateBuffer(CmdBuffer->CmdBuffer, GGenerateMipsBuffers.UB.Buffer, 0, sizeof(MipsUB), &MipsUB);
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, &GGenerateMipsBuffers.UB, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_UNIFORM_READ_BIT);
+
+	// Mip 0 was written by a copy or a render pass; the rest is about to be overwritten
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, Image.GetImage(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT, 1, 0);
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, Image.GetImage(), VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_ASPECT_COLOR_BIT, NumMips - 1, 1);
+
+	// Only made the first time an image gets its mips generated
+	std::vector<FImageView*> MipViews;
+	for (uint32 Index = 0; Index < NumMips; ++Index)
+	{
+		MipViews.push_back(GImageViewCache.GetOrCreate(Image.GetImage(), VK_IMAGE_VIEW_TYPE_2D, Image.GetFormat(), VK_IMAGE_ASPECT_COLOR_BIT, Index, 1));
+	}
 
+	vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline->Pipeline);
+	{
 		auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(Pipeline);
 		FWriteDescriptors WriteDescriptors;
-		Pipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", GTrilinearSampler);
-		Pipeline->SetImage(WriteDescriptors, DescriptorSet, "InTexture", GTrilinearSampler, *SourceImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		Pipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "MipsUB", GGenerateMipsBuffers.UB);
+		Pipeline->SetImage(WriteDescriptors, DescriptorSet, "InMip0", *GPointSampler, *MipViews[0], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		for (uint32 Index = 1; Index < FGenerateMipsBuffers::MaxMips; ++Index)
+		{
+			// The shader never writes past NumMips, but every binding needs something
+			char Name[16];
+			sprintf_s(Name, "OutMip%d", Index);
+			Pipeline->SetStorageImage(WriteDescriptors, DescriptorSet, Name, *MipViews[Index < NumMips ? Index : NumMips - 1]);
+		}
+		Pipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "Mip6", GGenerateMipsBuffers.Mip6);
+		Pipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "Counter", GGenerateMipsBuffers.Counter);
 		GDescriptorPool.UpdateDescriptors(WriteDescriptors);
-		DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipeline);
-
-		vkCmdDraw(CmdBuffer->CmdBuffer, 3, 1, 0, 0);
-		CmdBuffer->EndRenderPass();
-		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, Image.GetImage(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT, 1, Index);
+		DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline);
 	}
+
+	vkCmdDispatch(CmdBuffer->CmdBuffer, NumGroupsX, NumGroupsY, 1);
+
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, &GGenerateMipsBuffers.Mip6, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, &GGenerateMipsBuffers.Counter, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, Image.GetImage(), VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT, NumMips - 1, 1);
 }
 
 void CreateAndFillTexture()
@@ -695,7 +1026,7 @@ void CreateAndFillTexture()
 	GHeightMap.Create(GDevice.Device, 64, 64, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, 1, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
 	GGradient.Create(GDevice.Device, 256, 256, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, 8, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
 
-	GCubeTest.Create(GDevice.Device, 64, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, 1);
+	GCubeTest.Create(GDevice.Device, 64, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, 7);
 
 	FComputePipeline* Pipeline = GObjectCache.GetOrCreateComputePipeline(GShaderCollection.GetComputePSO("FillTexturePSO"));
 
@@ -774,20 +1105,38 @@ void CreateAndFillTexture()
 		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, GGradient.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
 	}
 
+	{
+		// Every face and mip in one copy; each face gets its own color, shifting a bit down the mips
+		std::vector<FImageSubresource> Subresources;
+		GetImageSubresources(&GCubeTest.Image, Subresources);
+		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, GCubeTest.GetImage(), VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_ASPECT_COLOR_BIT, GCubeTest.Image.NumMips, 0, GCubeTest.Image.NumLayers);
+		auto FillCube = [](FPrimaryCmdBuffer* CmdBuffer, void* Data, const FImageSubresource& Subresource)
+		{
+			uint32 Color = ToRGB8Color(GetGradient(((float)Subresource.Layer + (float)Subresource.Mip / 8.0f) / 6.0f), 255);
+			for (uint32 Y = 0; Y < Subresource.Height; ++Y)
+			{
+				uint32* Out = (uint32*)((uint8*)Data + Y * Subresource.RowPitch);
+				for (uint32 X = 0; X < Subresource.Width; ++X)
+				{
+					*Out++ = Color;
+				}
+			}
+		};
+		auto* StagingBuffer = GStagingManager.RequestUploadBufferForImage(Subresources, __FILE__, __LINE__);
+		MapAndFillImageSync(StagingBuffer, CmdBuffer, &GCubeTest.Image, Subresources, FillCube);
+		FlushMappedBuffer(GDevice.Device, StagingBuffer);
+
+		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, GCubeTest.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT, GCubeTest.Image.NumMips, 0, GCubeTest.Image.NumLayers);
+	}
+
 	// Generate Mips
-	std::vector<FImageView*> ImageViews;
-	GenerateMips(CmdBuffer, GGradient, ImageViews);
+	GenerateMips(CmdBuffer, GGradient);
 
 	CmdBuffer->End();
 
 	GGfxCmdBufferMgr.Submit(CmdBuffer, GDevice.PresentQueue, {}, nullptr);
 	GDescriptorPool.RefreshFences();
 	CmdBuffer->WaitForFence();
-	for (FImageView* View : ImageViews)
-	{
-		View->Destroy();
-		delete View;
-	}
 }
 
 static void FillFloor(FCmdBuffer* CmdBuffer)
@@ -806,8 +1155,8 @@ static void FillFloor(FCmdBuffer* CmdBuffer)
 		ComputePipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "OutIndices", GFloorIB.Buffer);
 		ComputePipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "OutVertices", GFloorVB.Buffer);
 		ComputePipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "UB", GCreateFloorUB);
-		ComputePipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", GTrilinearSampler);
-		ComputePipeline->SetImage(WriteDescriptors, DescriptorSet, "Heightmap", GTrilinearSampler, GHeightMap.ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		ComputePipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", *GTrilinearSampler);
+		ComputePipeline->SetImage(WriteDescriptors, DescriptorSet, "Heightmap", *GTrilinearSampler, GHeightMap.ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		GDescriptorPool.UpdateDescriptors(WriteDescriptors);
 		DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline);
 	}
@@ -873,6 +1222,8 @@ static void SetupFloor()
 
 bool DoInit(HINSTANCE hInstance, HWND hWnd, uint32& Width, uint32& Height)
 {
+	GInitStartTime = std::chrono::high_resolution_clock::now();
+
 	LPSTR CmdLine = ::GetCommandLineA();
 	const char* Token = CmdLine;
 	while (Token = strchr(Token, ' '))
@@ -942,9 +1293,42 @@ bool DoInit(HINSTANCE hInstance, HWND hWnd, uint32& Width, uint32& Height)
 		{
 			GVkTrace = true;
 		}
+		else if (!_strnicmp(Token, "-dumpshaders", 12))
+		{
+			GShaderCollection.bDumpDebugFiles = true;
+		}
+		else if (!_strnicmp(Token, "-benchobj", 9))
+		{
+			GBenchmarkObjLoaders = true;
+		}
+		else if (!_strnicmp(Token, "-benchtextures", 14))
+		{
+			GBenchmarkTextureLoading = true;
+		}
+		else if (!_strnicmp(Token, "-nobc", 5))
+		{
+			GCompressTextures = false;
+		}
+		else if (!_strnicmp(Token, "-texturebudget=", 15))
+		{
+			GTextureBudgetInMB = (uint32)atoi(Token + 15);
+		}
+		else if (!_strnicmp(Token, "-nostreaming", 12))
+		{
+			GStreamTextures = false;
+		}
+		else if (!_strnicmp(Token, "-quantize", 9))
+		{
+			GQuantizeVertices = true;
+		}
+		else if (!_strnicmp(Token, "-forest=", 8))
+		{
+			GForestSize = (uint32)atoi(Token + 8);
+		}
 	}
 
 	GCamera.SetupFromIni(GIni);
+	GCameraPathStart = GCamera;
 
 	GInstance.Create(hInstance, hWnd);
 	GInstance.CreateDevice(GDevice);
@@ -957,15 +1341,25 @@ bool DoInit(HINSTANCE hInstance, HWND hWnd, uint32& Width, uint32& Height)
 
 	GMemMgr.Create(GDevice.Device, GDevice.PhysicalDevice);
 
-	GShaderCollection.Create(GDevice.Device);
+	GDeferredDeletion.Create({ &GGfxCmdBufferMgr, &GTransferCmdBufferMgr });
+	GImageViewCache.Create(GDevice.Device, &GDeferredDeletion);
+	GSamplerCache.Create(GDevice.Device);
+	// GenerateMips() needs GPointSampler, and the texture benchmark in LoadShadersAndGeometry() can get there
+	GTrilinearSampler = GSamplerCache.GetOrCreate(FSamplerDesc::GetTrilinear());
+	GPointSampler = GSamplerCache.GetOrCreate(FSamplerDesc::GetPoint());
+	GShaderCollection.Create(GDevice.Device, &GDeferredDeletion, &GDescriptorPool);
 
 	GQueryMgr.Create(&GDevice);
 
 	GDescriptorPool.Create(GDevice.Device);
 	GStagingManager.Create(GDevice.Device, &GMemMgr);
+	GTextureStreamer.Create(&GDevice, &GMemMgr, &GStagingManager, &GDeferredDeletion, (uint64)GTextureBudgetInMB * 1024 * 1024);
 
 	GObjectCache.Create(&GDevice);
 
+	// Before LoadShadersAndGeometry(), the texture benchmark already needs it
+	GGenerateMipsBuffers.Create(GDevice.Device);
+
 	if (!LoadShadersAndGeometry())
 	{
 		return false;
@@ -974,6 +1368,7 @@ bool DoInit(HINSTANCE hInstance, HWND hWnd, uint32& Width, uint32& Height)
 	GViewUB.Create(GDevice.Device, &GMemMgr);
 	//GObjUB.Create(GDevice.Device, &GMemMgr);
 	GIdentityUB.Create(GDevice.Device, &GMemMgr);
+	GCullUB.Create(GDevice.Device, &GMemMgr);
 	GUIUB.Create(GDevice.Device, &GMemMgr);
 	GFontBuffer.Create(GDevice.Device);
 	GLitDataUB.Create(GDevice.Device, &GMemMgr);
@@ -1000,8 +1395,6 @@ bool DoInit(HINSTANCE hInstance, HWND hWnd, uint32& Width, uint32& Height)
 	}
 
 	GRenderTargetPool.Create(GDevice.Device, &GMemMgr);
-	GTrilinearSampler.CreateTrilinear(GDevice.Device);
-	GPointSampler.CreatePoint(GDevice.Device);
 
 	CreateAndFillTexture();
 
@@ -1025,18 +1418,358 @@ bool DoInit(HINSTANCE hInstance, HWND hWnd, uint32& Width, uint32& Height)
 	return true;
 }
 
+// Culls the meshlets of the mesh into Mesh.CulledIB and Mesh.IndirectBuffer; has to be outside a render pass
+static void CullMeshlets(FCmdBuffer* CmdBuffer, FMesh& Mesh, FUniformBuffer<FObjUB>& ObjUB, uint32 LOD)
+{
+	check(Mesh.NumMeshlets && LOD < Mesh.NumLODs);
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, &Mesh.IndirectBuffer, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+	{
+		VkBufferCopy Region;
+		MemZero(Region);
+		Region.size = Mesh.IndirectBuffer.GetSize();
+		vkCmdCopyBuffer(CmdBuffer->CmdBuffer, Mesh.ClearIndirectBuffer.Buffer, Mesh.IndirectBuffer.Buffer, 1, &Region);
+	}
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, &Mesh.IndirectBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, &Mesh.CulledIB.Buffer, 0, VK_ACCESS_SHADER_WRITE_BIT);
+
+	auto* ComputePipeline = GObjectCache.GetOrCreateComputePipeline(GShaderCollection.GetComputePSO("CullMeshletsPSO"));
+	vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline->Pipeline);
+
+	FCullUB& CullUB = *GCullUB.GetMappedData();
+	CullUB.FirstMeshlet = Mesh.LODFirstMeshlet[LOD];
+	CullUB.NumMeshlets = Mesh.LODNumMeshlets[LOD];
+
+	{
+		auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(ComputePipeline);
+
+		FWriteDescriptors WriteDescriptors;
+		ComputePipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ViewUB", GViewUB);
+		ComputePipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ObjUB", ObjUB);
+		ComputePipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "CullUB", GCullUB);
+		ComputePipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "Meshlets", Mesh.MeshletsBuffer);
+		ComputePipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "InIndices", Mesh.ObjIB.Buffer);
+		ComputePipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "OutIndices", Mesh.CulledIB.Buffer);
+		ComputePipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "Draws", Mesh.IndirectBuffer);
+		GDescriptorPool.UpdateDescriptors(WriteDescriptors);
+		DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline);
+	}
+
+	// 64 threads per group, see CullMeshletsCS.hlsl
+	vkCmdDispatch(CmdBuffer->CmdBuffer, (CullUB.NumMeshlets + 63) / 64, 1, 1);
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, &Mesh.IndirectBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+	BufferBarrier(CmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, &Mesh.CulledIB.Buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
+static bool UseCulledMeshlets(const FMesh& Mesh)
+{
+	return GControl.DoClusterCulling && Mesh.NumMeshlets > 0;
+}
+
+// A coarser LOD gets used once its error covers less than LODPixelError pixels on screen, and a finer one as soon as the
+// current error covers more. Going coarser also needs the error to be below LODHysteresis of the limit, so instances
+// right at a threshold don't switch every frame
+static const float LODPixelError = 1.0f;
+static const float LODHysteresis = 0.75f;
+
+// Pixels on screen per object space unit at the closest point of the bounds, which is the most any part of the mesh can be
+// magnified; FLT_MAX when the camera is inside the bounds
+static float GetPixelsPerUnit(const FMesh& Mesh, const FMatrix4x4& ObjMtx)
+{
+	const FViewUB& ViewUB = *GViewUB.GetMappedData();
+	FVector3 Center = ViewUB.View.TransformPosition(ObjMtx.TransformPosition(FVector3(Mesh.Bounds.x, Mesh.Bounds.y, Mesh.Bounds.z)));
+	float Scale = 0;
+	for (uint32 Axis = 0; Axis < 3; ++Axis)
+	{
+		float AxisScale = FVector3(ObjMtx.Rows[Axis].x, ObjMtx.Rows[Axis].y, ObjMtx.Rows[Axis].z).GetLength();
+		Scale = AxisScale > Scale ? AxisScale : Scale;
+	}
+
+	float Distance = Center.GetLength() - Mesh.Bounds.w * Scale;
+	if (Distance <= 0)
+	{
+		return FLT_MAX;
+	}
+	return Scale * ViewUB.Proj.Rows[1].y * (float)GSwapchain.GetHeight() * 0.5f / Distance;
+}
+
+static uint32 SelectLOD(const FMesh& Mesh, const FMatrix4x4& ObjMtx, uint32 CurrentLOD)
+{
+	float PixelsPerUnit = GetPixelsPerUnit(Mesh, ObjMtx);
+	if (PixelsPerUnit == FLT_MAX)
+	{
+		return 0;
+	}
+
+	uint32 FinestAllowed = 0;
+	uint32 Coarsest = 0;
+	for (uint32 LOD = 1; LOD < Mesh.NumLODs; ++LOD)
+	{
+		float Pixels = Mesh.LODErrors[LOD] * PixelsPerUnit;
+		FinestAllowed = Pixels <= LODPixelError ? LOD : FinestAllowed;
+		Coarsest = Pixels <= LODPixelError * LODHysteresis ? LOD : Coarsest;
+	}
+
+	if (CurrentLOD > FinestAllowed)
+	{
+		return FinestAllowed;
+	}
+	return Coarsest > CurrentLOD ? Coarsest : CurrentLOD;
+}
+
 template <typename TSetDescriptors>
-static void DrawMesh(FCmdBuffer* CmdBuffer, FMesh& Mesh, TSetDescriptors SetDescriptors)
+static void DrawMesh(FCmdBuffer* CmdBuffer, FMesh& Mesh, TSetDescriptors SetDescriptors, uint32 LOD, float PixelsPerUnit, bool bCulled = false)
 {
-	for (auto* Batch : Mesh.Batches)
+	if (Mesh.Batches.empty() || Mesh.ObjIB.NumIndices == 0)
+	{
+		return;
+	}
+
+	CmdBind(CmdBuffer, &Mesh.ObjVB);
+	CmdBind(CmdBuffer, bCulled ? &Mesh.CulledIB : &Mesh.ObjIB);
+	for (uint32 Index = 0; Index < (uint32)Mesh.Batches.size(); ++Index)
 	{
+		FMesh::FBatch* Batch = Mesh.Batches[Index];
 		FImage2DWithView* Image = Batch->DiffuseTexture ? Batch->DiffuseTexture : &GGradient;
 		FImage2DWithView* NormalImage = Batch->BumpTexture ? Batch->BumpTexture : &GGradient;
-		SetDescriptors(Image, NormalImage);
-		CmdBind(CmdBuffer, &Batch->ObjVB);
-		CmdBind(CmdBuffer, &Batch->ObjIB);
-		vkCmdDrawIndexed(CmdBuffer->CmdBuffer, Batch->NumIndices, 1, 0, 0, 0);
+		// The mips wanted here come in on a later frame, see FTextureStreamer::Update(). Images are shared between meshes, so
+		// this goes to the streamer whichever mesh streamed them in
+		GTextureStreamer.Request(Image, Batch->UVDensity, PixelsPerUnit);
+		GTextureStreamer.Request(NormalImage, Batch->UVDensity, PixelsPerUnit);
+		SetDescriptors(Batch, Image, NormalImage);
+		const FMesh::FLOD& BatchLOD = Batch->GetLOD(LOD);
+		GNumTrianglesDrawn += BatchLOD.NumIndices / 3;
+		if (bCulled)
+		{
+			// Filled in by CullMeshlets()
+			vkCmdDrawIndexedIndirect(CmdBuffer->CmdBuffer, Mesh.IndirectBuffer.Buffer, Index * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			vkCmdDrawIndexed(CmdBuffer->CmdBuffer, BatchLOD.NumIndices, 1, Batch->FirstIndex + BatchLOD.FirstIndex, Batch->VertexOffset, 0);
+		}
+	}
+}
+
+// Binds what Lit.hlsl needs to draw a batch of a mesh
+static void SetLitDescriptors(FCmdBuffer* CmdBuffer, FGfxPipeline* GfxPipeline, FUniformBuffer<FViewUB>& ViewUB, FUniformBuffer<FObjUB>& ObjUB, FMesh::FBatch* Batch, FImage2DWithView* Image, FImage2DWithView* NormalImage)
+{
+	auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(GfxPipeline);
+
+	FWriteDescriptors WriteDescriptors;
+	GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ViewUB", ViewUB);
+	GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ObjUB", ObjUB);
+	GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "DataUB", GLitDataUB);
+	GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "QuantizationUB", Batch->QuantizationUB);
+	GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", *GTrilinearSampler);
+	GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "Tex", *GTrilinearSampler, Image->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SSPoint", *GPointSampler);
+	GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "NormalTex", *GPointSampler, NormalImage->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	GDescriptorPool.UpdateDescriptors(WriteDescriptors);
+
+	DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline);
+}
+
+// Frames are laid out on the octahedral mapping of the sphere (DecodeOctahedral() in Impostor.hlsl), with the first and
+// last frame of each row and column on the edges of the mapping
+static FVector3 GetImpostorFrameDirection(uint32 X, uint32 Y)
+{
+	FVector3 Dir((float)X / (float)(FImpostor::FramesPerSide - 1) * 2 - 1, (float)Y / (float)(FImpostor::FramesPerSide - 1) * 2 - 1, 0);
+	Dir.z = 1 - fabsf(Dir.x) - fabsf(Dir.y);
+	if (Dir.z < 0)
+	{
+		float OldX = Dir.x;
+		Dir.x = (1 - fabsf(Dir.y)) * (OldX >= 0 ? 1 : -1);
+		Dir.y = (1 - fabsf(OldX)) * (Dir.y >= 0 ? 1 : -1);
+	}
+	Dir.Normalize();
+	return Dir;
+}
+
+// Orthographic view of the bounds from Dir, with the sphere filling the frame; Impostor.hlsl builds the same X and Y axes
+static FViewUB GetImpostorFrameView(const FVector4& Bounds, const FVector3& Dir)
+{
+	FVector3 Up = fabsf(Dir.y) < 0.999f ? FVector3(0, 1, 0) : FVector3(0, 0, 1);
+	FVector3 X = Cross(Up, Dir);
+	X.Normalize();
+	FVector3 Y = Cross(Dir, X);
+	float Radius = Bounds.w;
+	FVector3 Eye = FVector3(Bounds.x, Bounds.y, Bounds.z).Add(Dir.Mul(2 * Radius));
+
+	// Looks down -Dir, like the main view looks down -z
+	FViewUB ViewUB;
+	ViewUB.View = FMatrix4x4::GetIdentity();
+	const FVector3* Axes[3] = { &X, &Y, &Dir };
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		ViewUB.View.Set(0, Axis, Axes[Axis]->x);
+		ViewUB.View.Set(1, Axis, Axes[Axis]->y);
+		ViewUB.View.Set(2, Axis, Axes[Axis]->z);
+		ViewUB.View.Set(3, Axis, -Dot(Eye, *Axes[Axis]));
+	}
+
+	float Near = Radius * 0.5f;
+	float Far = Radius * 3.5f;
+	ViewUB.Proj = FMatrix4x4::GetZero();
+	ViewUB.Proj.Set(0, 0, 1.0f / Radius);
+	ViewUB.Proj.Set(1, 1, 1.0f / Radius);
+	ViewUB.Proj.Set(2, 2, -1.0f / (Far - Near));
+	ViewUB.Proj.Set(3, 2, -Near / (Far - Near));
+	ViewUB.Proj.Set(3, 3, 1);
+	return ViewUB;
+}
+
+// Renders LOD 0 of the mesh into every frame of the color atlas and then of the normal atlas. The pipeline has a single
+// color target, hence one pass per atlas instead of MRT
+static void BakeImpostor(FMesh& Mesh, FImpostor& Impostor)
+{
+	const uint32 AtlasSize = FImpostor::AtlasSize;
+	const uint32 NumFrames = FImpostor::FramesPerSide * FImpostor::FramesPerSide;
+	Impostor.Bounds = Mesh.Bounds;
+	Impostor.Color.Create(GDevice.Device, AtlasSize, AtlasSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, FImpostor::NumMips, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
+	Impostor.Normal.Create(GDevice.Device, AtlasSize, AtlasSize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, FImpostor::NumMips, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
+
+	GNumTrianglesDrawn = 0;
+
+	FImage2DWithView Depth;
+	Depth.Create(GDevice.Device, AtlasSize, AtlasSize, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &GMemMgr, 1, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
+
+	std::vector<FUniformBuffer<FViewUB>> FrameViewUBs(NumFrames);
+	for (uint32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		FrameViewUBs[Frame].Create(GDevice.Device, &GMemMgr);
+		*FrameViewUBs[Frame].GetMappedData() = GetImpostorFrameView(Mesh.Bounds, GetImpostorFrameDirection(Frame % FImpostor::FramesPerSide, Frame / FImpostor::FramesPerSide));
+	}
+
+	{
+		FObjUB& ObjUB = *GIdentityUB.GetMappedData();
+		ObjUB.Obj = FMatrix4x4::GetIdentity();
+		ObjUB.Tint = FVector4(1, 1, 1, 1);
+	}
+
+	auto* CmdBuffer = GGfxCmdBufferMgr.AllocateCmdBuffer();
+	CmdBuffer->Begin();
+
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, Depth.GetImage(), VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
+
+	FGfxPSO* PSO = GShaderCollection.GetGfxPSO(Mesh.bQuantized ? "ImpostorBakeQuantizedPSO" : "ImpostorBakePSO");
+	FVertexFormat* VF = Mesh.bQuantized ? &GQuantizedPosNormalUVFormat : &GPosNormalUVFormat;
+	FImage2DWithView* Atlases[2] = { &Impostor.Color, &Impostor.Normal };
+	for (uint32 Pass = 0; Pass < 2; ++Pass)
+	{
+		FImage2DWithView& Atlas = *Atlases[Pass];
+
+		// The framebuffer can only see mip 0
+		auto* TargetView = GImageViewCache.GetOrCreate(Atlas.GetImage(), VK_IMAGE_VIEW_TYPE_2D, Atlas.GetFormat(), VK_IMAGE_ASPECT_COLOR_BIT, 0, 1);
+
+		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, Atlas.GetImage(), VK_IMAGE_LAYOUT_UNDEFINED, 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		VkFormat Format = Atlas.GetFormat();
+		auto* RenderPass = GObjectCache.GetOrCreateRenderPass(AtlasSize, AtlasSize, 1, &Format, Depth.GetFormat());
+		auto* Framebuffer = GObjectCache.GetOrCreateFramebuffer(RenderPass->RenderPass, TargetView->ImageView, Depth.GetImageView(), AtlasSize, AtlasSize);
+		auto* GfxPipeline = GObjectCache.GetOrCreateGfxPipeline(PSO, VF, AtlasSize, AtlasSize, RenderPass, false, Pass == 0 ? 0 : (uint32)ELitMode::Normal);
+
+		CmdBuffer->BeginRenderPass(RenderPass->RenderPass, *Framebuffer, false);
+		{
+			// The render pass clears to the scene background, but texels the mesh doesn't cover need zero coverage
+			VkClearAttachment Clear;
+			MemZero(Clear);
+			Clear.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			VkClearRect Rect;
+			MemZero(Rect);
+			Rect.rect.extent.width = AtlasSize;
+			Rect.rect.extent.height = AtlasSize;
+			Rect.layerCount = 1;
+			vkCmdClearAttachments(CmdBuffer->CmdBuffer, 1, &Clear, 1, &Rect);
+		}
+		vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline->Pipeline);
+
+		for (uint32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			VkViewport Viewport;
+			MemZero(Viewport);
+			Viewport.x = (float)(Frame % FImpostor::FramesPerSide * FImpostor::FrameSize);
+			Viewport.y = (float)(Frame / FImpostor::FramesPerSide * FImpostor::FrameSize);
+			Viewport.width = (float)FImpostor::FrameSize;
+			Viewport.height = (float)FImpostor::FrameSize;
+			Viewport.maxDepth = 1;
+			vkCmdSetViewport(CmdBuffer->CmdBuffer, 0, 1, &Viewport);
+
+			VkRect2D Scissor;
+			MemZero(Scissor);
+			Scissor.offset.x = (int32)Viewport.x;
+			Scissor.offset.y = (int32)Viewport.y;
+			Scissor.extent.width = FImpostor::FrameSize;
+			Scissor.extent.height = FImpostor::FrameSize;
+			vkCmdSetScissor(CmdBuffer->CmdBuffer, 0, 1, &Scissor);
+
+			DrawMesh(CmdBuffer, Mesh,
+				[&](FMesh::FBatch* Batch, FImage2DWithView* Image, FImage2DWithView* NormalImage)
+				{
+					SetLitDescriptors(CmdBuffer, GfxPipeline, FrameViewUBs[Frame], GIdentityUB, Batch, Image, NormalImage);
+				}, 0, (float)FImpostor::FrameSize / (2 * Mesh.Bounds.w));
+		}
+
+		CmdBuffer->EndRenderPass();
+		ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, Atlas.GetImage(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+		GenerateMips(CmdBuffer, Atlas);
+	}
+
+	CmdBuffer->End();
+	GGfxCmdBufferMgr.Submit(CmdBuffer, GDevice.PresentQueue, {}, nullptr);
+	GDescriptorPool.RefreshFences();
+	CmdBuffer->WaitForFence();
+
+	for (auto& ViewUB : FrameViewUBs)
+	{
+		ViewUB.Destroy();
 	}
+	Depth.Destroy();
+
+	char s[256];
+	sprintf_s(s, "*** Impostor: %u frames of %ux%u, %u triangles baked\n", NumFrames, FImpostor::FrameSize, FImpostor::FrameSize, GNumTrianglesDrawn);
+	::OutputDebugStringA(s);
+}
+
+// Lays the forest out on a grid with a random rotation per tree and bakes GModel's impostor
+static void SetupForest()
+{
+	const FVector4& Bounds = GModel.Bounds;
+	float Spacing = Bounds.w * 2.5f;
+	GForestInstances.resize(GForestSize * GForestSize);
+	srand(0);
+	for (uint32 Index = 0; Index < (uint32)GForestInstances.size(); ++Index)
+	{
+		FForestInstance& Instance = GForestInstances[Index];
+		float Yaw = (float)rand() / (float)RAND_MAX * 2 * PI;
+		Instance.PositionAndYaw = FVector4(((float)(Index % GForestSize) - GForestSize / 2.0f) * Spacing, 0, ((float)(Index / GForestSize) - GForestSize / 2.0f) * Spacing, Yaw);
+
+		Instance.ObjUB.Create(GDevice.Device, &GMemMgr);
+		FObjUB& ObjUB = *Instance.ObjUB.GetMappedData();
+		ObjUB.Obj = FMatrix4x4::GetRotationY(Yaw);
+		ObjUB.Obj.Rows[3] = FVector4(Instance.PositionAndYaw.x, Instance.PositionAndYaw.y, Instance.PositionAndYaw.z, 1);
+		ObjUB.Tint = FVector4(1, 1, 1, 1);
+	}
+
+	GForestImpostorInstances.Create(GDevice.Device, sizeof(FVector4) * GForestInstances.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &GMemMgr, __FILE__, __LINE__);
+	GImpostorUB.Create(GDevice.Device, &GMemMgr);
+
+	BakeImpostor(GModel, GModelImpostor);
+
+	FImpostorUB& ImpostorUB = *GImpostorUB.GetMappedData();
+	ImpostorUB.Bounds = GModelImpostor.Bounds;
+	ImpostorUB.FramesPerSide = FImpostor::FramesPerSide;
+}
+
+static void DestroyForest()
+{
+	for (auto& Instance : GForestInstances)
+	{
+		Instance.ObjUB.Destroy();
+	}
+	GForestInstances.clear();
+	GForestImpostorInstances.Destroy();
+	GImpostorUB.Destroy();
+	GModelImpostor.Destroy();
 }
 
 static void DrawCubes(FGfxPipeline* GfxPipeline, VkDevice Device, FCmdBuffer* GfxCmdBuffer, FCmdBuffer* TransferCmdBuffer)
@@ -1062,6 +1795,7 @@ static void DrawCubes(FGfxPipeline* GfxPipeline, VkDevice Device, FCmdBuffer* Gf
 		ObjUB.Obj.Set(3, 1, -Index * 10.0f / NUM_CUBES);
 		ObjUB.Obj.Set(3, 2, (Y - NUM_CUBES_Y / 2.0f) * 3);
 		ObjUB.Tint = FVector4(GetGradient((float)Index / NUM_CUBES), 1);
+		Instance.LOD = SelectLOD(GCube, ObjUB.Obj, Instance.LOD);
 
 		VkBufferCopy Region;
 		MemZero(Region);
@@ -1069,21 +1803,22 @@ static void DrawCubes(FGfxPipeline* GfxPipeline, VkDevice Device, FCmdBuffer* Gf
 		vkCmdCopyBuffer(TransferCmdBuffer->CmdBuffer, UploadBuffer->Buffer, Instance.ObjUB.GPUBuffer.Buffer, 1, &Region);
 
 		DrawMesh(GfxCmdBuffer, GCube,
-			[&](FImage2DWithView* Image, FImage2DWithView* NormalImage)
+			[&](FMesh::FBatch* Batch, FImage2DWithView* Image, FImage2DWithView* NormalImage)
 		{
 			auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(GfxPipeline);
 
 			FWriteDescriptors WriteDescriptors;
 			GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ViewUB", GViewUB);
 			GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ObjUB", Instance.ObjUB.GPUBuffer);
-			GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", GTrilinearSampler);
-			GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "Tex", GTrilinearSampler, Image->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-			GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SSPoint", GPointSampler);
-			GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "NormalTex", GPointSampler, NormalImage->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "QuantizationUB", Batch->QuantizationUB);
+			GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", *GTrilinearSampler);
+			GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "Tex", *GTrilinearSampler, Image->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SSPoint", *GPointSampler);
+			GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "NormalTex", *GPointSampler, NormalImage->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 			GDescriptorPool.UpdateDescriptors(WriteDescriptors);
 
 			DescriptorSet->Bind(GfxCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline);
-		});
+		}, Instance.LOD, GetPixelsPerUnit(GCube, ObjUB.Obj));
 	}
 }
 
@@ -1095,26 +1830,100 @@ static void DrawModel(FGfxPipeline* GfxPipeline, VkDevice Device, FCmdBuffer* Cm
 	ObjUB.Tint = FVector4(1, 1, 1, 1);
 
 	DrawMesh(CmdBuffer, GModel,
-		[&](FImage2DWithView* Image, FImage2DWithView* NormalImage)
+		[&](FMesh::FBatch* Batch, FImage2DWithView* Image, FImage2DWithView* NormalImage)
 		{
-			auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(GfxPipeline);
-
-			FWriteDescriptors WriteDescriptors;
-			GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ViewUB", GViewUB);
-			GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ObjUB", GIdentityUB);
-			GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "DataUB", GLitDataUB);
-			GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", GTrilinearSampler);
-			GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "Tex", GTrilinearSampler, Image->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-			GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SSPoint", GPointSampler);
-			GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "NormalTex", GPointSampler, NormalImage->ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-			GDescriptorPool.UpdateDescriptors(WriteDescriptors);
-
-			DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline);
-		});
+			SetLitDescriptors(CmdBuffer, GfxPipeline, GViewUB, GIdentityUB, Batch, Image, NormalImage);
+		}, GModelLOD, GetPixelsPerUnit(GModel, ObjUB.Obj), UseCulledMeshlets(GModel));
 	//CmdBind(CmdBuffer, &GModel.ObjVB);
 	//vkCmdDraw(CmdBuffer->CmdBuffer, GModel.GetNumVertices(), 1, 0, 0);
 }
 
+// Forest instances whose bounds cover fewer than ImpostorPixelRadius pixels on screen draw as impostors, and switch back to
+// the mesh once they cover more than ImpostorPixelRadius / LODHysteresis. Forest instances aren't scaled
+static const float ImpostorPixelRadius = 64.0f;
+
+static bool SelectImpostor(const FMesh& Mesh, const FMatrix4x4& ObjMtx, bool bCurrentlyImpostor)
+{
+	const FViewUB& ViewUB = *GViewUB.GetMappedData();
+	FVector3 Center = ViewUB.View.TransformPosition(ObjMtx.TransformPosition(FVector3(Mesh.Bounds.x, Mesh.Bounds.y, Mesh.Bounds.z)));
+	float Distance = Center.GetLength();
+	if (Distance <= Mesh.Bounds.w)
+	{
+		return false;
+	}
+
+	float RadiusInPixels = Mesh.Bounds.w * ViewUB.Proj.Rows[1].y * (float)GSwapchain.GetHeight() * 0.5f / Distance;
+	return RadiusInPixels < (bCurrentlyImpostor ? ImpostorPixelRadius / LODHysteresis : ImpostorPixelRadius);
+}
+
+// The rotation part of the view is orthonormal, so the eye is the translation rotated back
+static FVector3 GetCameraWorldPosition(const FMatrix4x4& View)
+{
+	FVector3 Translation(View.Rows[3].x, View.Rows[3].y, View.Rows[3].z);
+	return FVector3(
+		-Dot(FVector3(View.Rows[0].x, View.Rows[0].y, View.Rows[0].z), Translation),
+		-Dot(FVector3(View.Rows[1].x, View.Rows[1].y, View.Rows[1].z), Translation),
+		-Dot(FVector3(View.Rows[2].x, View.Rows[2].y, View.Rows[2].z), Translation));
+}
+
+static FGfxPipeline* GetImpostorPipeline(uint32 Width, uint32 Height, FRenderPass* RenderPass)
+{
+	uint32 PermutationKey = (GControl.LitMode == ELitMode::Normal || GControl.LitMode == ELitMode::NdotL) ? (uint32)GControl.LitMode : 0;
+	return GObjectCache.GetOrCreateGfxPipeline(GShaderCollection.GetGfxPSO("ImpostorPSO"), nullptr, Width, Height, RenderPass, GControl.ViewMode == EViewMode::Wireframe, PermutationKey);
+}
+
+// Near trees draw the mesh one by one, far ones all go in a single instanced draw of GModelImpostor
+static void DrawForest(FGfxPipeline* GfxPipeline, FCmdBuffer* CmdBuffer, FRenderPass* RenderPass, uint32 Width, uint32 Height)
+{
+	auto* ImpostorInstances = (FVector4*)GForestImpostorInstances.GetMappedData();
+	uint32 NumImpostors = 0;
+	for (auto& Instance : GForestInstances)
+	{
+		const FMatrix4x4& ObjMtx = Instance.ObjUB.GetMappedData()->Obj;
+		Instance.bImpostor = SelectImpostor(GModel, ObjMtx, Instance.bImpostor);
+		if (Instance.bImpostor)
+		{
+			ImpostorInstances[NumImpostors++] = Instance.PositionAndYaw;
+			continue;
+		}
+
+		// The meshlet culling buffers are per mesh, so the forest draws the LODs whole
+		Instance.LOD = SelectLOD(GModel, ObjMtx, Instance.LOD);
+		DrawMesh(CmdBuffer, GModel,
+			[&](FMesh::FBatch* Batch, FImage2DWithView* Image, FImage2DWithView* NormalImage)
+			{
+				SetLitDescriptors(CmdBuffer, GfxPipeline, GViewUB, Instance.ObjUB, Batch, Image, NormalImage);
+			}, Instance.LOD, GetPixelsPerUnit(GModel, ObjMtx));
+	}
+
+	if (NumImpostors == 0)
+	{
+		return;
+	}
+
+	GImpostorUB.GetMappedData()->CameraPos = FVector4(GetCameraWorldPosition(GViewUB.GetMappedData()->View), 1);
+
+	auto* ImpostorPipeline = GetImpostorPipeline(Width, Height, RenderPass);
+	vkCmdBindPipeline(CmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ImpostorPipeline->Pipeline);
+	{
+		auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(ImpostorPipeline);
+
+		FWriteDescriptors WriteDescriptors;
+		ImpostorPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ViewUB", GViewUB);
+		ImpostorPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ImpostorUB", GImpostorUB);
+		ImpostorPipeline->SetStorageBuffer(WriteDescriptors, DescriptorSet, "Instances", GForestImpostorInstances);
+		ImpostorPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", *GTrilinearSampler);
+		ImpostorPipeline->SetImage(WriteDescriptors, DescriptorSet, "ColorAtlas", *GTrilinearSampler, GModelImpostor.Color.ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		ImpostorPipeline->SetImage(WriteDescriptors, DescriptorSet, "NormalAtlas", *GTrilinearSampler, GModelImpostor.Normal.ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		GDescriptorPool.UpdateDescriptors(WriteDescriptors);
+		DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ImpostorPipeline);
+	}
+
+	// Two triangles per instance, see MainVS in Impostor.hlsl
+	vkCmdDraw(CmdBuffer->CmdBuffer, 6, NumImpostors, 0, 0);
+	GNumTrianglesDrawn += NumImpostors * 2;
+}
+
 static void DrawFloor(FGfxPipeline* GfxPipeline, VkDevice Device, FCmdBuffer* CmdBuffer)
 {
 	auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(GfxPipeline);
@@ -1122,8 +1931,8 @@ static void DrawFloor(FGfxPipeline* GfxPipeline, VkDevice Device, FCmdBuffer* Cm
 	FWriteDescriptors WriteDescriptors;
 	GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ViewUB", GViewUB);
 	GfxPipeline->SetUniformBuffer(WriteDescriptors, DescriptorSet, "ObjUB", GIdentityUB);
-	GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", GTrilinearSampler);
-	GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "Tex", GTrilinearSampler, GCheckerboardTexture.ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	GfxPipeline->SetSampler(WriteDescriptors, DescriptorSet, "SS", *GTrilinearSampler);
+	GfxPipeline->SetImage(WriteDescriptors, DescriptorSet, "Tex", *GTrilinearSampler, GCheckerboardTexture.ImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 	GDescriptorPool.UpdateDescriptors(WriteDescriptors);
 	DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline);
 
@@ -1150,6 +1959,15 @@ static void SetDynamicStates(VkCommandBuffer CmdBuffer, uint32 Width, uint32 Hei
 
 static void UpdateCamera()
 {
+	if (GControl.DoCameraPath)
+	{
+		GCamera = GCameraPathStart;
+		GCamera.Pos.z -= CameraPathDistance * (float)GCameraPathFrame / (float)(CameraPathFrames - 1);
+		GControl.MouseMoveX = 0;
+		GControl.MouseMoveY = 0;
+		GControl.StepDirection = { 0, 0, 0 };
+	}
+
 	FViewUB& ViewUB = *GViewUB.GetMappedData();
 	static const float RotateSpeed = 0.5f;
 	static const float StepSpeed = 0.001f;
@@ -1169,6 +1987,12 @@ static void UpdateCamera()
 	ViewUB.Proj = CalculateProjectionMatrix(ToRadians(60), (float)GSwapchain.GetWidth() / (float)GSwapchain.GetHeight(), 0.1f, 4000.0f);
 }
 
+static FGfxPipeline* GetOrCreateLitPipeline(const FMesh& Mesh, uint32 Width, uint32 Height, FRenderPass* RenderPass)
+{
+	FGfxPSO* PSO = GShaderCollection.GetGfxPSO(Mesh.bQuantized ? "LitQuantizedPSO" : "LitPSO");
+	FVertexFormat* VF = Mesh.bQuantized ? &GQuantizedPosNormalUVFormat : &GPosNormalUVFormat;
+	return GObjectCache.GetOrCreateGfxPipeline(PSO, VF, Width, Height, RenderPass, GControl.ViewMode == EViewMode::Wireframe, (uint32)GControl.LitMode);
+}
 
 static void InternalRenderFrame(VkDevice Device, FRenderPass* RenderPass, FCmdBuffer* GfxCmdBuffer, FCmdBuffer* TransferCmdBuffer, uint32 Width, uint32 Height)
 {
@@ -1181,17 +2005,24 @@ static void InternalRenderFrame(VkDevice Device, FRenderPass* RenderPass, FCmdBu
 
 		DrawFloor(FloorPipeline, Device, GfxCmdBuffer);
 
-		auto* GfxPipeline = GObjectCache.GetOrCreateGfxPipeline(GShaderCollection.GetGfxPSO("LitPSO"), &GPosNormalUVFormat, Width, Height, RenderPass, GControl.ViewMode == EViewMode::Wireframe);
+		auto* GfxPipeline = GetOrCreateLitPipeline(GCube, Width, Height, RenderPass);
 		vkCmdBindPipeline(GfxCmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline->Pipeline);
 		//DrawCube(GfxPipeline, Device, CmdBuffer);
 		DrawCubes(GfxPipeline, Device, GfxCmdBuffer, TransferCmdBuffer);
 	}
 	else
 	{
-		auto* GfxPipeline = GObjectCache.GetOrCreateGfxPipeline(GShaderCollection.GetGfxPSO("LitPSO"), &GPosNormalUVFormat, Width, Height, RenderPass, GControl.ViewMode == EViewMode::Wireframe);
+		auto* GfxPipeline = GetOrCreateLitPipeline(GModel, Width, Height, RenderPass);
 		vkCmdBindPipeline(GfxCmdBuffer->CmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, GfxPipeline->Pipeline);
 		SetDynamicStates(GfxCmdBuffer->CmdBuffer, Width, Height);
-		DrawModel(GfxPipeline, Device, GfxCmdBuffer);
+		if (GForestInstances.empty())
+		{
+			DrawModel(GfxPipeline, Device, GfxCmdBuffer);
+		}
+		else
+		{
+			DrawForest(GfxPipeline, GfxCmdBuffer, RenderPass, Width, Height);
+		}
 	}
 }
 
@@ -1199,8 +2030,21 @@ static void RenderFrame(VkDevice Device, FPrimaryCmdBuffer* GfxCmdBuffer, FPrima
 {
 	UpdateCamera();
 
+	// Acts on what the draws of the previous frame asked for
+	GTextureStreamer.Update(GfxCmdBuffer);
+
 	FillFloor(GfxCmdBuffer);
 
+	GNumTrianglesDrawn = 0;
+	if (!GModelName.empty() && GForestInstances.empty())
+	{
+		GModelLOD = SelectLOD(GModel, GIdentityUB.GetMappedData()->Obj, GModelLOD);
+		if (UseCulledMeshlets(GModel))
+		{
+			CullMeshlets(GfxCmdBuffer, GModel, GIdentityUB, GModelLOD);
+		}
+	}
+
 	VkFormat ColorFormat = ColorBuffer->GetFormat();
 	auto* RenderPass = GObjectCache.GetOrCreateRenderPass(ColorBuffer->GetWidth(), ColorBuffer->GetHeight(), 1, &ColorFormat, DepthBuffer->GetFormat(), ColorBuffer->Image.Samples, ResolveColorBuffer, ResolveDepth);
 	auto* Framebuffer = GObjectCache.GetOrCreateFramebuffer(RenderPass->RenderPass, ColorBuffer->GetImageView(), DepthBuffer->GetImageView(), ColorBuffer->GetWidth(), ColorBuffer->GetHeight(), ResolveColorBuffer ? ResolveColorBuffer->GetImageView() : VK_NULL_HANDLE, ResolveDepth ? ResolveDepth->GetImageView() : VK_NULL_HANDLE);
@@ -1223,6 +2067,31 @@ static void RenderFrame(VkDevice Device, FPrimaryCmdBuffer* GfxCmdBuffer, FPrima
 #endif
 
 	GfxCmdBuffer->EndRenderPass();
+
+	if (GControl.DoCameraPath)
+	{
+		GCameraPathTriangles += GNumTrianglesDrawn;
+		GCameraPathTextureSize += GTextureStreamer.ResidentSize;
+		GCameraPathPeakTextureSize = GTextureStreamer.ResidentSize > GCameraPathPeakTextureSize ? GTextureStreamer.ResidentSize : GCameraPathPeakTextureSize;
+		if (++GCameraPathFrame == CameraPathFrames)
+		{
+			char s[256];
+			sprintf_s(s, "*** Camera path: %u frames, %.0f triangles per frame\n", CameraPathFrames, (double)GCameraPathTriangles / CameraPathFrames);
+			::OutputDebugStringA(s);
+			const double MB = 1024.0 * 1024.0;
+			sprintf_s(s, "*** Texture streaming: %.2f MB resident per frame, %.2f MB peak, %.2f MB budget, %.2f MB streamed in and %.2f MB evicted since startup\n",
+				(double)GCameraPathTextureSize / CameraPathFrames / MB, GCameraPathPeakTextureSize / MB, GTextureStreamer.Budget / MB, GTextureStreamer.StreamedInSize / MB, GTextureStreamer.EvictedSize / MB);
+			::OutputDebugStringA(s);
+			GRequestControl.DoCameraPath = false;
+		}
+	}
+	else
+	{
+		GCameraPathFrame = 0;
+		GCameraPathTriangles = 0;
+		GCameraPathTextureSize = 0;
+		GCameraPathPeakTextureSize = 0;
+	}
 }
 
 void RenderPost(VkDevice Device, FCmdBuffer* CmdBuffer, FRenderTargetPool::FEntry* SceneColorEntry, FRenderTargetPool::FEntry* SceneColorAfterPostEntry)
@@ -1237,7 +2106,7 @@ void RenderPost(VkDevice Device, FCmdBuffer* CmdBuffer, FRenderTargetPool::FEntr
 		auto* DescriptorSet = GDescriptorPool.AllocateDescriptorSet(ComputePipeline);
 
 		FWriteDescriptors WriteDescriptors;
-		ComputePipeline->SetImage(WriteDescriptors, DescriptorSet, "InImage", GPointSampler, SceneColorEntry->Texture.ImageView, VK_IMAGE_LAYOUT_GENERAL);
+		ComputePipeline->SetImage(WriteDescriptors, DescriptorSet, "InImage", *GPointSampler, SceneColorEntry->Texture.ImageView, VK_IMAGE_LAYOUT_GENERAL);
 		ComputePipeline->SetStorageImage(WriteDescriptors, DescriptorSet, "RWImage", SceneColorAfterPostEntry->Texture.ImageView);
 		GDescriptorPool.UpdateDescriptors(WriteDescriptors);
 		DescriptorSet->Bind(CmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, ComputePipeline);
@@ -1257,8 +2126,8 @@ void RenderUI(VkDevice Device, FCmdBuffer* CmdBuffer, FRenderTargetPool::FEntry*
 		FUIUB& UIUB = *GUIUB.GetMappedData();
 		UIUB.TextPosX = 20;
 		UIUB.TextPosY = 60;
-		char s[32];
-		UIUB.NumChars = (uint32)sprintf_s(s, "GPU %.2f ms", GGPUTimeInMS);
+		char s[64];
+		UIUB.NumChars = (uint32)sprintf_s(s, "GPU %.2f ms VS %u Tris %u", GGPUTimeInMS, (uint32)GQueryMgr.LastVSInvocations, GNumTrianglesDrawn);
 		//UIUB.NumChars = (uint32)sprintf_s(s, "CPU %.2f ms", (float)DeltaTime.count());
 		for (uint32 Index = 0; Index < UIUB.NumChars; ++Index)
 		{
@@ -1323,6 +2192,49 @@ DWORD __stdcall FThread::ThreadFunction(void* Param)
 }
 #endif
 
+// Creates whatever GModelLoader finished since the last frame; the forest needs the textures for its impostor, so it waits
+// for everything
+static void UpdateModelLoading()
+{
+	if (!GModelLoader.IsLoading() || !GModelLoader.Update(&GDevice, &GGfxCmdBufferMgr, &GStagingManager, &GMemMgr))
+	{
+		return;
+	}
+
+	char s[512];
+	if (GModelLoader.bFailed)
+	{
+		sprintf_s(s, "*** Unable to load %s\n", GModelName.c_str());
+		::OutputDebugStringA(s);
+		return;
+	}
+
+	sprintf_s(s, "*** %s: geometry after %.2f ms, fully loaded after %.2f ms\n", GModelName.c_str(), GModelLoader.GeometryTimeInMS, GModelLoader.TotalTimeInMS);
+	::OutputDebugStringA(s);
+
+	// Names that share a file, or a file some other mesh loaded, share the image
+	std::set<FImage2DWithView*> Images;
+	uint64 TextureSize = 0;
+	for (auto& Pair : GModel.Textures)
+	{
+		const FImage* Image = Pair.second && Images.insert(Pair.second).second ? &Pair.second->Image : nullptr;
+		for (uint32 Mip = 0; Image && Mip < Image->NumMips; ++Mip)
+		{
+			uint32 Width = Image->Width >> Mip;
+			uint32 Height = Image->Height >> Mip;
+			TextureSize += GetFormatImageSize(Image->Format, Width ? Width : 1, Height ? Height : 1);
+		}
+	}
+	sprintf_s(s, "*** %s: %d textures in %d images, %.2f MB%s; %u images loaded in total\n", GModelName.c_str(), (int)GModel.Textures.size(), (int)Images.size(), TextureSize / (1024.0 * 1024.0),
+		GModel.bCompressTextures ? " block compressed" : "", GTextureCache.GetNumImages());
+	::OutputDebugStringA(s);
+
+	if (GForestSize > 0)
+	{
+		SetupForest();
+	}
+}
+
 void DoRender()
 {
 	GRenderTargetPool.EmptyPool();
@@ -1332,19 +2244,26 @@ void DoRender()
 		return;
 	}
 
+	if (GShaderCollection.HaveSourcesChanged())
+	{
+		GRequestControl.DoRecompileShaders = true;
+	}
+
 	GControl = GRequestControl;
 	GGfxCmdBufferMgr.Update();
+	GTransferCmdBufferMgr.Update();
 	GStagingManager.Update();
+	GDeferredDeletion.Update();
+
+	UpdateModelLoading();
 
 	if (GControl.DoRecompileShaders)
 	{
 		GRequestControl.DoRecompileShaders = false;
-		vkDeviceWaitIdle(GDevice.Device);
-		GGfxCmdBufferMgr.Update();
-		GTransferCmdBufferMgr.Update();
+		// Replaced PSOs are freed through GDeferredDeletion once the frames using them are done
 		if (GShaderCollection.ReloadShaders())
 		{
-			GObjectCache.Destroy();
+			GObjectCache.EvictPSOs(GShaderCollection.InvalidatedPSOs);
 		}
 	}
 
@@ -1462,6 +2381,15 @@ void DoRender()
 	GDescriptorPool.RefreshFences();
 
 	GSwapchain.Present(GDevice.PresentQueue);
+
+	if (!GFirstFrameReported)
+	{
+		GFirstFrameReported = true;
+		std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - GInitStartTime;
+		char s[256];
+		sprintf_s(s, "*** First frame after %.2f ms\n", Time.count());
+		::OutputDebugStringA(s);
+	}
 }
 
 void DoResize(uint32 Width, uint32 Height)
@@ -1508,22 +2436,38 @@ void DoDeinit()
 		//GObjUB.Destroy();
 	}
 	GCube.Destroy();
+	if (GModelLoader.IsLoading())
+	{
+		GModelLoader.Cancel();
+	}
+	if (!GForestInstances.empty())
+	{
+		DestroyForest();
+	}
 	GModel.Destroy();
+	GTextureCache.Destroy();
+	GTextureStreamer.Destroy();
 	GUIUB.Destroy();
 	GIdentityUB.Destroy();
+	GCullUB.Destroy();
+	GGenerateMipsBuffers.Destroy();
 	GFontBuffer.Destroy();
 	GLitDataUB.Destroy();
 
-	GTrilinearSampler.Destroy();
-	GPointSampler.Destroy();
-
 	GCheckerboardTexture.Destroy();
 	GHeightMap.Destroy();
 	GGradient.Destroy();
 	GCubeTest.Destroy();
 
+	// The views of the images destroyed so far are waiting in GDeferredDeletion
+	GImageViewCache.Destroy();
+	GSamplerCache.Destroy();
+
 	GQueryMgr.Destroy();
 
+	GShaderCollection.Destroy();
+	GDeferredDeletion.Flush();
+
 	GDescriptorPool.Destroy();
 
 	GRenderTargetPool.Destroy();
@@ -1535,7 +2479,6 @@ void DoDeinit()
 	GGfxCmdBufferMgr.Destroy();
 	GTransferToComputeSemaphore.Destroy(GDevice.Device);
 	GTransferCmdBufferMgr.Destroy();
-	GShaderCollection.Destroy();
 	GMemMgr.Destroy();
 	GDevice.Destroy();
 	GInstance.Destroy();
@@ -10,15 +10,31 @@ enum class EViewMode
 	Wireframe,
 };
 
+// Matches LIT_MODE_* in Lit.hlsl
+enum class ELitMode
+{
+	Texture,
+	NormalTexture,
+	Normal,
+	NdotL,
+	BRDF,
+
+	Num
+};
+
 struct FControl
 {
 	FVector3 StepDirection;
 	FVector4 CameraPos;
 	EViewMode ViewMode;
+	ELitMode LitMode;
 	int32 MouseMoveX = 0;
 	int32 MouseMoveY = 0;
 	bool DoPost;
 	bool DoMSAA;
+	bool DoClusterCulling;
+	// Replaces the camera with a fixed path and logs the triangles drawn along it
+	bool DoCameraPath;
 	bool DoRecompileShaders = false;
 
 	FControl();
@@ -583,13 +583,13 @@ FGfxPipeline::FGfxPipeline()
 	DynamicInfo.pDynamicStates = Dynamic;
 }
 
-void FGfxPipeline::Create(VkDevice Device, const FGfxPSO* InPSO, const FVertexFormat* VertexFormat, uint32 Width, uint32 Height, const FRenderPass* RenderPass)
+void FGfxPipeline::Create(VkDevice Device, const FGfxPSO* InPSO, const FVertexFormat* VertexFormat, uint32 Width, uint32 Height, const FRenderPass* RenderPass, uint32 PermutationKey)
 {
 	PSO = InPSO;
 	PSO->Pipelines.push_back(this);
 
 	std::vector<VkPipelineShaderStageCreateInfo> ShaderStages;
-	PSO->SetupShaderStages(ShaderStages);
+	PSO->SetupShaderStages(ShaderStages, PermutationKey);
 
 	VkPipelineLayoutCreateInfo CreateInfo;
 	MemZero(CreateInfo);
@@ -741,7 +741,7 @@ void FCmdBuffer::BeginRenderPass(VkRenderPass RenderPass, const FFramebuffer& Fr
 
 void FShader::GenerateReflection(std::map<uint32, FDescriptorSetInfo>& DescriptorSets)
 {
-	spirv_cross::Compiler Compiler((uint32*)&SpirV[0], SpirV.size() / 4);
+	spirv_cross::Compiler Compiler((const uint32*)Code, CodeSize / 4);
 	spirv_cross::ShaderResources Resources = Compiler.get_shader_resources();
 
 	auto ParseResources = [&](std::vector<spirv_cross::Resource>& Resources, FDescriptorSetInfo::FBindingInfo::EType Type)
@@ -943,11 +943,13 @@ void FGfxPSO::Destroy(VkDevice Device)
 void FComputePSO::Destroy(VkDevice Device)
 {
 	FPSO::Destroy(Device);
-	Collection.DestroyShader(CS);
+	// The collection owns the shaders; at this point CS might already refer to a newer version
 }
 
-void FComputePSO::SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages) const
+void FComputePSO::SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages, uint32 PermutationKey) const
 {
+	check(PermutationKey == 0);
+
 	VkPipelineShaderStageCreateInfo Info;
 	MemZero(Info);
 	Info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -957,13 +959,21 @@ void FComputePSO::SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>
 	OutShaderStages.push_back(Info);
 }
 
-bool FGfxPSO::CreateVSPS(VkDevice Device, FShaderHandle InVS, FShaderHandle InPS)
+bool FGfxPSO::CreateVSPS(VkDevice Device, FShaderHandle InVS, FShaderHandle InPS, const std::map<uint32, FGfxPSOPermutation>& InPermutations)
 {
 	VS = InVS;
 	PS = InPS;
+	Permutations = InPermutations;
 	((FShader*)(Collection.GetShader(VS)))->GenerateReflection(DescriptorSetInfo);
 	((FShader*)(Collection.GetShader(PS)))->GenerateReflection(DescriptorSetInfo);
 
+	// The layout is the union of the bindings of every permutation, so any of them can use the same descriptor sets
+	for (auto& Pair : Permutations)
+	{
+		((FShader*)(Collection.GetShader(Pair.second.VS)))->GenerateReflection(DescriptorSetInfo);
+		((FShader*)(Collection.GetShader(Pair.second.PS)))->GenerateReflection(DescriptorSetInfo);
+	}
+
 	std::vector<VkDescriptorSetLayoutBinding> DSBindings;
 	//for (const auto& Binding : PSOBindings)
 	//{
@@ -973,24 +983,47 @@ bool FGfxPSO::CreateVSPS(VkDevice Device, FShaderHandle InVS, FShaderHandle InPS
 	return true;
 }
 
-void FGfxPSO::SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages) const
+void FGfxPSO::SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages, uint32 PermutationKey) const
 {
+	FShaderHandle StageVS = VS;
+	FShaderHandle StagePS = PS;
+	const VkSpecializationInfo* Specialization = nullptr;
+	if (PermutationKey != 0)
+	{
+		auto Found = Permutations.find(PermutationKey);
+		check(Found != Permutations.end());
+		const FGfxPSOPermutation& Permutation = Found->second;
+		StageVS = Permutation.VS;
+		StagePS = Permutation.PS;
+		if (!Permutation.Constants.IsEmpty())
+		{
+			MemZero(SpecializationInfo);
+			SpecializationInfo.mapEntryCount = (uint32)Permutation.Constants.Entries.size();
+			SpecializationInfo.pMapEntries = &Permutation.Constants.Entries[0];
+			SpecializationInfo.dataSize = Permutation.Constants.Data.size() * sizeof(uint32);
+			SpecializationInfo.pData = &Permutation.Constants.Data[0];
+			Specialization = &SpecializationInfo;
+		}
+	}
+
 	VkPipelineShaderStageCreateInfo Info;
 	MemZero(Info);
 	Info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	Info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	Info.module = Collection.GetShaderModule(VS);
-	Info.pName = Collection.GetEntryPoint(VS).c_str();
+	Info.module = Collection.GetShaderModule(StageVS);
+	Info.pName = Collection.GetEntryPoint(StageVS).c_str();
+	Info.pSpecializationInfo = Specialization;
 	OutShaderStages.push_back(Info);
 
-	VkShaderModule PixelShaderModule = Collection.GetShaderModule(PS);
+	VkShaderModule PixelShaderModule = Collection.GetShaderModule(StagePS);
 	if (PixelShaderModule != VK_NULL_HANDLE)
 	{
 		MemZero(Info);
 		Info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		Info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		Info.module = PixelShaderModule;
-		Info.pName = Collection.GetEntryPoint(PS).c_str();
+		Info.pName = Collection.GetEntryPoint(StagePS).c_str();
+		Info.pSpecializationInfo = Specialization;
 		OutShaderStages.push_back(Info);
 	}
 }
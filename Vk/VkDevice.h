@@ -6,6 +6,7 @@
 #include <vulkan/vulkan.h>
 
 #include "../Utils/Util.h"
+#include <functional>
 
 class FDescriptorPool;
 
@@ -127,6 +128,7 @@ struct FDevice
 	VkPhysicalDevice PhysicalDevice = VK_NULL_HANDLE;
 	VkDevice Device = VK_NULL_HANDLE;
 	VkPhysicalDeviceProperties DeviceProperties;
+	VkPhysicalDeviceFeatures DeviceFeatures;
 	uint32 PresentQueueFamilyIndex = UINT32_MAX;
 	uint32 ComputeQueueFamilyIndex = UINT32_MAX;
 	uint32 TransferQueueFamilyIndex = UINT32_MAX;
@@ -165,7 +167,6 @@ struct FDevice
 			}
 		}
 
-		VkPhysicalDeviceFeatures DeviceFeatures;
 		vkGetPhysicalDeviceFeatures(PhysicalDevice, &DeviceFeatures);
 
 		bool bSeparateTransfer = PresentQueueFamilyIndex != TransferQueueFamilyIndex;
@@ -655,6 +656,83 @@ struct FCmdBufferMgr
 	std::list<FSecondaryCmdBuffer*> SecondaryCmdBuffers;
 };
 
+// Runs deleters once every command buffer that was recording or in flight when they got queued has finished, so
+// objects can be replaced while rendering without waiting for the device to go idle
+struct FDeferredDeletionQueue
+{
+	void Create(std::initializer_list<FCmdBufferMgr*> InCmdBufferMgrs)
+	{
+		CmdBufferMgrs = InCmdBufferMgrs;
+	}
+
+	void Enqueue(std::function<void()>&& Delete)
+	{
+		FEntry Entry;
+		for (auto* Mgr : CmdBufferMgrs)
+		{
+			for (auto* CmdBuffer : Mgr->CmdBuffers)
+			{
+				CmdBuffer->RefreshState();
+				if (CmdBuffer->State != FCmdBuffer::EState::ReadyForBegin)
+				{
+					Entry.Fences.push_back(FCmdBufferFence(CmdBuffer));
+				}
+			}
+		}
+
+		if (Entry.Fences.empty())
+		{
+			Delete();
+			return;
+		}
+
+		Entry.Delete = std::move(Delete);
+		Entries.push_back(std::move(Entry));
+	}
+
+	// Call after the FCmdBufferMgrs have been updated
+	void Update()
+	{
+		for (auto It = Entries.begin(); It != Entries.end();)
+		{
+			bool bPassed = true;
+			for (auto& Fence : It->Fences)
+			{
+				bPassed = bPassed && Fence.HasFencePassed();
+			}
+
+			if (bPassed)
+			{
+				It->Delete();
+				It = Entries.erase(It);
+			}
+			else
+			{
+				++It;
+			}
+		}
+	}
+
+	// Only once the device is idle
+	void Flush()
+	{
+		for (auto& Entry : Entries)
+		{
+			Entry.Delete();
+		}
+		Entries.clear();
+	}
+
+protected:
+	struct FEntry
+	{
+		std::vector<FCmdBufferFence> Fences;
+		std::function<void()> Delete;
+	};
+	std::list<FEntry> Entries;
+	std::vector<FCmdBufferMgr*> CmdBufferMgrs;
+};
+
 struct FQueryMgr
 {
 	struct FTimestampQuery
@@ -664,8 +742,11 @@ struct FQueryMgr
 	};
 
 	VkQueryPool Pool = VK_NULL_HANDLE;
+	// Vertex shader invocations, one query per timestamp pair; null if the device doesn't support pipeline statistics
+	VkQueryPool StatsPool = VK_NULL_HANDLE;
 	VkDevice Device = VK_NULL_HANDLE;
 	float Period = 0.0f;
+	uint64 LastVSInvocations = 0;
 	FTimestampQuery* CurrentQuery = nullptr;
 	enum
 	{
@@ -687,6 +768,13 @@ struct FQueryMgr
 		Info.queryType = VK_QUERY_TYPE_TIMESTAMP;
 		Info.queryCount = NumQueries;
 		checkVk(vkCreateQueryPool(Device, &Info, nullptr, &Pool));
+		if (InDevice->DeviceFeatures.pipelineStatisticsQuery)
+		{
+			Info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			Info.queryCount = NumQueries / 2;
+			Info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT;
+			checkVk(vkCreateQueryPool(Device, &Info, nullptr, &StatsPool));
+		}
 		Queries.resize(NumQueries / 2);
 		for (int32 Index = 0; Index < NumQueries / 2; ++Index)
 		{
@@ -697,6 +785,10 @@ struct FQueryMgr
 
 	void Destroy()
 	{
+		if (StatsPool != VK_NULL_HANDLE)
+		{
+			vkDestroyQueryPool(Device, StatsPool, nullptr);
+		}
 		vkDestroyQueryPool(Device, Pool, nullptr);
 	}
 
@@ -711,11 +803,21 @@ struct FQueryMgr
 		CurrentQuery->CmdBufferFence = FCmdBufferFence(CmdBuffer);
 
 		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, Pool, CurrentQuery->QueryIndex);
+
+		if (StatsPool != VK_NULL_HANDLE)
+		{
+			vkCmdResetQueryPool(CmdBuffer->CmdBuffer, StatsPool, CurrentQuery->QueryIndex / 2, 1);
+			vkCmdBeginQuery(CmdBuffer->CmdBuffer, StatsPool, CurrentQuery->QueryIndex / 2, 0);
+		}
 	}	
 
 	void EndTime(FCmdBuffer* CmdBuffer)
 	{
 		check(CurrentQuery);
+		if (StatsPool != VK_NULL_HANDLE)
+		{
+			vkCmdEndQuery(CmdBuffer->CmdBuffer, StatsPool, CurrentQuery->QueryIndex / 2);
+		}
 		vkCmdWriteTimestamp(CmdBuffer->CmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, Pool, CurrentQuery->QueryIndex + 1);
 		PendingQueries.push_back(CurrentQuery);
 		CurrentQuery = nullptr;
@@ -744,6 +846,14 @@ struct FQueryMgr
 					{
 						uint64 Delta = Data[1] - Data[0];
 						Found = (float)((double)Delta / (double)Period / 1000.0 / 1000.0);
+						if (StatsPool != VK_NULL_HANDLE)
+						{
+							uint64 Invocations = 0;
+							if (vkGetQueryPoolResults(Device, StatsPool, Query->QueryIndex / 2, 1, sizeof(Invocations), &Invocations, sizeof(uint64), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+							{
+								LastVSInvocations = Invocations;
+							}
+						}
 					}
 					break;
 				case VK_NOT_READY:
@@ -777,10 +887,35 @@ struct FQueryMgr
 	}
 };
 
+static inline bool IsBlockCompressedFormat(VkFormat Format)
+{
+	switch (Format)
+	{
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return true;
+
+	default:
+		break;
+	}
+	return false;
+}
+
+// Block compressed formats average over their 4x4 blocks
 static inline uint32 GetFormatBitsPerPixel(VkFormat Format)
 {
 	switch (Format)
 	{
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		return 4;
+
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return 8;
+
 	case VK_FORMAT_R32_SFLOAT:
 	case VK_FORMAT_R8G8B8A8_UNORM:
 		return 32;
@@ -791,3 +926,14 @@ static inline uint32 GetFormatBitsPerPixel(VkFormat Format)
 	check(0);
 	return 0;
 }
+
+// Bytes of a Width x Height subresource; block compressed formats round up to whole blocks
+static inline uint64 GetFormatImageSize(VkFormat Format, uint32 Width, uint32 Height)
+{
+	if (IsBlockCompressedFormat(Format))
+	{
+		Width = (Width + 3) & ~3;
+		Height = (Height + 3) & ~3;
+	}
+	return (uint64)Width * Height * GetFormatBitsPerPixel(Format) / 8;
+}
@@ -5,7 +5,8 @@
 
 #pragma optimize( "gt", on )
 
-#include <unordered_map>
+#include <chrono>
+#include <float.h>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "../Utils/External/tiny_obj_loader.h"
@@ -13,29 +14,78 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_ASSERT(x) check(x)
 #include "../Utils/External/stb_image.h"
+#include "../Utils/TextureCompressor.h"
 
-namespace std
+FTextureCache GTextureCache;
+
+// Finds or adds vertices in a batch; open addressing with linear probing into a power of two table of indices
+template <typename TVertex>
+struct TVertexWelder
 {
-	template<> struct hash<FPosColorUVVertex>
+	enum
+	{
+		Empty = 0xffffffff,
+	};
+
+	std::vector<uint32> Table;
+
+	uint32 FindOrAdd(std::vector<TVertex>& Vertices, const TVertex& Vertex)
 	{
-		size_t operator()(FPosColorUVVertex const& Vertex) const
+		// Keep the load under 1/2 so probe sequences stay short
+		if ((Vertices.size() + 1) * 2 > Table.size())
 		{
-			static_assert(sizeof(Vertex) == 6 * 4, "");
-			uint32* Alias = (uint32*)&Vertex;
-			return Alias[0] ^ (Alias[1] >> 1) ^ (Alias[2] << 1) ^ Alias[3] ^ (Alias[4] >> 1) ^ (Alias[5] << 1); //((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1);
+			Grow(Vertices);
 		}
-	};
 
-	template<> struct hash<FPosNormalUVVertex>
+		uint32 Mask = (uint32)Table.size() - 1;
+		for (uint32 Slot = (uint32)Hash(Vertex) & Mask; ; Slot = (Slot + 1) & Mask)
+		{
+			uint32 Index = Table[Slot];
+			if (Index == Empty)
+			{
+				Table[Slot] = (uint32)Vertices.size();
+				Vertices.push_back(Vertex);
+				return Table[Slot];
+			}
+			else if (Vertices[Index] == Vertex)
+			{
+				return Index;
+			}
+		}
+	}
+
+	// Multiply-xorshift over the 32 bit words; -0 and +0 compare equal so they hash the same too
+	static uint64 Hash(const TVertex& Vertex)
 	{
-		size_t operator()(FPosNormalUVVertex const& Vertex) const
+		static_assert(sizeof(TVertex) % 4 == 0, "");
+		const uint32* Words = (const uint32*)&Vertex;
+		uint64 Hash = 0;
+		for (uint32 Index = 0; Index < sizeof(TVertex) / 4; ++Index)
 		{
-			static_assert(sizeof(Vertex) == 8 * 4, "");
-			uint32* Alias = (uint32*)&Vertex;
-			return Alias[0] ^ (Alias[1] >> 1) ^ (Alias[2] << 1) ^ Alias[3] ^ (Alias[4] >> 1) ^ (Alias[5] << 1) ^ Alias[6] ^ Alias[7];
+			uint32 Word = Words[Index] == 0x80000000 ? 0 : Words[Index];
+			Hash = (Hash ^ Word) * 0x9e3779b97f4a7c15ull;
+			Hash ^= Hash >> 32;
 		}
-	};
-}
+		return Hash;
+	}
+
+protected:
+	void Grow(const std::vector<TVertex>& Vertices)
+	{
+		size_t NewSize = Table.empty() ? 1024 : Table.size() * 2;
+		Table.assign(NewSize, (uint32)Empty);
+		uint32 Mask = (uint32)NewSize - 1;
+		for (uint32 Index = 0; Index < (uint32)Vertices.size(); ++Index)
+		{
+			uint32 Slot = (uint32)Hash(Vertices[Index]) & Mask;
+			while (Table[Slot] != Empty)
+			{
+				Slot = (Slot + 1) & Mask;
+			}
+			Table[Slot] = Index;
+		}
+	}
+};
 
 
 struct FTinyObj
@@ -45,229 +95,1780 @@ struct FTinyObj
 	std::vector<tinyobj::material_t> materials;
 };
 
-void FMesh::CreateFromObj(FObj* Obj, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr)
+// Expands the OBJ into per material vertex and index streams, welding identical vertices within each material. Missing
+// normals are smoothed afterwards, so corners only differing in the face they belong to weld together
+static void BuildBatchStreams(FObj* Obj, std::map<uint32, std::vector<FPosNormalUVVertex>>& Vertices, std::map<uint32, std::vector<uint32>>& Indices)
 {
-	std::unordered_map<FPosNormalUVVertex, uint32> uniqueVertices;
-	std::map<uint32, std::vector<FPosNormalUVVertex>> Vertices;
-	std::map<uint32, std::vector<uint32>> Indices;
-	std::set<uint32> MaterialIndices;
-	bool bNeedsNormals = true;
+	auto Start = std::chrono::high_resolution_clock::now();
+	std::map<uint32, TVertexWelder<FPosNormalUVVertex>> Welders;
+	size_t NumCorners = 0;
+	bool bNeedsNormals = false;
 	for (auto& Shape : Obj->Loaded->shapes)
 	{
 		check(!(Shape.mesh.indices.size() % 3));
-		for (size_t i = 0; i < Shape.mesh.indices.size(); ++i)
-		{
-			auto MeshIndex = Shape.mesh.indices[i];
-			FPosNormalUVVertex Vertex;
-			Vertex.x = Obj->Loaded->attrib.vertices[3 * MeshIndex.vertex_index + 0];
-			Vertex.y = -Obj->Loaded->attrib.vertices[3 * MeshIndex.vertex_index + 1];
-			Vertex.z = Obj->Loaded->attrib.vertices[3 * MeshIndex.vertex_index + 2];
-			if (MeshIndex.normal_index != -1)
+		for (size_t i = 0; i < Shape.mesh.indices.size(); i += 3)
+		{
+			FPosNormalUVVertex Corners[3];
+			for (uint32 Corner = 0; Corner < 3; ++Corner)
 			{
-				bNeedsNormals = false;
-				Vertex.nx = Obj->Loaded->attrib.normals[3 * MeshIndex.normal_index + 0];
-				Vertex.ny = -Obj->Loaded->attrib.normals[3 * MeshIndex.normal_index + 1];
-				Vertex.nz = Obj->Loaded->attrib.normals[3 * MeshIndex.normal_index + 2];
-			}
+				auto MeshIndex = Shape.mesh.indices[i + Corner];
+				FPosNormalUVVertex& Vertex = Corners[Corner];
+				Vertex.x = Obj->Loaded->attrib.vertices[3 * MeshIndex.vertex_index + 0];
+				Vertex.y = -Obj->Loaded->attrib.vertices[3 * MeshIndex.vertex_index + 1];
+				Vertex.z = Obj->Loaded->attrib.vertices[3 * MeshIndex.vertex_index + 2];
+				if (MeshIndex.normal_index != -1)
+				{
+					Vertex.nx = Obj->Loaded->attrib.normals[3 * MeshIndex.normal_index + 0];
+					Vertex.ny = -Obj->Loaded->attrib.normals[3 * MeshIndex.normal_index + 1];
+					Vertex.nz = Obj->Loaded->attrib.normals[3 * MeshIndex.normal_index + 2];
+				}
+				else
+				{
+					// Filled in by GenerateSmoothNormals() after welding
+					Vertex.nx = Vertex.ny = Vertex.nz = 0;
+					bNeedsNormals = true;
+				}
 
-			if (MeshIndex.texcoord_index != -1)
-			{
-				Vertex.u = Obj->Loaded->attrib.texcoords[2 * MeshIndex.texcoord_index + 0];
-				Vertex.v = Obj->Loaded->attrib.texcoords[2 * MeshIndex.texcoord_index + 1];
-			}
-			else
-			{
-				Vertex.u = 0;
-				Vertex.v = 0;
+				if (MeshIndex.texcoord_index != -1)
+				{
+					Vertex.u = Obj->Loaded->attrib.texcoords[2 * MeshIndex.texcoord_index + 0];
+					Vertex.v = Obj->Loaded->attrib.texcoords[2 * MeshIndex.texcoord_index + 1];
+				}
+				else
+				{
+					Vertex.u = 0;
+					Vertex.v = 0;
+				}
 			}
 
-			//if (uniqueVertices.count(Vertex) == 0)
+			uint32 MaterialIndex = (uint32)Shape.mesh.material_ids[i / 3];
+			auto& MaterialVertices = Vertices[MaterialIndex];
+			auto& MaterialIndices = Indices[MaterialIndex];
+			auto& Welder = Welders[MaterialIndex];
+			for (auto& Vertex : Corners)
 			{
-				int MaterialIndex = Shape.mesh.material_ids[i / 3];
-				uint32 VertexIndex = (uint32)Vertices[MaterialIndex].size();
-				uniqueVertices[Vertex] = VertexIndex;
-				Vertices[MaterialIndex].push_back(Vertex);
-				Indices[MaterialIndex].push_back(VertexIndex);
-				MaterialIndices.insert(MaterialIndex);
+				MaterialIndices.push_back(Welder.FindOrAdd(MaterialVertices, Vertex));
 			}
-/*
-			else
-			{
-				Indices.push_back(uniqueVertices[Vertex]);
-			}*/
+			NumCorners += 3;
 		}
 	}
 
-	std::map<uint32, std::map<uint32, std::vector<FVector3>>> TempNormals;
-
 	if (bNeedsNormals)
 	{
-#if 1
-		for (auto MaterialIndex : MaterialIndices)
+		std::vector<std::pair<std::vector<FPosNormalUVVertex>*, std::vector<uint32>*>> Batches;
+		for (auto& Pair : Vertices)
 		{
-			for (size_t Index = 0; Index < Indices[MaterialIndex].size(); Index += 3)
-			{
-				int VertexIndex0 = Indices[MaterialIndex][Index + 0];
-				int VertexIndex1 = Indices[MaterialIndex][Index + 1];
-				int VertexIndex2 = Indices[MaterialIndex][Index + 2];
-				FPosNormalUVVertex& V0 = Vertices[MaterialIndex][VertexIndex0];
-				FPosNormalUVVertex& V1 = Vertices[MaterialIndex][VertexIndex1];
-				FPosNormalUVVertex& V2 = Vertices[MaterialIndex][VertexIndex2];
-				FVector3 A(V0.x, V0.y, V0.z);
-				FVector3 B(V1.x, V1.y, V1.z);
-				FVector3 C(V2.x, V2.y, V2.z);
-				FVector3 AB = A - B;
-				AB.Normalize();
-				FVector3 AC = A - C;
-				AC.Normalize();
-				FVector3 Normal = Cross(AC, AB);
-				Normal.Normalize();
-				V0.nx = V1.nx = V2.nx = Normal.x;
-				V0.ny = V1.ny = V2.ny = Normal.y;
-				V0.nz = V1.nz = V2.nz = Normal.z;
-			}
+			Batches.push_back(std::make_pair(&Pair.second, &Indices[Pair.first]));
+		}
+
+		ParallelFor((uint32)Batches.size(), [&](uint32 Index)
+		{
+			auto& BatchVertices = *Batches[Index].first;
+			auto& BatchIndices = *Batches[Index].second;
+			MeshOpt::GenerateSmoothNormals(&BatchVertices[0].x, sizeof(FPosNormalUVVertex), &BatchVertices[0].nx, sizeof(FPosNormalUVVertex), (uint32)BatchVertices.size(),
+				&BatchIndices[0], (uint32)BatchIndices.size());
+		});
+	}
+
+	size_t NumVertices = 0;
+	for (auto& Pair : Vertices)
+	{
+		NumVertices += Pair.second.size();
+	}
+
+	std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - Start;
+	char s[256];
+	sprintf_s(s, "*** %s: welded %u corners into %u vertices (%.1f%%) in %.2f ms\n", Obj->BaseDir.c_str(), (uint32)NumCorners, (uint32)NumVertices,
+		NumCorners ? 100.0 * (double)NumVertices / (double)NumCorners : 0.0, Time.count());
+	::OutputDebugStringA(s);
+}
+
+// Vertex cache, then overdraw, then vertex fetch order; each step keeps most of what the previous one got
+static void OptimizeBatchStreams(FObj* Obj, std::map<uint32, std::vector<FPosNormalUVVertex>>& Vertices, std::map<uint32, std::vector<uint32>>& Indices)
+{
+	auto Start = std::chrono::high_resolution_clock::now();
+	MeshOpt::FCacheStats Before;
+	MeshOpt::FCacheStats After;
+	for (auto& Pair : Vertices)
+	{
+		auto& BatchVertices = Pair.second;
+		auto& BatchIndices = Indices[Pair.first];
+		if (BatchIndices.empty())
+		{
+			continue;
+		}
+
+		uint32 NumVertices = (uint32)BatchVertices.size();
+		uint32 NumIndices = (uint32)BatchIndices.size();
+		auto Stats = MeshOpt::AnalyzeVertexCache(&BatchIndices[0], NumIndices, NumVertices);
+		Before.NumMisses += Stats.NumMisses;
+		Before.NumTriangles += Stats.NumTriangles;
+		Before.NumVertices += Stats.NumVertices;
+
+		MeshOpt::OptimizeVertexCache(&BatchIndices[0], NumIndices, NumVertices);
+		MeshOpt::OptimizeOverdraw(&BatchIndices[0], NumIndices, &BatchVertices[0].x, sizeof(FPosNormalUVVertex), NumVertices);
+		NumVertices = MeshOpt::OptimizeVertexFetch(&BatchVertices[0], sizeof(FPosNormalUVVertex), NumVertices, &BatchIndices[0], NumIndices);
+		BatchVertices.resize(NumVertices);
+
+		Stats = MeshOpt::AnalyzeVertexCache(&BatchIndices[0], NumIndices, NumVertices);
+		After.NumMisses += Stats.NumMisses;
+		After.NumTriangles += Stats.NumTriangles;
+		After.NumVertices += Stats.NumVertices;
+	}
+
+	auto GetRatio = [](uint32 A, uint32 B)
+	{
+		return B ? (double)A / (double)B : 0.0;
+	};
+
+	std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - Start;
+	char s[256];
+	sprintf_s(s, "*** %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (cache size %d) in %.2f ms\n", Obj->BaseDir.c_str(),
+		GetRatio(Before.NumMisses, Before.NumTriangles), GetRatio(After.NumMisses, After.NumTriangles),
+		GetRatio(Before.NumMisses, Before.NumVertices), GetRatio(After.NumMisses, After.NumVertices), (int)MeshOpt::DefaultCacheSize, Time.count());
+	::OutputDebugStringA(s);
+}
+
+static bool HasBumpTexture(FObj* Obj, uint32 MaterialIndex)
+{
+	return MaterialIndex < (uint32)Obj->Loaded->materials.size() && !Obj->Loaded->materials[MaterialIndex].bump_texname.empty();
+}
+
+// Only for batches with a bump texture; goes after OptimizeBatchStreams() as that reorders the vertices
+static void BuildTangents(FObj* Obj, std::map<uint32, std::vector<FPosNormalUVVertex>>& Vertices, std::map<uint32, std::vector<uint32>>& Indices, std::map<uint32, std::vector<FVector4>>& OutTangents)
+{
+	std::vector<uint32> Materials;
+	for (auto& Pair : Vertices)
+	{
+		if (HasBumpTexture(Obj, Pair.first) && !Pair.second.empty())
+		{
+			Materials.push_back(Pair.first);
+			OutTangents[Pair.first].resize(Pair.second.size());
+		}
+	}
+
+	std::vector<std::vector<FPosNormalUVVertex>*> BatchVertices;
+	std::vector<std::vector<uint32>*> BatchIndices;
+	std::vector<std::vector<FVector4>*> BatchTangents;
+	for (uint32 MaterialIndex : Materials)
+	{
+		BatchVertices.push_back(&Vertices[MaterialIndex]);
+		BatchIndices.push_back(&Indices[MaterialIndex]);
+		BatchTangents.push_back(&OutTangents[MaterialIndex]);
+	}
+
+	ParallelFor((uint32)Materials.size(), [&](uint32 Index)
+	{
+		const FPosNormalUVVertex* First = &BatchVertices[Index]->at(0);
+		auto& Triangles = *BatchIndices[Index];
+		MeshOpt::GenerateTangents(&First->x, sizeof(FPosNormalUVVertex), &First->nx, sizeof(FPosNormalUVVertex), &First->u, sizeof(FPosNormalUVVertex),
+			(uint32)BatchVertices[Index]->size(), Triangles.empty() ? nullptr : &Triangles[0], (uint32)Triangles.size(), BatchTangents[Index]->at(0).Values);
+	});
+}
+
+// Simplification stops at this error, relative to the size of the batch
+static const float MaxLODError = 0.05f;
+
+// Every LOD has half the triangles of the previous one and gets appended to the batch's indices. Goes after
+// OptimizeBatchStreams() and BuildTangents(), which only look at LOD 0
+static void BuildLODs(std::map<uint32, std::vector<FPosNormalUVVertex>>& Vertices, std::map<uint32, std::vector<uint32>>& Indices, std::map<uint32, std::vector<FMesh::FLOD>>& OutLODs)
+{
+	std::vector<std::vector<FPosNormalUVVertex>*> BatchVertices;
+	std::vector<std::vector<uint32>*> BatchIndices;
+	std::vector<std::vector<FMesh::FLOD>*> BatchLODs;
+	for (auto& Pair : Vertices)
+	{
+		BatchVertices.push_back(&Pair.second);
+		BatchIndices.push_back(&Indices[Pair.first]);
+		BatchLODs.push_back(&OutLODs[Pair.first]);
+	}
+
+	auto Start = std::chrono::high_resolution_clock::now();
+	ParallelFor((uint32)BatchVertices.size(), [&](uint32 Index)
+	{
+		auto& Positions = *BatchVertices[Index];
+		auto& Triangles = *BatchIndices[Index];
+		auto& LODs = *BatchLODs[Index];
+
+		FMesh::FLOD LOD0;
+		MemZero(LOD0);
+		LOD0.NumIndices = (uint32)Triangles.size();
+		LODs.push_back(LOD0);
+		if (Triangles.empty())
+		{
+			return;
+		}
+
+		FVector3 Min(Positions[0].x, Positions[0].y, Positions[0].z);
+		FVector3 Max = Min;
+		for (auto& Vertex : Positions)
+		{
+			Min.Set(Vertex.x < Min.x ? Vertex.x : Min.x, Vertex.y < Min.y ? Vertex.y : Min.y, Vertex.z < Min.z ? Vertex.z : Min.z);
+			Max.Set(Vertex.x > Max.x ? Vertex.x : Max.x, Vertex.y > Max.y ? Vertex.y : Max.y, Vertex.z > Max.z ? Vertex.z : Max.z);
 		}
-#else
-		for (auto MaterialIndex : MaterialIndices)
+		float TargetError = (Max - Min).GetLength() * MaxLODError;
+
+		uint32 NumVertices = (uint32)Positions.size();
+		std::vector<uint32> Source;
+		std::vector<uint32> Simplified(Triangles.size());
+		while (LODs.size() < FMesh::MaxLODs)
 		{
-			for (size_t Index = 0; Index < Indices[MaterialIndex].size(); Index += 3)
+			FMesh::FLOD Previous = LODs.back();
+			Source.assign(Triangles.begin() + Previous.FirstIndex, Triangles.begin() + Previous.FirstIndex + Previous.NumIndices);
+			float Error = 0;
+			uint32 NumIndices = MeshOpt::Simplify(&Source[0], Previous.NumIndices, &Positions[0].x, sizeof(FPosNormalUVVertex), NumVertices, Previous.NumIndices / 6 * 3, TargetError, &Simplified[0], &Error);
+
+			// Not worth another level if the seams, borders or the error limit kept most of the triangles
+			if (NumIndices == 0 || NumIndices > Previous.NumIndices / 4 * 3)
 			{
-				int VertexIndex0 = Indices[MaterialIndex][Index + 0];
-				int VertexIndex1 = Indices[MaterialIndex][Index + 1];
-				int VertexIndex2 = Indices[MaterialIndex][Index + 2];
-				FPosNormalUVVertex& V0 = Vertices[MaterialIndex][VertexIndex0];
-				FPosNormalUVVertex& V1 = Vertices[MaterialIndex][VertexIndex1];
-				FPosNormalUVVertex& V2 = Vertices[MaterialIndex][VertexIndex2];
-				FVector3 A(V0.x, V0.y, V0.z);
-				FVector3 B(V1.x, V1.y, V1.z);
-				FVector3 C(V2.x, V2.y, V2.z);
-				FVector3 AB = A - B;
-				AB.Normalize();
-				FVector3 AC = A - C;
-				AC.Normalize();
-				FVector3 Normal = Cross(AB, AC);
-				Normal.Normalize();
-				TempNormals[MaterialIndex][VertexIndex0].push_back(Normal);
-				TempNormals[MaterialIndex][VertexIndex1].push_back(Normal);
-				TempNormals[MaterialIndex][VertexIndex2].push_back(Normal);
+				break;
 			}
+
+			MeshOpt::OptimizeVertexCache(&Simplified[0], NumIndices, NumVertices);
+			FMesh::FLOD LOD;
+			MemZero(LOD);
+			LOD.FirstIndex = (uint32)Triangles.size();
+			LOD.NumIndices = NumIndices;
+			LOD.Error = Previous.Error + Error;
+			Triangles.insert(Triangles.end(), Simplified.begin(), Simplified.begin() + NumIndices);
+			LODs.push_back(LOD);
+		}
+	});
+
+	uint32 NumTriangles[FMesh::MaxLODs] = { 0 };
+	for (auto* LODs : BatchLODs)
+	{
+		for (uint32 LOD = 0; LOD < FMesh::MaxLODs; ++LOD)
+		{
+			NumTriangles[LOD] += LODs->at(LOD < LODs->size() ? LOD : LODs->size() - 1).NumIndices / 3;
+		}
+	}
+
+	std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - Start;
+	char s[256];
+	sprintf_s(s, "*** LOD triangles %u, %u, %u, %u in %.2f ms\n", NumTriangles[0], NumTriangles[1], NumTriangles[2], NumTriangles[3], Time.count());
+	::OutputDebugStringA(s);
+}
+
+// Meshlets are ranges of the final index order of each LOD, so this goes last
+static void BuildMeshlets(std::map<uint32, std::vector<FPosNormalUVVertex>>& Vertices, std::map<uint32, std::vector<uint32>>& Indices, std::map<uint32, std::vector<FMesh::FLOD>>& LODs, std::map<uint32, std::vector<MeshOpt::FMeshlet>>& OutMeshlets)
+{
+	std::vector<std::vector<FPosNormalUVVertex>*> BatchVertices;
+	std::vector<std::vector<uint32>*> BatchIndices;
+	std::vector<std::vector<FMesh::FLOD>*> BatchLODs;
+	std::vector<std::vector<MeshOpt::FMeshlet>*> BatchMeshlets;
+	for (auto& Pair : Vertices)
+	{
+		if (!Pair.second.empty())
+		{
+			BatchVertices.push_back(&Pair.second);
+			BatchIndices.push_back(&Indices[Pair.first]);
+			BatchLODs.push_back(&LODs[Pair.first]);
+			BatchMeshlets.push_back(&OutMeshlets[Pair.first]);
 		}
+	}
 
-		for (auto MaterialIndex : MaterialIndices)
+	ParallelFor((uint32)BatchVertices.size(), [&](uint32 Index)
+	{
+		auto& Triangles = *BatchIndices[Index];
+		auto& Meshlets = *BatchMeshlets[Index];
+		std::vector<MeshOpt::FMeshlet> LODMeshlets;
+		for (auto& LOD : *BatchLODs[Index])
 		{
-			for (auto Pair : TempNormals[MaterialIndex])
+			LOD.FirstMeshlet = (uint32)Meshlets.size();
+			if (LOD.NumIndices)
 			{
-				int VertexIndex = Pair.first;
-				auto& Normals = Pair.second;
-				FVector3 Normal = FVector3::GetZero();
-				for (const FVector3& N : Normals)
+				MeshOpt::BuildMeshlets(&Triangles[LOD.FirstIndex], LOD.NumIndices, &BatchVertices[Index]->at(0).x, sizeof(FPosNormalUVVertex), (uint32)BatchVertices[Index]->size(), LODMeshlets);
+				for (auto& Meshlet : LODMeshlets)
 				{
-					Normal.Add(N);
+					Meshlet.FirstIndex += LOD.FirstIndex;
+					Meshlets.push_back(Meshlet);
 				}
-
-				Normal.Normalize();
-				Vertices[MaterialIndex][VertexIndex].nx = Normal.x;
-				Vertices[MaterialIndex][VertexIndex].ny = Normal.y;
-				Vertices[MaterialIndex][VertexIndex].nz = Normal.z;
 			}
+			LOD.NumMeshlets = (uint32)Meshlets.size() - LOD.FirstMeshlet;
+		}
+	});
+}
+
+static void GetBatchData(FObj* Obj, std::map<uint32, std::vector<FPosNormalUVVertex>>& Vertices, std::map<uint32, std::vector<uint32>>& Indices, std::map<uint32, std::vector<FVector4>>& Tangents,
+	std::map<uint32, std::vector<FMesh::FLOD>>& LODs, std::map<uint32, std::vector<MeshOpt::FMeshlet>>& Meshlets, std::vector<FMesh::FBatchData>& OutBatches)
+{
+	for (auto& Pair : Vertices)
+	{
+		uint32 MaterialIndex = Pair.first;
+		FMesh::FBatchData Batch;
+		Batch.MaterialID = (int)MaterialIndex;
+		Batch.Vertices = &Pair.second[0];
+		Batch.NumVertices = (uint32)Pair.second.size();
+		Batch.Indices = &Indices[MaterialIndex][0];
+		Batch.NumIndices = (uint32)Indices[MaterialIndex].size();
+		auto& BatchLODs = LODs[MaterialIndex];
+		check(!BatchLODs.empty() && BatchLODs.size() <= FMesh::MaxLODs);
+		Batch.NumLODs = (uint32)BatchLODs.size();
+		memcpy(Batch.LODs, &BatchLODs[0], BatchLODs.size() * sizeof(FMesh::FLOD));
+		auto FoundTangents = Tangents.find(MaterialIndex);
+		Batch.Tangents = FoundTangents != Tangents.end() ? &FoundTangents->second[0] : nullptr;
+		auto FoundMeshlets = Meshlets.find(MaterialIndex);
+		if (FoundMeshlets != Meshlets.end() && !FoundMeshlets->second.empty())
+		{
+			Batch.Meshlets = &FoundMeshlets->second[0];
+			Batch.NumMeshlets = (uint32)FoundMeshlets->second.size();
 		}
-#endif
+		if (Batch.MaterialID >= 0 && Batch.MaterialID < (int)Obj->Loaded->materials.size())
+		{
+			auto& Material = Obj->Loaded->materials[Batch.MaterialID];
+			Batch.DiffuseTexture = Material.diffuse_texname;
+			Batch.BumpTexture = Material.bump_texname;
+		}
+		OutBatches.push_back(Batch);
 	}
+}
+
+void FMesh::CreateFromObj(FObj* Obj, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, bool bQuantize)
+{
+	bQuantized = bQuantize;
+	std::map<uint32, std::vector<FPosNormalUVVertex>> Vertices;
+	std::map<uint32, std::vector<uint32>> Indices;
+	std::map<uint32, std::vector<FVector4>> Tangents;
+	std::map<uint32, std::vector<FMesh::FLOD>> LODs;
+	std::map<uint32, std::vector<MeshOpt::FMeshlet>> Meshlets;
+	BuildBatchStreams(Obj, Vertices, Indices);
+	OptimizeBatchStreams(Obj, Vertices, Indices);
+	BuildTangents(Obj, Vertices, Indices, Tangents);
+	BuildLODs(Vertices, Indices, LODs);
+	BuildMeshlets(Vertices, Indices, LODs, Meshlets);
+
+	std::vector<FBatchData> BatchData;
+	GetBatchData(Obj, Vertices, Indices, Tangents, LODs, Meshlets, BatchData);
+	CreateBatches(Obj->BaseDir, BatchData, Device, CmdBufMgr, StagingMgr, MemMgr);
+}
 
-	for (auto MaterialIndex : MaterialIndices)
+// Cooked meshes are the final per batch streams, so loading one is a map and a copy into staging per buffer:
+//	FCookedMeshHeader
+//	FCookedBatch[NumBatches]
+//	Zero terminated texture names
+//	Vertex, index, optional tangent and meshlet data, 4 byte aligned
+struct FCookedMeshHeader
+{
+	enum
 	{
-		auto* Batch = new FBatch;
-		Batch->NumVertices = (uint32)Vertices[MaterialIndex].size();
+		Magic = 0x534d4b56,	// 'VKMS'
+		// Bump when the format or anything in BuildBatchStreams(), OptimizeBatchStreams(), BuildTangents(), BuildLODs() or
+		// BuildMeshlets() changes
+		Version = 8,
+	};
+
+	uint32 Magic;
+	uint32 Version;
+	uint64 SourceHash;
+	uint32 NumBatches;
+	uint32 Padding;
+};
+
+struct FCookedBatch
+{
+	int32 MaterialID;
+	uint32 NumVertices;
+	uint32 NumIndices;
+	uint32 DiffuseTextureOffset;
+	uint32 BumpTextureOffset;
+	uint32 NumMeshlets;
+	uint64 VerticesOffset;
+	uint64 IndicesOffset;
+	// 0 if the batch has no tangents
+	uint64 TangentsOffset;
+	uint64 MeshletsOffset;
+	uint32 NumLODs;
+	FMesh::FLOD LODs[FMesh::MaxLODs];
+};
+
+// The OBJ and its material library, as those are what ends up in the cooked file
+static uint64 HashMeshSource(const char* ObjFilename)
+{
+	FileUtils::FMappedFile File;
+	if (!File.Open(ObjFilename))
+	{
+		return 0;
+	}
 
-		Batch->ObjVB.Create(Device->Device, sizeof(FPosColorUVVertex) * Batch->NumVertices, MemMgr);
+	uint32 Version = FCookedMeshHeader::Version;
+	uint64 Hash = Hash64(&Version, sizeof(Version));
+	Hash = Hash64(File.Data, File.Size, Hash);
 
-		auto FillVB = [&](void* VertexData, void* UserData)
+	const char* End = File.Data + File.Size;
+	for (const char* Line = File.Data; Line < End;)
+	{
+		const char* LineEnd = (const char*)memchr(Line, '\n', End - Line);
+		LineEnd = LineEnd ? LineEnd : End;
+		if (LineEnd - Line > 7 && !strncmp(Line, "mtllib ", 7))
 		{
-			memcpy(VertexData, &Vertices[MaterialIndex][0], Batch->NumVertices * sizeof(FPosColorUVVertex));
-		};
-		MapAndFillBufferSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &Batch->ObjVB.Buffer, FillVB, sizeof(FPosColorUVVertex) * Batch->NumVertices, this, __FILE__, __LINE__);
+			std::string Library(Line + 7, LineEnd);
+			TrimWhiteSpace(Library);
+			std::vector<char> Materials = LoadFile(FileUtils::MakePath(FileUtils::GetPath(ObjFilename, true), Library).c_str());
+			Hash = Materials.empty() ? Hash : Hash64(&Materials[0], Materials.size(), Hash);
+		}
+		Line = LineEnd + 1;
+	}
 
-		Batch->NumIndices = (uint32)Indices[MaterialIndex].size();
-		Batch->ObjIB.Create(Device->Device, Batch->NumIndices, VK_INDEX_TYPE_UINT32, MemMgr);
+	return Hash;
+}
+
+static bool SaveCookedMesh(const std::string& Filename, uint64 SourceHash, const std::vector<FMesh::FBatchData>& Batches)
+{
+	FCookedMeshHeader Header;
+	MemZero(Header);
+	Header.Magic = FCookedMeshHeader::Magic;
+	Header.Version = FCookedMeshHeader::Version;
+	Header.SourceHash = SourceHash;
+	Header.NumBatches = (uint32)Batches.size();
+
+	std::vector<FCookedBatch> CookedBatches(Batches.size());
+	std::string Names;
+	uint64 NamesOffset = sizeof(Header) + Batches.size() * sizeof(FCookedBatch);
+	for (size_t Index = 0; Index < Batches.size(); ++Index)
+	{
+		FCookedBatch& Cooked = CookedBatches[Index];
+		MemZero(Cooked);
+		Cooked.MaterialID = Batches[Index].MaterialID;
+		Cooked.NumVertices = Batches[Index].NumVertices;
+		Cooked.NumIndices = Batches[Index].NumIndices;
+		Cooked.NumMeshlets = Batches[Index].NumMeshlets;
+		Cooked.NumLODs = Batches[Index].NumLODs;
+		memcpy(Cooked.LODs, Batches[Index].LODs, sizeof(Cooked.LODs));
+		Cooked.DiffuseTextureOffset = (uint32)(NamesOffset + Names.size());
+		Names.append(Batches[Index].DiffuseTexture.c_str(), Batches[Index].DiffuseTexture.size() + 1);
+		Cooked.BumpTextureOffset = (uint32)(NamesOffset + Names.size());
+		Names.append(Batches[Index].BumpTexture.c_str(), Batches[Index].BumpTexture.size() + 1);
+	}
 
-		auto FillIB = [&](void* IndexData, void* UserData)
+	uint64 DataOffset = Align<uint64>(NamesOffset + Names.size(), 4);
+	for (size_t Index = 0; Index < Batches.size(); ++Index)
+	{
+		CookedBatches[Index].VerticesOffset = DataOffset;
+		DataOffset += Batches[Index].NumVertices * sizeof(FPosNormalUVVertex);
+		CookedBatches[Index].IndicesOffset = DataOffset;
+		DataOffset += Batches[Index].NumIndices * sizeof(uint32);
+		if (Batches[Index].Tangents)
 		{
-			memcpy(IndexData, &Indices[MaterialIndex][0], Batch->NumIndices * sizeof(uint32));
-		};
-		MapAndFillBufferSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &Batch->ObjIB.Buffer, FillIB, sizeof(uint32) * Batch->NumIndices, this, __FILE__, __LINE__);
-		Batch->MaterialID = (int)MaterialIndex;
-		Batches.push_back(Batch);
+			CookedBatches[Index].TangentsOffset = DataOffset;
+			DataOffset += Batches[Index].NumVertices * sizeof(FVector4);
+		}
+		CookedBatches[Index].MeshletsOffset = DataOffset;
+		DataOffset += Batches[Index].NumMeshlets * sizeof(MeshOpt::FMeshlet);
+	}
+
+	std::string TempFile = Filename + ".tmp";
+	FILE* File = OpenFile(TempFile.c_str(), "wb");
+	if (!File)
+	{
+		return false;
+	}
+
+	static const char Zeroes[4] = { 0, 0, 0, 0 };
+	bool bWritten = fwrite(&Header, sizeof(Header), 1, File) == 1;
+	bWritten = bWritten && (CookedBatches.empty() || fwrite(&CookedBatches[0], sizeof(FCookedBatch), CookedBatches.size(), File) == CookedBatches.size());
+	bWritten = bWritten && fwrite(Names.data(), 1, Names.size(), File) == Names.size();
+	size_t PaddingSize = (size_t)(CookedBatches.empty() ? 0 : CookedBatches[0].VerticesOffset - (NamesOffset + Names.size()));
+	bWritten = bWritten && fwrite(Zeroes, 1, PaddingSize, File) == PaddingSize;
+	for (auto& Batch : Batches)
+	{
+		bWritten = bWritten && fwrite(Batch.Vertices, sizeof(FPosNormalUVVertex), Batch.NumVertices, File) == Batch.NumVertices;
+		bWritten = bWritten && fwrite(Batch.Indices, sizeof(uint32), Batch.NumIndices, File) == Batch.NumIndices;
+		bWritten = bWritten && (!Batch.Tangents || fwrite(Batch.Tangents, sizeof(FVector4), Batch.NumVertices, File) == Batch.NumVertices);
+		bWritten = bWritten && fwrite(Batch.Meshlets, sizeof(MeshOpt::FMeshlet), Batch.NumMeshlets, File) == Batch.NumMeshlets;
 	}
+	fclose(File);
 
-	for (size_t Index = 0; Index < Obj->Loaded->materials.size(); ++Index)
+	remove(Filename.c_str());
+	if (!bWritten || rename(TempFile.c_str(), Filename.c_str()) != 0)
 	{
-		auto& Material = Obj->Loaded->materials[Index];
-		SetupTexture(Obj, Device, CmdBufMgr, StagingMgr, MemMgr, (int32)Index, Material.diffuse_texname, [](FBatch* Batch) -> FImage2DWithView*& { return Batch->DiffuseTexture; } );
-		SetupTexture(Obj, Device, CmdBufMgr, StagingMgr, MemMgr, (int32)Index, Material.bump_texname, [](FBatch* Batch) -> FImage2DWithView*& { return Batch->BumpTexture; });
+		remove(TempFile.c_str());
+		return false;
 	}
+
+	return true;
 }
 
-void FMesh::SetupTexture(FObj* Obj, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, int32 Index, const std::string& MaterialTextureName, std::function<FImage2DWithView*&(FBatch* Batch)> Callback)
+// Returns false if the file is missing, for a different source or otherwise not usable
+static bool ReadCookedMesh(const FileUtils::FMappedFile& File, uint64 SourceHash, std::vector<FMesh::FBatchData>& OutBatches)
 {
-	if (!MaterialTextureName.empty())
+	const FCookedMeshHeader* Header = (const FCookedMeshHeader*)File.Data;
+	if (File.Size < sizeof(FCookedMeshHeader) || Header->Magic != FCookedMeshHeader::Magic || Header->Version != FCookedMeshHeader::Version ||
+		Header->SourceHash != SourceHash || (File.Size - sizeof(FCookedMeshHeader)) / sizeof(FCookedBatch) < Header->NumBatches)
+	{
+		return false;
+	}
+
+	auto IsInFile = [&](uint64 Offset, uint64 Size)
+	{
+		return Offset <= File.Size && Size <= File.Size - Offset;
+	};
+
+	auto GetString = [&](uint32 Offset, std::string& OutString)
+	{
+		const char* Begin = File.Data + Offset;
+		const char* End = Offset < File.Size ? (const char*)memchr(Begin, 0, File.Size - Offset) : nullptr;
+		if (End)
+		{
+			OutString.assign(Begin, End);
+		}
+		return End != nullptr;
+	};
+
+	auto AreLODsValid = [](const FCookedBatch& Cooked)
 	{
-		FImage2DWithView* Image = nullptr;
-		auto Found = Textures.find(MaterialTextureName);
-		if (Found != Textures.end())
+		if (Cooked.NumLODs == 0 || Cooked.NumLODs > FMesh::MaxLODs)
 		{
-			Image = Found->second;
+			return false;
 		}
-		else
+		for (uint32 Index = 0; Index < Cooked.NumLODs; ++Index)
 		{
-			std::string Texture = FileUtils::MakePath(Obj->BaseDir, MaterialTextureName);
-			std::vector<char> FileData = LoadFile(Texture.c_str());
-			if (!FileData.empty())
+			const FMesh::FLOD& LOD = Cooked.LODs[Index];
+			if (LOD.FirstIndex > Cooked.NumIndices || LOD.NumIndices > Cooked.NumIndices - LOD.FirstIndex ||
+				LOD.FirstMeshlet > Cooked.NumMeshlets || LOD.NumMeshlets > Cooked.NumMeshlets - LOD.FirstMeshlet)
 			{
-				int W, H, C;
-				auto* PixelData = stbi_load_from_memory((stbi_uc*)&FileData[0], (int)FileData.size(), &W, &H, &C, 4);
-				if (PixelData)
-				{
-					Image = new FImage2DWithView;
-					Image->Create(Device->Device, W, H, VK_FORMAT_R8G8B8A8_UNORM,
-						VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemMgr, 1, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
+				return false;
+			}
+		}
+		return true;
+	};
+
+	const FCookedBatch* CookedBatches = (const FCookedBatch*)(Header + 1);
+	for (uint32 Index = 0; Index < Header->NumBatches; ++Index)
+	{
+		const FCookedBatch& Cooked = CookedBatches[Index];
+		FMesh::FBatchData Batch;
+		Batch.MaterialID = Cooked.MaterialID;
+		Batch.NumVertices = Cooked.NumVertices;
+		Batch.NumIndices = Cooked.NumIndices;
+		if (!IsInFile(Cooked.VerticesOffset, (uint64)Cooked.NumVertices * sizeof(FPosNormalUVVertex)) ||
+			!IsInFile(Cooked.IndicesOffset, (uint64)Cooked.NumIndices * sizeof(uint32)) ||
+			(Cooked.TangentsOffset && !IsInFile(Cooked.TangentsOffset, (uint64)Cooked.NumVertices * sizeof(FVector4))) ||
+			!IsInFile(Cooked.MeshletsOffset, (uint64)Cooked.NumMeshlets * sizeof(MeshOpt::FMeshlet)) || !AreLODsValid(Cooked) ||
+			!GetString(Cooked.DiffuseTextureOffset, Batch.DiffuseTexture) || !GetString(Cooked.BumpTextureOffset, Batch.BumpTexture))
+		{
+			OutBatches.clear();
+			return false;
+		}
+		Batch.Vertices = (const FPosNormalUVVertex*)(File.Data + Cooked.VerticesOffset);
+		Batch.Indices = (const uint32*)(File.Data + Cooked.IndicesOffset);
+		Batch.Tangents = Cooked.TangentsOffset ? (const FVector4*)(File.Data + Cooked.TangentsOffset) : nullptr;
+		Batch.Meshlets = Cooked.NumMeshlets ? (const MeshOpt::FMeshlet*)(File.Data + Cooked.MeshletsOffset) : nullptr;
+		Batch.NumMeshlets = Cooked.NumMeshlets;
+		Batch.NumLODs = Cooked.NumLODs;
+		memcpy(Batch.LODs, Cooked.LODs, sizeof(Batch.LODs));
+		OutBatches.push_back(Batch);
+	}
+
+	return true;
+}
+
+bool FMeshSource::Load(const char* ObjFilename)
+{
+	uint64 SourceHash = HashMeshSource(ObjFilename);
+	if (!SourceHash)
+	{
+		return false;
+	}
 
-					uint32 Size = W * H * 4;
+	std::string BaseName;
+	FileUtils::SplitPath(ObjFilename, BaseDir, BaseName, false);
+	std::string CookedFilename = FileUtils::MakePath(BaseDir, BaseName + ".mesh");
 
-					MapAndFillImageSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &Image->Image,
-						[&](FPrimaryCmdBuffer* CmdBuffer, void* Data, uint32 Width, uint32 Height)
+	if (File.Open(CookedFilename.c_str()))
+	{
+		if (ReadCookedMesh(File, SourceHash, BatchData))
+		{
+			return true;
+		}
+		BatchData.clear();
+		File.Close();
+	}
+
+	FObj Obj;
+	if (!Obj.Load(ObjFilename))
+	{
+		Obj.Destroy();
+		return false;
+	}
+
+	BuildBatchStreams(&Obj, Vertices, Indices);
+	OptimizeBatchStreams(&Obj, Vertices, Indices);
+	BuildTangents(&Obj, Vertices, Indices, Tangents);
+	BuildLODs(Vertices, Indices, LODs);
+	BuildMeshlets(Vertices, Indices, LODs, Meshlets);
+
+	GetBatchData(&Obj, Vertices, Indices, Tangents, LODs, Meshlets, BatchData);
+	if (!SaveCookedMesh(CookedFilename, SourceHash, BatchData))
+	{
+		// Not fatal, it'll get cooked again next time
+		::OutputDebugStringA(("*** Unable to write " + CookedFilename + "\n").c_str());
+	}
+
+	Obj.Destroy();
+	return true;
+}
+
+bool FMesh::Load(const char* ObjFilename, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, bool bQuantize)
+{
+	bQuantized = bQuantize;
+	FMeshSource Source;
+	if (!Source.Load(ObjFilename))
+	{
+		return false;
+	}
+
+	CreateBatches(Source.BaseDir, Source.BatchData, Device, CmdBufMgr, StagingMgr, MemMgr);
+	return true;
+}
+
+void FAsyncMeshLoader::Start(FMesh* InMesh, const char* ObjFilename, bool bQuantize)
+{
+	check(!Mesh);
+	Mesh = InMesh;
+	Mesh->bQuantized = bQuantize;
+	Filename = ObjFilename;
+	Source = new FMeshSource;
+	bSourceLoaded = false;
+	bSourceReady = false;
+	bTexturesDone = false;
+	bCancel = false;
+	bBatchesCreated = false;
+	bFailed = false;
+	StartTime = std::chrono::high_resolution_clock::now();
+
+	bool bCompress = Mesh->bCompressTextures;
+	Thread = std::thread([this, bCompress]()
+	{
+		bSourceLoaded = Source->Load(Filename.c_str());
+		bSourceReady = true;
+		if (bSourceLoaded)
+		{
+			std::set<std::string> Names;
+			for (auto& Data : Source->BatchData)
+			{
+				for (const std::string* Name : { &Data.DiffuseTexture, &Data.BumpTexture })
+				{
+					if (!Name->empty())
 					{
-						ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, Image->Image.Image,
-							VK_IMAGE_LAYOUT_UNDEFINED, 0,
-							VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
-							VK_IMAGE_ASPECT_COLOR_BIT);
-						memcpy(Data, PixelData, Size);
-					}, Size, __FILE__, __LINE__);
+						Names.insert(*Name);
+					}
 				}
-				stbi_image_free(PixelData);
-				Textures[MaterialTextureName] = Image;
 			}
+
+			// The staging buffers belong to the main thread, so these get decoded into their own memory and copied in Update()
+			std::vector<std::string> NameList(Names.begin(), Names.end());
+			ParallelFor((uint32)NameList.size(), [&](uint32 Index)
+			{
+				if (bCancel)
+				{
+					return;
+				}
+
+				FDecodedTexture Decoded;
+				FMesh::ReadTexture(Source->BaseDir, NameList[Index], bCompress, Decoded);
+				FMesh::DecodeTexture(Decoded);
+				std::lock_guard<std::mutex> Lock(Mutex);
+				DecodedTextures.push_back(std::move(Decoded));
+			});
 		}
-		FBatch* Batch = FindBatchByMaterialID(Index);
-		if (Batch)
+		bTexturesDone = true;
+	});
+}
+
+bool FAsyncMeshLoader::Update(FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr)
+{
+	check(Mesh);
+	if (!bSourceReady)
+	{
+		return false;
+	}
+
+	if (!bSourceLoaded)
+	{
+		bFailed = true;
+		Finish();
+		return true;
+	}
+
+	if (!bBatchesCreated)
+	{
+		Mesh->CreateBatches(Source->BaseDir, Source->BatchData, Device, CmdBufMgr, StagingMgr, MemMgr, false);
+		bBatchesCreated = true;
+		std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - StartTime;
+		GeometryTimeInMS = Time.count();
+	}
+
+	// Read before taking the queue, so a texture pushed after the check can't be left behind
+	bool bDone = bTexturesDone;
+	std::vector<FDecodedTexture> Ready;
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Ready.swap(DecodedTextures);
+	}
+
+	// Everything decoded since last frame goes up in one submission
+	Mesh->CreateTextures(Ready, Device, CmdBufMgr, StagingMgr, MemMgr);
+	for (auto& Decoded : Ready)
+	{
+		FImage2DWithView* Image = Mesh->Textures[Decoded.Name];
+		for (size_t Index = 0; Index < Source->BatchData.size(); ++Index)
 		{
-			Callback(Batch) = Image;
+			const FMesh::FBatchData& Data = Source->BatchData[Index];
+			FMesh::FBatch* Batch = Mesh->Batches[Index];
+			Batch->DiffuseTexture = Data.DiffuseTexture == Decoded.Name ? Image : Batch->DiffuseTexture;
+			Batch->BumpTexture = Data.BumpTexture == Decoded.Name ? Image : Batch->BumpTexture;
 		}
 	}
-}
 
-bool FObj::Load(const char* Filename)
-{
-	std::string err;
-	Loaded = new FTinyObj;
-	std::string Dummy;
-	FileUtils::SplitPath(Filename, BaseDir, Dummy, true);
-	if (!tinyobj::LoadObj(&Loaded->attrib, &Loaded->shapes, &Loaded->materials, &err, Filename, BaseDir.c_str()/*basepath*/, true/*triangulate*/))
+	if (!bDone)
 	{
 		return false;
 	}
 
+	std::chrono::duration<double, std::milli> Time = std::chrono::high_resolution_clock::now() - StartTime;
+	TotalTimeInMS = Time.count();
+	Finish();
 	return true;
 }
 
+void FAsyncMeshLoader::Cancel()
+{
+	check(Mesh);
+	bCancel = true;
+	Thread.join();
+	DecodedTextures.clear();
+	Finish();
+}
+
+void FAsyncMeshLoader::Finish()
+{
+	if (Thread.joinable())
+	{
+		Thread.join();
+	}
+	delete Source;
+	Source = nullptr;
+	Mesh = nullptr;
+}
+
+// Bounds of the batch; a flat axis gets a scale of 0 so everything quantizes to the minimum
+static FMesh::FQuantizationUB GetQuantization(const FPosNormalUVVertex* Vertices, uint32 NumVertices)
+{
+	FVector3 Min(NumVertices ? Vertices[0].x : 0, NumVertices ? Vertices[0].y : 0, NumVertices ? Vertices[0].z : 0);
+	FVector3 Max = Min;
+	for (uint32 Index = 1; Index < NumVertices; ++Index)
+	{
+		const FPosNormalUVVertex& Vertex = Vertices[Index];
+		Min.Set(Vertex.x < Min.x ? Vertex.x : Min.x, Vertex.y < Min.y ? Vertex.y : Min.y, Vertex.z < Min.z ? Vertex.z : Min.z);
+		Max.Set(Vertex.x > Max.x ? Vertex.x : Max.x, Vertex.y > Max.y ? Vertex.y : Max.y, Vertex.z > Max.z ? Vertex.z : Max.z);
+	}
+
+	FMesh::FQuantizationUB Quantization;
+	Quantization.PositionMin = FVector4(Min, 0);
+	Quantization.PositionScale = FVector4(Max - Min, 0);
+	return Quantization;
+}
+
+static void QuantizeVertices(const FMesh::FQuantizationUB& Quantization, const FPosNormalUVVertex* Vertices, uint32 NumVertices, FQuantizedPosNormalUVVertex* OutVertices)
+{
+	auto ToUNorm16 = [](float Value, float Min, float Scale)
+	{
+		float f = Scale > 0 ? (Value - Min) / Scale : 0;
+		f = f < 0 ? 0 : (f > 1 ? 1 : f);
+		return (uint16)(f * 65535.0f + 0.5f);
+	};
+
+	for (uint32 Index = 0; Index < NumVertices; ++Index)
+	{
+		const FPosNormalUVVertex& In = Vertices[Index];
+		FQuantizedPosNormalUVVertex& Out = OutVertices[Index];
+		Out.x = ToUNorm16(In.x, Quantization.PositionMin.x, Quantization.PositionScale.x);
+		Out.y = ToUNorm16(In.y, Quantization.PositionMin.y, Quantization.PositionScale.y);
+		Out.z = ToUNorm16(In.z, Quantization.PositionMin.z, Quantization.PositionScale.z);
+		Out.Padding = 0;
+		Out.Normal = PackNormalOctahedral(FVector3(In.nx, In.ny, In.nz));
+		Out.u = FloatToHalf(In.u);
+		Out.v = FloatToHalf(In.v);
+	}
+}
+
+// Square root of the ratio of the areas of the LOD 0 triangles in UV and in object space
+static float GetUVDensity(const FMesh::FBatchData& Data)
+{
+	double UVArea = 0;
+	double Area = 0;
+	uint32 FirstIndex = Data.NumLODs ? Data.LODs[0].FirstIndex : 0;
+	uint32 NumIndices = Data.NumLODs ? Data.LODs[0].NumIndices : Data.NumIndices;
+	for (uint32 Index = FirstIndex; Index + 2 < FirstIndex + NumIndices; Index += 3)
+	{
+		const FPosNormalUVVertex& V0 = Data.Vertices[Data.Indices[Index + 0]];
+		const FPosNormalUVVertex& V1 = Data.Vertices[Data.Indices[Index + 1]];
+		const FPosNormalUVVertex& V2 = Data.Vertices[Data.Indices[Index + 2]];
+		FVector3 Edge1(V1.x - V0.x, V1.y - V0.y, V1.z - V0.z);
+		FVector3 Edge2(V2.x - V0.x, V2.y - V0.y, V2.z - V0.z);
+		Area += Cross(Edge1, Edge2).GetLength();
+		UVArea += fabs((V1.u - V0.u) * (V2.v - V0.v) - (V2.u - V0.u) * (V1.v - V0.v));
+	}
+	return Area > 0 ? (float)sqrt(UVArea / Area) : 0;
+}
+
+void FMesh::CreateBatches(const std::string& BaseDir, const std::vector<FBatchData>& BatchData, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, bool bCreateTextures)
+{
+	check(Batches.empty());
+	uint32 TotalVertices = 0;
+	uint32 TotalIndices = 0;
+	NumLODs = 1;
+	for (uint32 LOD = 0; LOD < MaxLODs; ++LOD)
+	{
+		LODErrors[LOD] = 0;
+	}
+
+	FVector3 Min(FLT_MAX, FLT_MAX, FLT_MAX);
+	FVector3 Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (auto& Data : BatchData)
+	{
+		for (uint32 Index = 0; Index < Data.NumVertices; ++Index)
+		{
+			const FPosNormalUVVertex& Vertex = Data.Vertices[Index];
+			Min.Set(Vertex.x < Min.x ? Vertex.x : Min.x, Vertex.y < Min.y ? Vertex.y : Min.y, Vertex.z < Min.z ? Vertex.z : Min.z);
+			Max.Set(Vertex.x > Max.x ? Vertex.x : Max.x, Vertex.y > Max.y ? Vertex.y : Max.y, Vertex.z > Max.z ? Vertex.z : Max.z);
+		}
+	}
+	Bounds = Min.x > Max.x ? FVector4(0, 0, 0, 0) : FVector4(Min.Add(Max).Mul(0.5f), (Max - Min).GetLength() * 0.5f);
+
+	for (auto& Data : BatchData)
+	{
+		auto* Batch = new FBatch;
+		Batch->NumVertices = Data.NumVertices;
+		Batch->NumIndices = Data.NumIndices;
+		Batch->NumLODs = Data.NumLODs;
+		memcpy(Batch->LODs, Data.LODs, sizeof(Batch->LODs));
+		NumLODs = Batch->NumLODs > NumLODs ? Batch->NumLODs : NumLODs;
+		for (uint32 LOD = 0; LOD < MaxLODs; ++LOD)
+		{
+			float Error = Batch->GetLOD(LOD).Error;
+			LODErrors[LOD] = Error > LODErrors[LOD] ? Error : LODErrors[LOD];
+		}
+		Batch->VertexOffset = (int32)TotalVertices;
+		Batch->FirstIndex = TotalIndices;
+		TotalVertices += Data.NumVertices;
+		TotalIndices += Data.NumIndices;
+
+		if (bQuantized)
+		{
+			Batch->QuantizationUB.Create(Device->Device, MemMgr);
+			*Batch->QuantizationUB.GetMappedData() = GetQuantization(Data.Vertices, Data.NumVertices);
+		}
+
+		Batch->MaterialID = Data.MaterialID;
+		Batch->UVDensity = GetUVDensity(Data);
+		Batches.push_back(Batch);
+	}
+
+	if (bCreateTextures)
+	{
+		std::set<std::string> Names;
+		for (auto& Data : BatchData)
+		{
+			Names.insert(Data.DiffuseTexture);
+			Names.insert(Data.BumpTexture);
+		}
+		SetupTextures(BaseDir, Names, Device, CmdBufMgr, StagingMgr, MemMgr);
+
+		for (size_t Index = 0; Index < BatchData.size(); ++Index)
+		{
+			Batches[Index]->DiffuseTexture = SetupTexture(BaseDir, BatchData[Index].DiffuseTexture, Device, CmdBufMgr, StagingMgr, MemMgr);
+			Batches[Index]->BumpTexture = SetupTexture(BaseDir, BatchData[Index].BumpTexture, Device, CmdBufMgr, StagingMgr, MemMgr);
+		}
+	}
+
+	if (!TotalVertices || !TotalIndices)
+	{
+		return;
+	}
+
+	// All batches go in one vertex and one index buffer; indices stay relative to their batch and get VertexOffset added when drawing
+	uint32 VertexSize = bQuantized ? sizeof(FQuantizedPosNormalUVVertex) : sizeof(FPosNormalUVVertex);
+	ObjVB.Create(Device->Device, (uint64)VertexSize * TotalVertices, MemMgr);
+
+	auto FillVB = [&](void* VertexData, void* UserData)
+	{
+		for (size_t Index = 0; Index < BatchData.size(); ++Index)
+		{
+			const FBatchData& Data = BatchData[Index];
+			FBatch* Batch = Batches[Index];
+			if (bQuantized)
+			{
+				QuantizeVertices(*Batch->QuantizationUB.GetMappedData(), Data.Vertices, Data.NumVertices, (FQuantizedPosNormalUVVertex*)VertexData + Batch->VertexOffset);
+			}
+			else
+			{
+				memcpy((FPosNormalUVVertex*)VertexData + Batch->VertexOffset, Data.Vertices, Data.NumVertices * sizeof(FPosNormalUVVertex));
+			}
+		}
+	};
+	MapAndFillBufferSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &ObjVB.Buffer, FillVB, VertexSize * TotalVertices, this, __FILE__, __LINE__);
+
+	// Also read by CullMeshletsCS
+	ObjIB.Create(Device->Device, TotalIndices, VK_INDEX_TYPE_UINT32, MemMgr, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	auto FillIB = [&](void* IndexData, void* UserData)
+	{
+		for (size_t Index = 0; Index < BatchData.size(); ++Index)
+		{
+			memcpy((uint32*)IndexData + Batches[Index]->FirstIndex, BatchData[Index].Indices, BatchData[Index].NumIndices * sizeof(uint32));
+		}
+	};
+	MapAndFillBufferSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &ObjIB.Buffer, FillIB, sizeof(uint32) * TotalIndices, this, __FILE__, __LINE__);
+
+	CreateMeshletBuffers(BatchData, Device, CmdBufMgr, StagingMgr, MemMgr);
+}
+
+void FMesh::CreateMeshletBuffers(const std::vector<FBatchData>& BatchData, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr)
+{
+	check(!NumMeshlets);
+	for (uint32 LOD = 0; LOD < MaxLODs; ++LOD)
+	{
+		LODFirstMeshlet[LOD] = NumMeshlets;
+		LODNumMeshlets[LOD] = 0;
+		if (LOD < NumLODs)
+		{
+			for (auto* Batch : Batches)
+			{
+				LODNumMeshlets[LOD] += Batch->GetLOD(LOD).NumMeshlets;
+			}
+		}
+		NumMeshlets += LODNumMeshlets[LOD];
+	}
+
+	if (!NumMeshlets)
+	{
+		return;
+	}
+
+	MeshletsBuffer.Create(Device->Device, sizeof(FGPUMeshlet) * NumMeshlets, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemMgr, __FILE__, __LINE__);
+	auto FillMeshlets = [&](void* Data, void* UserData)
+	{
+		auto* Meshlet = (FGPUMeshlet*)Data;
+		for (uint32 LOD = 0; LOD < NumLODs; ++LOD)
+		{
+			for (size_t Index = 0; Index < BatchData.size(); ++Index)
+			{
+				const FLOD& BatchLOD = Batches[Index]->GetLOD(LOD);
+				for (uint32 MeshletIndex = BatchLOD.FirstMeshlet; MeshletIndex < BatchLOD.FirstMeshlet + BatchLOD.NumMeshlets; ++MeshletIndex)
+				{
+					const MeshOpt::FMeshlet& In = BatchData[Index].Meshlets[MeshletIndex];
+					Meshlet->Sphere = FVector4(In.Center[0], In.Center[1], In.Center[2], In.Radius);
+					Meshlet->FirstIndex = Batches[Index]->FirstIndex + In.FirstIndex;
+					Meshlet->NumIndices = In.NumIndices;
+					Meshlet->Batch = (uint32)Index;
+					Meshlet->Padding = 0;
+					++Meshlet;
+				}
+			}
+		}
+	};
+	MapAndFillBufferSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &MeshletsBuffer, FillMeshlets, sizeof(FGPUMeshlet) * NumMeshlets, this, __FILE__, __LINE__);
+
+	CulledIB.Create(Device->Device, ObjIB.NumIndices, VK_INDEX_TYPE_UINT32, MemMgr, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	uint32 IndirectSize = (uint32)(sizeof(VkDrawIndexedIndirectCommand) * Batches.size());
+	IndirectBuffer.Create(Device->Device, IndirectSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemMgr, __FILE__, __LINE__);
+	ClearIndirectBuffer.Create(Device->Device, IndirectSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemMgr, __FILE__, __LINE__);
+	auto FillDraws = [&](void* Data, void* UserData)
+	{
+		auto* Draw = (VkDrawIndexedIndirectCommand*)Data;
+		for (auto* Batch : Batches)
+		{
+			Draw->indexCount = 0;
+			Draw->instanceCount = 1;
+			Draw->firstIndex = Batch->FirstIndex;
+			Draw->vertexOffset = Batch->VertexOffset;
+			Draw->firstInstance = 0;
+			++Draw;
+		}
+	};
+	MapAndFillBufferSyncOneShotCmdBuffer(Device, CmdBufMgr, StagingMgr, &ClearIndirectBuffer, FillDraws, IndirectSize, this, __FILE__, __LINE__);
+}
+
+// Cooked textures are the compressed mip chain of a source image, so loading one is a read and a copy into staging:
+//	FCookedTextureHeader
+//	Mips from the largest down, in whole blocks
+struct FCookedTextureHeader
+{
+	enum
+	{
+		Magic = 0x58544b56,	// 'VKTX'
+		// Bump when the format or anything in TexCompress changes
+		Version = 1,
+	};
+
+	uint32 Magic;
+	uint32 Version;
+	uint64 SourceHash;
+	uint32 Format;
+	uint32 Width;
+	uint32 Height;
+	uint32 NumMips;
+};
+
+// Height maps are treated like normal maps, BC5 keeps their two channels at full precision
+static bool IsNormalMap(const std::string& MaterialTextureName)
+{
+	std::string Path;
+	std::string Name;
+	FileUtils::SplitPath(MaterialTextureName, Path, Name, false);
+	for (auto& Char : Name)
+	{
+		Char = (char)tolower(Char);
+	}
+	auto EndsWith = [&](const char* Suffix)
+	{
+		size_t Length = strlen(Suffix);
+		return Name.size() >= Length && !Name.compare(Name.size() - Length, Length, Suffix);
+	};
+	return EndsWith("-bump") || EndsWith("_n");
+}
+
+static TexCompress::EFormat GetCompressorFormat(VkFormat Format)
+{
+	switch (Format)
+	{
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		return TexCompress::EFormat::BC1;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		return TexCompress::EFormat::BC3;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		return TexCompress::EFormat::BC5;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		return TexCompress::EFormat::BC7;
+	default:
+		break;
+	}
+	check(0);
+	return TexCompress::EFormat::BC7;
+}
+
+static bool SaveCookedTexture(const FDecodedTexture& Texture, const uint8* Data)
+{
+	FCookedTextureHeader Header;
+	MemZero(Header);
+	Header.Magic = FCookedTextureHeader::Magic;
+	Header.Version = FCookedTextureHeader::Version;
+	Header.SourceHash = Texture.SourceHash;
+	Header.Format = (uint32)Texture.Format;
+	Header.Width = (uint32)Texture.Width;
+	Header.Height = (uint32)Texture.Height;
+	Header.NumMips = Texture.NumMips;
+
+	std::string TempFile = Texture.CookedFilename + ".tmp";
+	FILE* File = OpenFile(TempFile.c_str(), "wb");
+	if (!File)
+	{
+		return false;
+	}
+
+	size_t Size = (size_t)Texture.GetDataSize();
+	bool bWritten = fwrite(&Header, sizeof(Header), 1, File) == 1;
+	bWritten = bWritten && fwrite(Data, 1, Size, File) == Size;
+	fclose(File);
+
+	remove(Texture.CookedFilename.c_str());
+	if (!bWritten || rename(TempFile.c_str(), Texture.CookedFilename.c_str()) != 0)
+	{
+		remove(TempFile.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// Returns false if the file is for a different source or otherwise not usable
+static bool IsCookedTextureValid(const std::vector<char>& File, const FDecodedTexture& Texture)
+{
+	const FCookedTextureHeader* Header = (const FCookedTextureHeader*)(File.empty() ? nullptr : &File[0]);
+	return File.size() >= sizeof(FCookedTextureHeader) && Header->Magic == FCookedTextureHeader::Magic && Header->Version == FCookedTextureHeader::Version &&
+		Header->SourceHash == Texture.SourceHash && Header->Format == (uint32)Texture.Format && Header->Width == (uint32)Texture.Width &&
+		Header->Height == (uint32)Texture.Height && Header->NumMips == Texture.NumMips && File.size() - sizeof(FCookedTextureHeader) == Texture.GetDataSize();
+}
+
+// The format only depends on the name and bCompress, so the same file read the same way always makes the same image
+static std::string GetTextureCacheKey(const std::string& Filename, bool bCompress)
+{
+	return FileUtils::GetCanonicalPath(Filename) + (bCompress ? "|bc" : "");
+}
+
+// Same contents read into the same format
+static uint64 GetTextureContentHash(const FDecodedTexture& Texture)
+{
+	return Hash64(&Texture.Format, sizeof(Texture.Format), Texture.SourceHash);
+}
+
+bool FMesh::ReadTexture(const std::string& BaseDir, const std::string& MaterialTextureName, bool bCompress, FDecodedTexture& Out)
+{
+	Out.Name = MaterialTextureName;
+	std::string Texture = FileUtils::MakePath(BaseDir, MaterialTextureName);
+	Out.CacheKey = GetTextureCacheKey(Texture, bCompress);
+	Out.FileData = LoadFile(Texture.c_str());
+	int C;
+	if (Out.FileData.empty() || !stbi_info_from_memory((stbi_uc*)&Out.FileData[0], (int)Out.FileData.size(), &Out.Width, &Out.Height, &C))
+	{
+		Out.FileData.clear();
+		Out.Width = 0;
+		Out.Height = 0;
+		return false;
+	}
+
+	uint32 Size = (uint32)(Out.Width > Out.Height ? Out.Width : Out.Height);
+	uint32 NumMips = 1;
+	for (; Size > 1; Size /= 2)
+	{
+		++NumMips;
+	}
+
+	uint32 Version = FCookedTextureHeader::Version;
+	Out.SourceHash = Hash64(&Out.FileData[0], Out.FileData.size(), Hash64(&Version, sizeof(Version)));
+
+	if (!bCompress)
+	{
+		// GenerateMips() can't go past 4096x4096; those stay with mip 0 only, as they always did
+		if (NumMips > 1 && Out.Width <= 4096 && Out.Height <= 4096)
+		{
+			Out.NumMips = NumMips;
+			Out.bGenerateMips = true;
+		}
+	}
+	else
+	{
+		Out.Format = IsNormalMap(MaterialTextureName) ? VK_FORMAT_BC5_UNORM_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+		Out.NumMips = NumMips;
+		Out.CookedFilename = Texture + ".tex";
+		std::vector<char> Cooked = LoadFile(Out.CookedFilename.c_str());
+		if (IsCookedTextureValid(Cooked, Out))
+		{
+			Out.FileData.swap(Cooked);
+			Out.bCooked = true;
+		}
+	}
+
+	return true;
+}
+
+bool FMesh::DecodeTexture(FDecodedTexture& InOut, uint8* Dest)
+{
+	if (InOut.FileData.empty())
+	{
+		return false;
+	}
+
+	size_t Size = (size_t)InOut.GetDataSize();
+	if (!Dest)
+	{
+		InOut.Data.resize(Size);
+		Dest = &InOut.Data[0];
+	}
+
+	if (InOut.bCooked)
+	{
+		memcpy(Dest, &InOut.FileData[sizeof(FCookedTextureHeader)], Size);
+		std::vector<char>().swap(InOut.FileData);
+		return true;
+	}
+
+	int Width, Height, C;
+	uint8* Pixels = stbi_load_from_memory((stbi_uc*)&InOut.FileData[0], (int)InOut.FileData.size(), &Width, &Height, &C, 4);
+	check(!Pixels || (Width == InOut.Width && Height == InOut.Height));
+	std::vector<char>().swap(InOut.FileData);
+	if (!Pixels)
+	{
+		std::vector<uint8>().swap(InOut.Data);
+		return false;
+	}
+
+	if (InOut.Format == VK_FORMAT_R8G8B8A8_UNORM)
+	{
+		memcpy(Dest, Pixels, Size);
+		stbi_image_free(Pixels);
+		return true;
+	}
+
+	// Each mip is filtered from the one above before it gets compressed
+	TexCompress::EFormat Format = GetCompressorFormat(InOut.Format);
+	std::vector<uint8> Mip(Pixels, Pixels + (size_t)Width * Height * 4);
+	std::vector<uint8> NextMip;
+	stbi_image_free(Pixels);
+	uint8* MipDest = Dest;
+	for (uint32 Index = 0; Index < InOut.NumMips; ++Index)
+	{
+		TexCompress::Compress(Format, &Mip[0], Width, Height, MipDest);
+		MipDest += InOut.GetMipSize(Index);
+		if (Index + 1 < InOut.NumMips)
+		{
+			NextMip.resize((size_t)(Width > 1 ? Width / 2 : 1) * (Height > 1 ? Height / 2 : 1) * 4);
+			TexCompress::Downsample(&Mip[0], Width, Height, &NextMip[0]);
+			Mip.swap(NextMip);
+			Width = Width > 1 ? Width / 2 : 1;
+			Height = Height > 1 ? Height / 2 : 1;
+		}
+	}
+
+	if (!SaveCookedTexture(InOut, Dest))
+	{
+		// Not fatal, it'll get cooked again next time
+		::OutputDebugStringA(("*** Unable to write " + InOut.CookedFilename + "\n").c_str());
+	}
+
+	return true;
+}
+
+void FMesh::CreateTextures(std::vector<FDecodedTexture>& InTextures, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr)
+{
+	// Only the first of each file or contents gets an image; the others pick it up from GTextureCache at the end
+	std::vector<FDecodedTexture*> NewTextures;
+	std::vector<FDecodedTexture*> Duplicates;
+	{
+		std::set<std::string> NewCacheKeys;
+		std::set<uint64> NewContentHashes;
+		for (auto& Texture : InTextures)
+		{
+			if (Texture.Width > 0 && Texture.Height > 0)
+			{
+				uint64 ContentHash = GetTextureContentHash(Texture);
+				FImage2DWithView* Shared = GTextureCache.AddRef(Texture.CacheKey, ContentHash);
+				if (Shared)
+				{
+					Textures[Texture.Name] = Shared;
+					std::vector<uint8>().swap(Texture.Data);
+					std::vector<char>().swap(Texture.FileData);
+					continue;
+				}
+
+				if (NewCacheKeys.count(Texture.CacheKey) || NewContentHashes.count(ContentHash))
+				{
+					Duplicates.push_back(&Texture);
+					continue;
+				}
+				NewCacheKeys.insert(Texture.CacheKey);
+				NewContentHashes.insert(ContentHash);
+			}
+			NewTextures.push_back(&Texture);
+		}
+	}
+
+	// Streamed textures only upload their last mips here, the rest stays in Data for the streamer
+	auto GetFirstMip = [&](const FDecodedTexture& Texture) -> uint32
+	{
+		bool bStream = Streamer && Texture.Width > 0 && Texture.Height > 0 && Texture.NumMips > 1 && !Texture.bGenerateMips;
+		return bStream ? Texture.NumMips - FTextureStreamer::GetInitialResidentMips(Texture) : 0;
+	};
+
+	size_t Begin = 0;
+	while (Begin < NewTextures.size())
+	{
+		// Pack as many as fit in MaxTextureStagingSize; mips are whole blocks or texels, so every offset stays aligned to them
+		std::vector<uint64> Offsets;
+		uint64 StagingSize = 0;
+		size_t End = Begin;
+		for (; End < NewTextures.size(); ++End)
+		{
+			const FDecodedTexture& Texture = *NewTextures[End];
+			uint64 Size = Texture.GetDataSize() - Texture.GetMipOffset(GetFirstMip(Texture));
+			if (End > Begin && StagingSize + Size > MaxTextureStagingSize)
+			{
+				break;
+			}
+			Offsets.push_back(StagingSize);
+			StagingSize += Size;
+		}
+
+		std::vector<FImage2DWithView*> Images(End - Begin, nullptr);
+		for (size_t Index = Begin; Index < End; ++Index)
+		{
+			FDecodedTexture& Texture = *NewTextures[Index];
+			if (Texture.Width > 0 && Texture.Height > 0)
+			{
+				// Compressed formats can't be rendered to; the streamer copies the mips it keeps out of the image
+				uint32 FirstMip = GetFirstMip(Texture);
+				VkImageUsageFlags Usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+				Usage |= IsBlockCompressedFormat(Texture.Format) ? 0 : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+				Usage |= Texture.bGenerateMips ? VK_IMAGE_USAGE_STORAGE_BIT : 0;
+				Usage |= FirstMip > 0 ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0;
+				uint32 Width = (uint32)Texture.Width >> FirstMip;
+				uint32 Height = (uint32)Texture.Height >> FirstMip;
+				auto* Image = new FImage2DWithView;
+				Image->Create(Device->Device, Width ? Width : 1, Height ? Height : 1, Texture.Format, Usage,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemMgr, Texture.NumMips - FirstMip, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
+				Images[Index - Begin] = Image;
+			}
+		}
+
+		if (StagingSize > 0)
+		{
+			FOneShotCmdBuffer OneShotCmdBuffer(Device, CmdBufMgr);
+			auto* CmdBuffer = OneShotCmdBuffer.CmdBuffer;
+			FStagingBuffer* StagingBuffer = StagingMgr->RequestUploadBuffer(StagingSize, __FILE__, __LINE__);
+			auto* StagingData = (uint8*)StagingBuffer->GetMappedData();
+			check(StagingData);
+
+			ParallelFor((uint32)(End - Begin), [&](uint32 Index)
+			{
+				FDecodedTexture& Texture = *NewTextures[Begin + Index];
+				if (!Images[Index])
+				{
+					return;
+				}
+
+				uint8* Dest = StagingData + Offsets[Index];
+				size_t Size = (size_t)Texture.GetDataSize();
+				uint32 FirstMip = GetFirstMip(Texture);
+				if (FirstMip > 0)
+				{
+					// The streamer needs all of them, so these get decoded into Data
+					if (Texture.Data.empty() && !DecodeTexture(Texture))
+					{
+						Texture.Data.assign(Size, 0);
+					}
+					uint64 Offset = Texture.GetMipOffset(FirstMip);
+					memcpy(Dest, &Texture.Data[(size_t)Offset], Size - (size_t)Offset);
+				}
+				else if (!Texture.Data.empty())
+				{
+					memcpy(Dest, &Texture.Data[0], Size);
+					std::vector<uint8>().swap(Texture.Data);
+				}
+				else if (!DecodeTexture(Texture, Dest))
+				{
+					// The header was fine but the data wasn't; leave it black rather than with whatever was in staging
+					memset(Dest, 0, Size);
+				}
+			});
+			FlushMappedBuffer(Device->Device, StagingBuffer);
+
+			for (size_t Index = 0; Index < Images.size(); ++Index)
+			{
+				FImage2DWithView* Image = Images[Index];
+				if (!Image)
+				{
+					continue;
+				}
+
+				const FDecodedTexture& Texture = *NewTextures[Begin + Index];
+				ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, Image->GetImage(),
+					VK_IMAGE_LAYOUT_UNDEFINED, 0,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+					VK_IMAGE_ASPECT_COLOR_BIT, Image->Image.NumMips);
+
+				// The mips are packed the way DecodeTexture() writes them
+				uint32 NumMipsInData = Texture.bGenerateMips ? 1 : Image->Image.NumMips;
+				std::vector<FImageSubresource> Subresources;
+				uint64 Size = GetImageSubresources(&Image->Image, Subresources, 0, NumMipsInData);
+				check(Size == Texture.GetDataSize() - Texture.GetMipOffset(GetFirstMip(Texture)));
+				CopyBufferToImage(CmdBuffer, StagingBuffer->Buffer, Offsets[Index], &Image->Image, Subresources);
+
+				// The Lit descriptors expect them ready to sample; GenerateMips() leaves the mips it fills that way too
+				ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, Image->GetImage(),
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+					VK_IMAGE_ASPECT_COLOR_BIT, NumMipsInData);
+				if (Texture.bGenerateMips)
+				{
+					GenerateMips(CmdBuffer, *Image);
+				}
+			}
+
+			StagingBuffer->SetFence(CmdBuffer);
+		}
+
+		for (size_t Index = Begin; Index < End; ++Index)
+		{
+			FDecodedTexture& Texture = *NewTextures[Index];
+			FImage2DWithView* Image = Images[Index - Begin];
+			if (Image)
+			{
+				bool bStreamed = Image->Image.NumMips < Texture.NumMips;
+				GTextureCache.Add(Texture.CacheKey, GetTextureContentHash(Texture), Image, bStreamed ? Streamer : nullptr);
+				if (bStreamed)
+				{
+					Streamer->Add(Image, Texture, Image->Image.NumMips);
+				}
+			}
+			std::vector<uint8>().swap(Texture.Data);
+			std::vector<char>().swap(Texture.FileData);
+			Textures[Texture.Name] = Image;
+		}
+
+		Begin = End;
+	}
+
+	for (FDecodedTexture* Texture : Duplicates)
+	{
+		Textures[Texture->Name] = GTextureCache.AddRef(Texture->CacheKey, GetTextureContentHash(*Texture));
+		check(Textures[Texture->Name]);
+		std::vector<uint8>().swap(Texture->Data);
+		std::vector<char>().swap(Texture->FileData);
+	}
+}
+
+void FMesh::SetupTextures(const std::string& BaseDir, const std::set<std::string>& MaterialTextureNames, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr)
+{
+	std::vector<FDecodedTexture> NewTextures;
+	for (auto& Name : MaterialTextureNames)
+	{
+		if (!Name.empty() && Textures.find(Name) == Textures.end())
+		{
+			// Loaded already, for this mesh under another path or for another mesh
+			FImage2DWithView* Shared = GTextureCache.AddRef(GetTextureCacheKey(FileUtils::MakePath(BaseDir, Name), bCompressTextures));
+			if (Shared)
+			{
+				Textures[Name] = Shared;
+				continue;
+			}
+
+			NewTextures.push_back(FDecodedTexture());
+			NewTextures.back().Name = Name;
+		}
+	}
+
+	// Only the headers here, so CreateTextures() can lay out the staging buffer and decode into it
+	ParallelFor((uint32)NewTextures.size(), [&](uint32 Index)
+	{
+		ReadTexture(BaseDir, NewTextures[Index].Name, bCompressTextures, NewTextures[Index]);
+	});
+
+	CreateTextures(NewTextures, Device, CmdBufMgr, StagingMgr, MemMgr);
+}
+
+FImage2DWithView* FMesh::SetupTexture(const std::string& BaseDir, const std::string& MaterialTextureName, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr)
+{
+	if (MaterialTextureName.empty())
+	{
+		return nullptr;
+	}
+
+	auto Found = Textures.find(MaterialTextureName);
+	if (Found != Textures.end())
+	{
+		return Found->second;
+	}
+
+	SetupTextures(BaseDir, { MaterialTextureName }, Device, CmdBufMgr, StagingMgr, MemMgr);
+	return Textures[MaterialTextureName];
+}
+
+void FMesh::DestroyTextures()
+{
+	for (auto Pair : Textures)
+	{
+		// Textures that failed to load stay in the map as nullptr
+		if (Pair.second)
+		{
+			GTextureCache.Release(Pair.second);
+		}
+	}
+	Textures.clear();
+}
+
+FImage2DWithView* FTextureCache::AddRef(const std::string& CacheKey, uint64 ContentHash)
+{
+	FImage2DWithView* Image = nullptr;
+	auto FoundKey = ByCacheKey.find(CacheKey);
+	if (FoundKey != ByCacheKey.end())
+	{
+		Image = FoundKey->second;
+	}
+	else if (ContentHash)
+	{
+		auto FoundHash = ByContentHash.find(ContentHash);
+		if (FoundHash == ByContentHash.end())
+		{
+			return nullptr;
+		}
+
+		Image = FoundHash->second;
+		ByCacheKey[CacheKey] = Image;
+		Entries[Image].CacheKeys.push_back(CacheKey);
+	}
+	else
+	{
+		return nullptr;
+	}
+
+	++Entries[Image].NumRefs;
+	return Image;
+}
+
+void FTextureCache::Add(const std::string& CacheKey, uint64 ContentHash, FImage2DWithView* Image, FTextureStreamer* Streamer)
+{
+	check(Image && Entries.find(Image) == Entries.end() && ByCacheKey.find(CacheKey) == ByCacheKey.end());
+	FEntry& Entry = Entries[Image];
+	Entry.NumRefs = 1;
+	Entry.ContentHash = ContentHash;
+	Entry.CacheKeys.push_back(CacheKey);
+	Entry.Streamer = Streamer;
+	ByCacheKey[CacheKey] = Image;
+	ByContentHash[ContentHash] = Image;
+}
+
+void FTextureCache::Release(FImage2DWithView* Image)
+{
+	auto Found = Entries.find(Image);
+	check(Found != Entries.end() && Found->second.NumRefs > 0);
+	FEntry& Entry = Found->second;
+	if (--Entry.NumRefs > 0)
+	{
+		return;
+	}
+
+	for (auto& CacheKey : Entry.CacheKeys)
+	{
+		ByCacheKey.erase(CacheKey);
+	}
+	ByContentHash.erase(Entry.ContentHash);
+	if (Entry.Streamer)
+	{
+		Entry.Streamer->Remove(Image);
+	}
+	Entries.erase(Found);
+
+	Image->Destroy();
+	delete Image;
+}
+
+uint32 FTextureStreamer::GetInitialResidentMips(const FDecodedTexture& Texture)
+{
+	uint32 Size = (uint32)(Texture.Width > Texture.Height ? Texture.Width : Texture.Height);
+	uint32 FirstMip = 0;
+	while (FirstMip + 1 < Texture.NumMips && (Size >> FirstMip) > MinResidentSize)
+	{
+		++FirstMip;
+	}
+	return Texture.NumMips - FirstMip;
+}
+
+void FTextureStreamer::Add(FImage2DWithView* Image, FDecodedTexture& Texture, uint32 ResidentMips)
+{
+	check(Entries.find(Image) == Entries.end() && Texture.Data.size() == Texture.GetDataSize());
+	FEntry& Entry = Entries[Image];
+	Entry.Image = Image;
+	Entry.Texture.Name = Texture.Name;
+	Entry.Texture.Format = Texture.Format;
+	Entry.Texture.Width = Texture.Width;
+	Entry.Texture.Height = Texture.Height;
+	Entry.Texture.NumMips = Texture.NumMips;
+	Entry.Texture.Data.swap(Texture.Data);
+	Entry.MinResidentMips = GetInitialResidentMips(Entry.Texture);
+	Entry.ResidentMips = ResidentMips;
+	Entry.WantedMips = Entry.MinResidentMips;
+	Entry.LastRequestFrame = Frame;
+	ResidentSize += Entry.GetSize(ResidentMips);
+}
+
+void FTextureStreamer::Remove(FImage2DWithView* Image)
+{
+	auto Found = Entries.find(Image);
+	if (Found != Entries.end())
+	{
+		ResidentSize -= Found->second.GetSize(Found->second.ResidentMips);
+		Entries.erase(Found);
+	}
+}
+
+void FTextureStreamer::Request(FImage2DWithView* Image, float UVDensity, float PixelsPerUnit)
+{
+	auto Found = Entries.find(Image);
+	if (Found == Entries.end())
+	{
+		return;
+	}
+
+	FEntry& Entry = Found->second;
+	Entry.LastRequestFrame = Frame;
+	const FDecodedTexture& Texture = Entry.Texture;
+	uint32 Mips = Texture.NumMips;
+	if (UVDensity <= 0)
+	{
+		// Every texel has the same UV
+		Mips = 1;
+	}
+	else if (PixelsPerUnit < FLT_MAX)
+	{
+		// The sampler reads mip N once a pixel covers 2^N texels of mip 0; FLT_MAX means the camera is inside the bounds
+		float TexelsPerPixel = UVDensity * (float)(Texture.Width > Texture.Height ? Texture.Width : Texture.Height) / PixelsPerUnit;
+		for (; Mips > 1 && TexelsPerPixel >= 2.0f; --Mips)
+		{
+			TexelsPerPixel *= 0.5f;
+		}
+	}
+	Entry.RequestedMips = Mips > Entry.RequestedMips ? Mips : Entry.RequestedMips;
+}
+
+void FTextureStreamer::Update(FCmdBuffer* CmdBuffer)
+{
+	std::vector<FEntry*> Wanting;
+	for (auto& Pair : Entries)
+	{
+		FEntry& Entry = Pair.second;
+		Entry.WantedMips = Entry.RequestedMips > Entry.MinResidentMips ? Entry.RequestedMips : Entry.MinResidentMips;
+		Entry.RequestedMips = 0;
+		if (Entry.WantedMips > Entry.ResidentMips)
+		{
+			Wanting.push_back(&Entry);
+		}
+	}
+	++Frame;
+
+	// In case the budget went down
+	MakeRoom(CmdBuffer, 0, nullptr);
+
+	// The ones missing the most mips first
+	std::sort(Wanting.begin(), Wanting.end(), [](const FEntry* A, const FEntry* B)
+	{
+		return A->WantedMips - A->ResidentMips > B->WantedMips - B->ResidentMips;
+	});
+
+	uint64 Uploaded = 0;
+	for (FEntry* Entry : Wanting)
+	{
+		uint64 ResidentEntrySize = Entry->GetSize(Entry->ResidentMips);
+		uint32 Mips = Entry->WantedMips;
+		while (Mips > Entry->ResidentMips + 1 && Uploaded + Entry->GetSize(Mips) - ResidentEntrySize > MaxUploadPerFrame)
+		{
+			--Mips;
+		}
+
+		uint64 Size = Entry->GetSize(Mips) - ResidentEntrySize;
+		if (Uploaded > 0 && Uploaded + Size > MaxUploadPerFrame)
+		{
+			break;
+		}
+
+		// Textures that need all their mips aren't evicted for others, so this one waits for something to go out of view
+		if (MakeRoom(CmdBuffer, Size, Entry))
+		{
+			SetResidentMips(CmdBuffer, *Entry, Mips);
+			Uploaded += Size;
+			StreamedInSize += Size;
+		}
+	}
+}
+
+bool FTextureStreamer::MakeRoom(FCmdBuffer* CmdBuffer, uint64 Size, const FEntry* Keep)
+{
+	while (ResidentSize + Size > Budget)
+	{
+		FEntry* Victim = nullptr;
+		for (auto& Pair : Entries)
+		{
+			FEntry& Entry = Pair.second;
+			if (&Entry != Keep && Entry.ResidentMips > Entry.WantedMips && (!Victim || Entry.LastRequestFrame < Victim->LastRequestFrame))
+			{
+				Victim = &Entry;
+			}
+		}
+
+		if (!Victim)
+		{
+			return false;
+		}
+
+		EvictedSize += Victim->GetSize(Victim->ResidentMips) - Victim->GetSize(Victim->WantedMips);
+		SetResidentMips(CmdBuffer, *Victim, Victim->WantedMips);
+	}
+
+	return true;
+}
+
+void FTextureStreamer::SetResidentMips(FCmdBuffer* CmdBuffer, FEntry& Entry, uint32 ResidentMips)
+{
+	const FDecodedTexture& Texture = Entry.Texture;
+	uint32 OldFirstMip = Texture.NumMips - Entry.ResidentMips;
+	uint32 FirstMip = Texture.NumMips - ResidentMips;
+	FImage2DWithView* Image = Entry.Image;
+
+	uint32 Width = (uint32)Texture.Width >> FirstMip;
+	uint32 Height = (uint32)Texture.Height >> FirstMip;
+	auto* NewImage = new FImage2DWithView;
+	NewImage->Create(Device->Device, Width ? Width : 1, Height ? Height : 1, Texture.Format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemMgr, ResidentMips, VK_SAMPLE_COUNT_1_BIT, __FILE__, __LINE__);
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, NewImage->GetImage(),
+		VK_IMAGE_LAYOUT_UNDEFINED, 0,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT, ResidentMips);
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, Image->GetImage(),
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT, Entry.ResidentMips);
+
+	// The mips both have stay on the GPU
+	std::vector<VkImageCopy> Regions;
+	for (uint32 Mip = FirstMip > OldFirstMip ? FirstMip : OldFirstMip; Mip < Texture.NumMips; ++Mip)
+	{
+		VkImageCopy Region;
+		MemZero(Region);
+		Region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		Region.srcSubresource.mipLevel = Mip - OldFirstMip;
+		Region.srcSubresource.layerCount = 1;
+		Region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		Region.dstSubresource.mipLevel = Mip - FirstMip;
+		Region.dstSubresource.layerCount = 1;
+		Region.extent.width = (uint32)Texture.Width >> Mip ? (uint32)Texture.Width >> Mip : 1;
+		Region.extent.height = (uint32)Texture.Height >> Mip ? (uint32)Texture.Height >> Mip : 1;
+		Region.extent.depth = 1;
+		Regions.push_back(Region);
+	}
+	vkCmdCopyImage(CmdBuffer->CmdBuffer, Image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, NewImage->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32)Regions.size(), &Regions[0]);
+
+	// And the new ones come from Data, which is packed the same way
+	if (FirstMip < OldFirstMip)
+	{
+		std::vector<FImageSubresource> Subresources;
+		uint64 Size = GetImageSubresources(&NewImage->Image, Subresources, 0, OldFirstMip - FirstMip);
+		uint64 Offset = Texture.GetMipOffset(FirstMip);
+		check(Size == Texture.GetMipOffset(OldFirstMip) - Offset);
+		FStagingBuffer* StagingBuffer = StagingMgr->RequestUploadBuffer(Size, __FILE__, __LINE__);
+		memcpy(StagingBuffer->GetMappedData(), &Texture.Data[(size_t)Offset], (size_t)Size);
+		FlushMappedBuffer(Device->Device, StagingBuffer);
+		CopyBufferToImage(CmdBuffer, StagingBuffer->Buffer, 0, &NewImage->Image, Subresources);
+		StagingBuffer->SetFence(CmdBuffer);
+	}
+
+	ImageBarrier(CmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, NewImage->GetImage(),
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT, ResidentMips);
+
+	// The batches point at Image, so it takes the new image and view; the old ones go once no frame uses them
+	std::swap(Image->Image, NewImage->Image);
+	std::swap(Image->ImageView, NewImage->ImageView);
+	DeferredDeletion->Enqueue([NewImage]()
+	{
+		NewImage->Destroy();
+		delete NewImage;
+	});
+
+	ResidentSize = ResidentSize - Entry.GetSize(Entry.ResidentMips) + Entry.GetSize(ResidentMips);
+	Entry.ResidentMips = ResidentMips;
+}
+
+bool FObj::Load(const char* Filename)
+{
+	std::string err;
+	Loaded = new FTinyObj;
+	std::string Dummy;
+	FileUtils::SplitPath(Filename, BaseDir, Dummy, true);
+	if (!tinyobj::LoadObj(&Loaded->attrib, &Loaded->shapes, &Loaded->materials, &err, Filename, BaseDir.c_str()/*basepath*/, true/*triangulate*/))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void FObj::Destroy()
+{
+	delete Loaded;
+	Loaded = nullptr;
+}
+
 #pragma optimize( "", off )
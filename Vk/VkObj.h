@@ -8,6 +8,7 @@
 #pragma optimize( "gt", off )
 #include "VkDevice.h"
 #include "VkResources.h"
+#include "../Meshes/MeshOptimizer.h"
 
 struct FPosColorUVVertex
 {
@@ -45,29 +46,122 @@ struct FPosNormalUVVertex
 	}
 };
 
+// Half the size of FPosNormalUVVertex: positions are UNORM16 inside the batch bounds (see FMesh::FQuantizationUB),
+// normals are octahedral SNORM16 and UVs half floats
+struct FQuantizedPosNormalUVVertex
+{
+	uint16 x, y, z;
+	uint16 Padding;
+	uint32 Normal;
+	uint16 u, v;
+};
+static_assert(sizeof(FQuantizedPosNormalUVVertex) * 2 == sizeof(FPosNormalUVVertex), "");
+
 struct FTinyObj;
+struct FDecodedTexture;
+struct FTextureStreamer;
 
 struct FObj
 {
 	std::string BaseDir;
 	bool Load(const char* Filename);
+	void Destroy();
 	FTinyObj* Loaded = nullptr;
 };
 
 
 struct FMesh
 {
+	enum
+	{
+		MaxLODs = 4,
+
+		// Caps the staging memory CreateTextures() holds at once; a texture bigger than this gets a submission of its own
+		MaxTextureStagingSize = 64 * 1024 * 1024,
+	};
+
+	// Each LOD of a batch is another index range over the same vertices
+	struct FLOD
+	{
+		// Relative to the batch's indices and meshlets
+		uint32 FirstIndex;
+		uint32 NumIndices;
+		uint32 FirstMeshlet;
+		uint32 NumMeshlets;
+		// How far the surface may be from LOD 0, in object space units, see MeshOpt::Simplify()
+		float Error;
+	};
+
+	// By material texture name; each image holds a reference in GTextureCache, so other meshes may be using it too
 	std::map<std::string, FImage2DWithView*> Textures;
 
+	// Over all batches; a batch with fewer LODs uses its last one for the coarser levels
+	uint32 NumLODs = 1;
+	float LODErrors[MaxLODs];
+
+	// Object space bounding sphere, center and radius
+	FVector4 Bounds;
+
+	// Batch vertex buffers hold FQuantizedPosNormalUVVertex instead of FPosNormalUVVertex
+	bool bQuantized = false;
+
+	// Position = PositionMin + Quantized * PositionScale
+	struct FQuantizationUB
+	{
+		FVector4 PositionMin;
+		FVector4 PositionScale;
+	};
+
+	// Shared by all batches
+	FVertexBuffer ObjVB;
+	FIndexBuffer ObjIB;
+
+	// Layout of MeshletsBuffer, matches FMeshlet in CullMeshletsCS.hlsl
+	struct FGPUMeshlet
+	{
+		// Center and radius
+		FVector4 Sphere;
+		// Into ObjIB
+		uint32 FirstIndex;
+		uint32 NumIndices;
+		uint32 Batch;
+		uint32 Padding;
+	};
+
+	// Only created when the batches have meshlets. CullMeshletsCS appends the indices of the visible meshlets of each batch to
+	// the batch's range in CulledIB and counts them in the batch's VkDrawIndexedIndirectCommand in IndirectBuffer.
+	// MeshletsBuffer has the meshlets of every batch for LOD 0, then for LOD 1 and so on
+	uint32 NumMeshlets = 0;
+	uint32 LODFirstMeshlet[MaxLODs];
+	uint32 LODNumMeshlets[MaxLODs];
+	FBuffer MeshletsBuffer;
+	FIndexBuffer CulledIB;
+	FBuffer IndirectBuffer;
+	// The draws with an indexCount of 0, copied over IndirectBuffer before culling
+	FBuffer ClearIndirectBuffer;
+
 	struct FBatch
 	{
-		FVertexBuffer ObjVB;
-		FIndexBuffer ObjIB;
+		// Only created for quantized meshes
+		FUniformBuffer<FQuantizationUB> QuantizationUB;
 		FImage2DWithView* DiffuseTexture = nullptr;
 		FImage2DWithView* BumpTexture = nullptr;
 		uint32 NumVertices = 0;
+		// Of all LODs
 		uint32 NumIndices = 0;
+		// Where the batch starts in ObjIB and ObjVB, for vkCmdDrawIndexed()
+		uint32 FirstIndex = 0;
+		int32 VertexOffset = 0;
 		int MaterialID = -1;
+		FLOD LODs[MaxLODs];
+		uint32 NumLODs = 1;
+		// Texture units per object space unit, for FTextureStreamer::Request()
+		float UVDensity = 0;
+
+		const FLOD& GetLOD(uint32 LOD) const
+		{
+			return LODs[LOD < NumLODs ? LOD : NumLODs - 1];
+		}
 	};
 	std::vector<FBatch*> Batches;
 
@@ -85,27 +179,337 @@ struct FMesh
 		return nullptr;
 	}
 
-	void CreateFromObj(FObj* Obj, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr);
+	// Streams for one batch, either built from an OBJ or pointing into a mapped cooked mesh
+	struct FBatchData
+	{
+		int MaterialID = -1;
+		const FPosNormalUVVertex* Vertices = nullptr;
+		uint32 NumVertices = 0;
+		// All LODs
+		const uint32* Indices = nullptr;
+		uint32 NumIndices = 0;
+		FLOD LODs[MaxLODs];
+		uint32 NumLODs = 0;
+		// One per vertex for batches with a BumpTexture, see MeshOpt::GenerateTangents()
+		const FVector4* Tangents = nullptr;
+		const MeshOpt::FMeshlet* Meshlets = nullptr;
+		uint32 NumMeshlets = 0;
+		std::string DiffuseTexture;
+		std::string BumpTexture;
+	};
+
+	void CreateFromObj(FObj* Obj, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, bool bQuantize = false);
+
+	// Uses the cooked <name>.mesh next to the OBJ if it was cooked from the same source, otherwise cooks it
+	bool Load(const char* ObjFilename, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, bool bQuantize = false);
 
 	void Destroy()
 	{
+		if (NumMeshlets)
+		{
+			ClearIndirectBuffer.Destroy();
+			IndirectBuffer.Destroy();
+			CulledIB.Destroy();
+			MeshletsBuffer.Destroy();
+			NumMeshlets = 0;
+		}
+
+		if (ObjVB.Buffer.Buffer != VK_NULL_HANDLE)
+		{
+			ObjIB.Destroy();
+			ObjVB.Destroy();
+		}
+
 		for (auto& Batch : Batches)
 		{
-			Batch->ObjIB.Destroy();
-			Batch->ObjVB.Destroy();
+			if (bQuantized)
+			{
+				Batch->QuantizationUB.Destroy();
+			}
 			delete Batch;
 		}
 		Batches.clear();
 
-		for (auto Pair : Textures)
+		DestroyTextures();
+	}
+
+	// Releases the references to the images, see FTextureCache
+	void DestroyTextures();
+
+	// Without bCreateTextures the batches are left without textures, for FAsyncMeshLoader to fill in
+	void CreateBatches(const std::string& BaseDir, const std::vector<FBatchData>& BatchData, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, bool bCreateTextures = true);
+	void CreateMeshletBuffers(const std::vector<FBatchData>& BatchData, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr);
+
+	// Textures are shared between batches, and through GTextureCache between meshes
+	FImage2DWithView* SetupTexture(const std::string& BaseDir, const std::string& MaterialTextureName, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr);
+
+	// Creates all the textures not in Textures yet, decoding them in parallel, see CreateTextures(). Files already in
+	// GTextureCache aren't read again
+	void SetupTextures(const std::string& BaseDir, const std::set<std::string>& MaterialTextureNames, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr);
+
+	// Reading and decoding only touch the CPU, so they can run on any thread. ReadTexture() loads the file, or its cooked
+	// version, and works out the size and format; DecodeTexture() then writes all the mips into Dest, or into Data without
+	// one. With bCompress diffuse textures become BC7 and normal maps BC5, with a full mip chain, cooked next to the source
+	// as <texture>.tex the first time
+	static bool ReadTexture(const std::string& BaseDir, const std::string& MaterialTextureName, bool bCompress, FDecodedTexture& Out);
+	static bool DecodeTexture(FDecodedTexture& InOut, uint8* Dest = nullptr);
+
+	// Makes the images and uploads them with one staging buffer and one submission per MaxTextureStagingSize. Textures that
+	// were only read get decoded in parallel straight into the staging buffer; decoded ones get their Data copied and freed.
+	// Every texture ends up in Textures, as nullptr if it couldn't be read. Textures GTextureCache already has, and duplicates
+	// within InTextures, share that image instead
+	void CreateTextures(std::vector<FDecodedTexture>& InTextures, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr);
+
+	// Needs the device to support textureCompressionBC
+	bool bCompressTextures = false;
+
+	// Textures with all their mips in memory go to it and start with only the small ones resident
+	FTextureStreamer* Streamer = nullptr;
+};
+
+// A material texture on its way to an image. Width and Height are 0 if the file is missing or its header couldn't be read
+struct FDecodedTexture
+{
+	std::string Name;
+	// Canonical path and how it was read, for FTextureCache
+	std::string CacheKey;
+	VkFormat Format = VK_FORMAT_R8G8B8A8_UNORM;
+	int Width = 0;
+	int Height = 0;
+	uint32 NumMips = 1;
+
+	// The source image between ReadTexture() and DecodeTexture(), or the cooked one if bCooked
+	std::vector<char> FileData;
+	bool bCooked = false;
+
+	// Where a compressed texture gets cooked to, and the hash of its source, see FCookedTextureHeader. The hash is there for
+	// uncompressed ones too, FTextureCache finds copies of a file with it
+	std::string CookedFilename;
+	uint64 SourceHash = 0;
+
+	// All the mips, largest first, only when DecodeTexture() had no Dest
+	std::vector<uint8> Data;
+
+	// Data only has mip 0 and CreateTextures() fills the rest on the GPU, see GenerateMips()
+	bool bGenerateMips = false;
+
+	uint64 GetMipSize(uint32 Mip) const
+	{
+		uint32 MipWidth = (uint32)Width >> Mip;
+		uint32 MipHeight = (uint32)Height >> Mip;
+		return GetFormatImageSize(Format, MipWidth ? MipWidth : 1, MipHeight ? MipHeight : 1);
+	}
+
+	uint64 GetDataSize() const
+	{
+		uint64 Size = 0;
+		uint32 NumMipsInData = bGenerateMips ? 1 : NumMips;
+		for (uint32 Mip = 0; Width > 0 && Height > 0 && Mip < NumMipsInData; ++Mip)
+		{
+			Size += GetMipSize(Mip);
+		}
+		return Size;
+	}
+
+	// Where mip Mip starts in Data
+	uint64 GetMipOffset(uint32 Mip) const
+	{
+		uint64 Offset = 0;
+		for (uint32 Index = 0; Index < Mip; ++Index)
+		{
+			Offset += GetMipSize(Index);
+		}
+		return Offset;
+	}
+};
+
+// Keeps the mesh textures that have all their mips in memory at the mips their draws ask for, under a budget. A texture
+// starts with only the mips of MinResidentSize and below. Changing how many are resident makes a new image, copies over
+// the mips both have and uploads the missing ones, and then swaps it into the same FImage2DWithView, so batches never see
+// the change. Main thread only
+struct FTextureStreamer
+{
+	enum
+	{
+		// Largest mip a texture always has
+		MinResidentSize = 64,
+
+		// Bytes of new mips per Update(); a texture that alone is over it still gets one mip
+		MaxUploadPerFrame = 16 * 1024 * 1024,
+	};
+
+	void Create(FDevice* InDevice, FMemManager* InMemMgr, FStagingManager* InStagingMgr, FDeferredDeletionQueue* InDeferredDeletion, uint64 InBudget)
+	{
+		Device = InDevice;
+		MemMgr = InMemMgr;
+		StagingMgr = InStagingMgr;
+		DeferredDeletion = InDeferredDeletion;
+		Budget = InBudget;
+	}
+
+	void Destroy()
+	{
+		// The meshes own the images
+		check(Entries.empty());
+	}
+
+	// How many of the smallest mips CreateTextures() uploads
+	static uint32 GetInitialResidentMips(const FDecodedTexture& Texture);
+
+	// Image has the last ResidentMips mips of Texture, which has all of them in Data; Data gets moved out
+	void Add(FImage2DWithView* Image, FDecodedTexture& Texture, uint32 ResidentMips);
+	void Remove(FImage2DWithView* Image);
+
+	// From each draw: the batch has UVDensity texture units per object space unit and the closest point of the instance
+	// gets PixelsPerUnit pixels per object space unit on screen. Images not streamed are ignored
+	void Request(FImage2DWithView* Image, float UVDensity, float PixelsPerUnit);
+
+	// Streams in and evicts according to the requests since the last call. Needs to be outside a render pass
+	void Update(FCmdBuffer* CmdBuffer);
+
+	// Sizes are of the mip data, which is what the images need give or take alignment
+	uint64 Budget = 0;
+	uint64 ResidentSize = 0;
+	// Since Create()
+	uint64 StreamedInSize = 0;
+	uint64 EvictedSize = 0;
+
+protected:
+	struct FEntry
+	{
+		FImage2DWithView* Image = nullptr;
+		// Every mip in Data
+		FDecodedTexture Texture;
+		uint32 MinResidentMips = 1;
+		uint32 ResidentMips = 1;
+		// Largest request since the last Update()
+		uint32 RequestedMips = 0;
+		// What Update() last decided it needs
+		uint32 WantedMips = 1;
+		uint32 LastRequestFrame = 0;
+
+		// Of the last Mips mips
+		uint64 GetSize(uint32 Mips) const
 		{
-			Pair.second->Destroy();
-			delete Pair.second;
+			return Texture.GetDataSize() - Texture.GetMipOffset(Texture.NumMips - Mips);
 		}
-		Textures.clear();
+	};
+
+	// Replaces the image of the entry with one that has its last ResidentMips mips
+	void SetResidentMips(FCmdBuffer* CmdBuffer, FEntry& Entry, uint32 ResidentMips);
+
+	// Evicts mips nobody asked for, least recently drawn first, until Size more fit in the budget
+	bool MakeRoom(FCmdBuffer* CmdBuffer, uint64 Size, const FEntry* Keep);
+
+	FDevice* Device = nullptr;
+	FMemManager* MemMgr = nullptr;
+	FStagingManager* StagingMgr = nullptr;
+	FDeferredDeletionQueue* DeferredDeletion = nullptr;
+	std::map<FImage2DWithView*, FEntry> Entries;
+	uint32 Frame = 0;
+};
+
+// Mesh texture images for the whole process, reference counted. An image is found by the canonical path of its file and
+// the settings it was read with, see FDecodedTexture::CacheKey, or by its contents when another path has the same file.
+// Main thread only
+struct FTextureCache
+{
+	void Destroy()
+	{
+		// The meshes hold the references
+		check(Entries.empty());
 	}
 
-	void SetupTexture(FObj* Obj, FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr, int32 Index, const std::string& MaterialTextureName, std::function<FImage2DWithView*&(FBatch* Batch)> Callback);
+	// Adds a reference to the image for CacheKey, or with ContentHash unless it is 0, and returns it; nullptr if there
+	// isn't one. After a match by contents CacheKey finds it too
+	FImage2DWithView* AddRef(const std::string& CacheKey, uint64 ContentHash = 0);
+
+	// Image starts with one reference. Streamer is the one it was added to, if any
+	void Add(const std::string& CacheKey, uint64 ContentHash, FImage2DWithView* Image, FTextureStreamer* Streamer);
+
+	// Destroys the image with the last reference
+	void Release(FImage2DWithView* Image);
+
+	uint32 GetNumImages() const
+	{
+		return (uint32)Entries.size();
+	}
+
+protected:
+	struct FEntry
+	{
+		uint32 NumRefs = 0;
+		uint64 ContentHash = 0;
+		std::vector<std::string> CacheKeys;
+		FTextureStreamer* Streamer = nullptr;
+	};
+
+	std::map<FImage2DWithView*, FEntry> Entries;
+	std::map<std::string, FImage2DWithView*> ByCacheKey;
+	std::map<uint64, FImage2DWithView*> ByContentHash;
+};
+
+extern FTextureCache GTextureCache;
+
+// Everything FMesh::CreateBatches() needs, without touching the device. BatchData points into File for cooked meshes, or
+// into the streams when it was just cooked from the OBJ
+struct FMeshSource
+{
+	std::string BaseDir;
+	FileUtils::FMappedFile File;
+	std::map<uint32, std::vector<FPosNormalUVVertex>> Vertices;
+	std::map<uint32, std::vector<uint32>> Indices;
+	std::map<uint32, std::vector<FVector4>> Tangents;
+	std::map<uint32, std::vector<FMesh::FLOD>> LODs;
+	std::map<uint32, std::vector<MeshOpt::FMeshlet>> Meshlets;
+	std::vector<FMesh::FBatchData> BatchData;
+
+	// Uses the cooked <name>.mesh next to the OBJ if it was cooked from the same source, otherwise cooks it
+	bool Load(const char* ObjFilename);
+};
+
+// Loads a mesh on a background thread. The main thread calls Update() every frame, which creates the batches once the
+// geometry is ready and then each texture as soon as it's decoded; until then batches draw with the placeholder texture
+struct FAsyncMeshLoader
+{
+	void Start(FMesh* InMesh, const char* ObjFilename, bool bQuantize);
+
+	// Returns true once the mesh and all its textures are created, or the mesh failed to load (see bFailed)
+	bool Update(FDevice* Device, FCmdBufferMgr* CmdBufMgr, FStagingManager* StagingMgr, FMemManager* MemMgr);
+
+	// Skips the textures not decoded yet and waits for the thread
+	void Cancel();
+
+	bool IsLoading() const
+	{
+		return Mesh != nullptr;
+	}
+
+	bool bFailed = false;
+
+	// Since Start()
+	double GeometryTimeInMS = 0;
+	double TotalTimeInMS = 0;
+
+protected:
+	void Finish();
+
+	FMesh* Mesh = nullptr;
+	std::string Filename;
+	std::thread Thread;
+	std::chrono::high_resolution_clock::time_point StartTime;
+
+	// Owned by the thread until bSourceReady
+	FMeshSource* Source = nullptr;
+	bool bSourceLoaded = false;
+	std::atomic<bool> bSourceReady;
+	bool bBatchesCreated = false;
+
+	std::mutex Mutex;
+	// Decoded by the thread and not created yet, guarded by Mutex
+	std::vector<FDecodedTexture> DecodedTextures;
+	std::atomic<bool> bTexturesDone;
+	std::atomic<bool> bCancel;
 };
 
 
@@ -119,6 +523,13 @@ struct FMeshInstance
 		FVector4 Tint;
 	};
 	FGPUUniformBuffer<FObjUB> ObjUB;
+
+	// Picked every frame, see SelectLOD()
+	uint32 LOD = 0;
 };
 
 void LoadTexturesForMesh(FDevice* Device, FMemManager* MemMgr, FMesh& Mesh, const std::string& BaseDir);
+
+// Fills mips 1 and down from mip 0, which has to be in SHADER_READ_ONLY, with one compute dispatch. The image needs STORAGE
+// usage and can be up to 4096x4096; the views of each mip come from GImageViewCache. Lives in Vk.cpp
+void GenerateMips(FCmdBuffer* CmdBuffer, FImage2DWithView& Image);
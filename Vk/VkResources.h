@@ -4,6 +4,8 @@
 #include "VkDevice.h"
 #include "VkMem.h"
 #include "../Utils/Shaders.h"
+#include "VkShaderCompiler.h"
+#include <tuple>
 #include <direct.h>
 
 class FWriteDescriptors;
@@ -92,7 +94,8 @@ struct FIndexBuffer
 
 inline void CmdBind(FCmdBuffer* CmdBuffer, FIndexBuffer* IB)
 {
-	vkCmdBindIndexBuffer(CmdBuffer->CmdBuffer, IB->Buffer.Buffer, IB->Buffer.GetBindOffset(), IB->IndexType);
+	// The buffer is already bound at its memory offset, so this one is relative to the buffer
+	vkCmdBindIndexBuffer(CmdBuffer->CmdBuffer, IB->Buffer.Buffer, 0, IB->IndexType);
 }
 
 struct FVertexBuffer
@@ -164,6 +167,7 @@ struct FImage
 		Width = InWidth;
 		Height = InHeight;
 		NumMips = InNumMips;
+		NumLayers = NumArrayLayers;
 		Format = InFormat;
 		Samples = InSamples;
 
@@ -193,13 +197,8 @@ struct FImage
 		vkBindImageMemory(Device, Image, SubAlloc->GetHandle(), SubAlloc->GetBindOffset());
 	}
 
-	void Destroy(VkDevice Device)
-	{
-		vkDestroyImage(Device, Image, nullptr);
-		Image = VK_NULL_HANDLE;
-
-		SubAlloc->Release();
-	}
+	// Also drops the views GImageViewCache has of it
+	void Destroy(VkDevice Device);
 
 	void* GetMappedData()
 	{
@@ -216,12 +215,60 @@ struct FImage
 	uint32 Width = 0;
 	uint32 Height = 0;
 	uint32 NumMips = 0;
+	// 6 for cubemaps
+	uint32 NumLayers = 1;
 	VkFormat Format = VK_FORMAT_UNDEFINED;
 	VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
 	VkMemoryRequirements Reqs;
 	FMemSubAlloc* SubAlloc = nullptr;
 };
 
+// One mip of one array layer or cube face, and where its texels go in a staging buffer
+struct FImageSubresource
+{
+	uint32 Mip = 0;
+	uint32 Layer = 0;
+	uint32 Width = 0;
+	uint32 Height = 0;
+	// Bytes from one row to the next; a row of blocks for compressed formats
+	uint64 RowPitch = 0;
+	uint64 Offset = 0;
+	uint64 Size = 0;
+};
+
+// Packs the mips of each layer one after the other, layer by layer like DDS, with every offset aligned for
+// vkCmdCopyBufferToImage(). Rows are tightly packed. Returns the bytes needed for all of them
+inline uint64 GetImageSubresources(const FImage* Image, std::vector<FImageSubresource>& OutSubresources, uint32 StartMip = 0, uint32 NumMips = UINT32_MAX, uint32 StartLayer = 0, uint32 NumLayers = UINT32_MAX)
+{
+	NumMips = NumMips == UINT32_MAX ? Image->NumMips - StartMip : NumMips;
+	NumLayers = NumLayers == UINT32_MAX ? Image->NumLayers - StartLayer : NumLayers;
+	check(StartMip + NumMips <= Image->NumMips && StartLayer + NumLayers <= Image->NumLayers);
+
+	// Offsets need to be a multiple of both 4 and the texel or block size
+	uint32 BlockSize = GetFormatBitsPerPixel(Image->Format) * (IsBlockCompressedFormat(Image->Format) ? 16 : 1) / 8;
+	uint64 Alignment = BlockSize % 4 == 0 ? BlockSize : BlockSize * 4;
+
+	uint64 Size = 0;
+	for (uint32 Layer = StartLayer; Layer < StartLayer + NumLayers; ++Layer)
+	{
+		for (uint32 Mip = StartMip; Mip < StartMip + NumMips; ++Mip)
+		{
+			FImageSubresource Subresource;
+			Subresource.Mip = Mip;
+			Subresource.Layer = Layer;
+			Subresource.Width = Image->Width >> Mip ? Image->Width >> Mip : 1;
+			Subresource.Height = Image->Height >> Mip ? Image->Height >> Mip : 1;
+			Subresource.RowPitch = GetFormatImageSize(Image->Format, Subresource.Width, 1);
+			Subresource.Offset = (Size + Alignment - 1) / Alignment * Alignment;
+			Subresource.Size = GetFormatImageSize(Image->Format, Subresource.Width, Subresource.Height);
+			Size = Subresource.Offset + Subresource.Size;
+			OutSubresources.push_back(Subresource);
+		}
+	}
+
+	return Size;
+}
+
 struct FImageView
 {
 	VkImageView ImageView = VK_NULL_HANDLE;
@@ -324,8 +371,14 @@ struct FStagingManager
 
 	FStagingBuffer* RequestUploadBufferForImage(const FImage* Image, const char* InFile, int32 InLine)
 	{
-		uint32 Size = Image->Width * Image->Height * GetFormatBitsPerPixel(Image->Format) / 8;
-		return RequestUploadBuffer(Size, InFile, InLine);
+		return RequestUploadBuffer(GetFormatImageSize(Image->Format, Image->Width, Image->Height), InFile, InLine);
+	}
+
+	// Big enough for Subresources as laid out by GetImageSubresources()
+	FStagingBuffer* RequestUploadBufferForImage(const std::vector<FImageSubresource>& Subresources, const char* InFile, int32 InLine)
+	{
+		check(!Subresources.empty());
+		return RequestUploadBuffer(Subresources.back().Offset + Subresources.back().Size, InFile, InLine);
 	}
 
 	void Update()
@@ -456,22 +509,52 @@ struct FImageCubeWithView : public FBaseImageWithView
 		return Image.Height;
 	}
 };
-struct FSampler
+// Everything FSampler sets in VkSamplerCreateInfo, and the key of FSamplerCache
+struct FSamplerDesc
 {
-	VkSampler Sampler = VK_NULL_HANDLE;
-	VkDevice Device = VK_NULL_HANDLE;
+	VkFilter MagFilter = VK_FILTER_LINEAR;
+	VkFilter MinFilter = VK_FILTER_LINEAR;
+	VkSamplerMipmapMode MipMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	VkSamplerAddressMode AddressU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	VkSamplerAddressMode AddressV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	VkSamplerAddressMode AddressW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	float MipLodBias = 0;
+	// Anisotropic filtering is only enabled above 1, which needs the samplerAnisotropy feature
+	float MaxAnisotropy = 0;
+	// Set MinLod/MaxLod only on samplers that really need to skip part of the mip chain
+	float MinLod = 0;
+	float MaxLod = VK_LOD_CLAMP_NONE;
+
+	// Reads the whole mip chain; FTextureStreamer::Request() relies on mip N being sampled once a pixel covers 2^N texels
+	static FSamplerDesc GetTrilinear()
+	{
+		return FSamplerDesc();
+	}
 
-	void CreateTrilinear(VkDevice InDevice)
+	// Also unclamped: the texture and normal map view modes in Lit.hlsl sample with it, and they should show the mip the
+	// trilinear sampler would have picked; everything else reads single mip views through it
+	static FSamplerDesc GetPoint()
 	{
-		InternalCreate(InDevice, VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_MIPMAP_MODE_LINEAR);
+		FSamplerDesc Desc;
+		Desc.MagFilter = VK_FILTER_NEAREST;
+		Desc.MinFilter = VK_FILTER_NEAREST;
+		Desc.MipMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		return Desc;
 	}
 
-	void CreatePoint(VkDevice InDevice)
+	friend inline bool operator < (const FSamplerDesc& A, const FSamplerDesc& B)
 	{
-		InternalCreate(InDevice, VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_MIPMAP_MODE_NEAREST);
+		return std::tie(A.MagFilter, A.MinFilter, A.MipMode, A.AddressU, A.AddressV, A.AddressW, A.MipLodBias, A.MaxAnisotropy, A.MinLod, A.MaxLod) <
+			std::tie(B.MagFilter, B.MinFilter, B.MipMode, B.AddressU, B.AddressV, B.AddressW, B.MipLodBias, B.MaxAnisotropy, B.MinLod, B.MaxLod);
 	}
+};
+
+struct FSampler
+{
+	VkSampler Sampler = VK_NULL_HANDLE;
+	VkDevice Device = VK_NULL_HANDLE;
 
-	void InternalCreate(VkDevice InDevice, VkFilter InMag, VkFilter InMin, VkSamplerMipmapMode InMip)
+	void Create(VkDevice InDevice, const FSamplerDesc& Desc)
 	{
 		Device = InDevice;
 
@@ -479,19 +562,19 @@ struct FSampler
 		MemZero(Info);
 		Info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 		//VkSamplerCreateFlags    flags;
-		Info.magFilter = InMag;
-		Info.minFilter = InMin;
-		Info.mipmapMode = InMip;
-		//VkSamplerAddressMode    addressModeU;
-		//VkSamplerAddressMode    addressModeV;
-		//VkSamplerAddressMode    addressModeW;
-		//float                   mipLodBias;
-		//VkBool32                anisotropyEnable;
-		//float                   maxAnisotropy;
+		Info.magFilter = Desc.MagFilter;
+		Info.minFilter = Desc.MinFilter;
+		Info.mipmapMode = Desc.MipMode;
+		Info.addressModeU = Desc.AddressU;
+		Info.addressModeV = Desc.AddressV;
+		Info.addressModeW = Desc.AddressW;
+		Info.mipLodBias = Desc.MipLodBias;
+		Info.anisotropyEnable = Desc.MaxAnisotropy > 1.0f ? VK_TRUE : VK_FALSE;
+		Info.maxAnisotropy = Desc.MaxAnisotropy;
 		//VkBool32                compareEnable;
 		//VkCompareOp             compareOp;
-		//float                   maxLod;
-		Info.maxLod = 1.0f;
+		Info.minLod = Desc.MinLod;
+		Info.maxLod = Desc.MaxLod;
 		//VkBorderColor           borderColor;
 		//VkBool32                unnormalizedCoordinates;
 		checkVk(vkCreateSampler(Device, &Info, nullptr, &Sampler));
@@ -504,6 +587,145 @@ struct FSampler
 	}
 };
 
+// One sampler per FSamplerDesc, alive until Destroy()
+struct FSamplerCache
+{
+	void Create(VkDevice InDevice)
+	{
+		Device = InDevice;
+	}
+
+	FSampler* GetOrCreate(const FSamplerDesc& Desc)
+	{
+		auto Found = Samplers.find(Desc);
+		if (Found != Samplers.end())
+		{
+			return Found->second;
+		}
+
+		auto* NewSampler = new FSampler;
+		NewSampler->Create(Device, Desc);
+		Samplers[Desc] = NewSampler;
+		return NewSampler;
+	}
+
+	void Destroy()
+	{
+		for (auto& Pair : Samplers)
+		{
+			Pair.second->Destroy();
+			delete Pair.second;
+		}
+		Samplers.clear();
+	}
+
+	VkDevice Device = VK_NULL_HANDLE;
+	std::map<FSamplerDesc, FSampler*> Samplers;
+};
+
+// Views of a range of mips and layers of an image, made the first time one is asked for and kept until the image is
+// destroyed, see FImage::Destroy(). The Vulkan views then go through DeferredDeletion, as the GPU might still be using them
+struct FImageViewCache
+{
+	void Create(VkDevice InDevice, FDeferredDeletionQueue* InDeferredDeletion)
+	{
+		Device = InDevice;
+		DeferredDeletion = InDeferredDeletion;
+	}
+
+	FImageView* GetOrCreate(VkImage Image, VkImageViewType ViewType, VkFormat Format, VkImageAspectFlags Aspect, uint32 StartMip, uint32 NumMips, uint32 StartLayer = 0, uint32 NumLayers = 1)
+	{
+		FKey Key = { Image, ViewType, Format, Aspect, StartMip, NumMips, StartLayer, NumLayers };
+		auto Found = Views.find(Key);
+		if (Found != Views.end())
+		{
+			return Found->second;
+		}
+
+		auto* NewView = new FImageView;
+		NewView->Create(Device, Image, ViewType, Format, Aspect, NumMips, NumLayers, StartMip, StartLayer);
+		Views[Key] = NewView;
+		return NewView;
+	}
+
+	// The handle can be reused by a new image, so the views are forgotten right away
+	void EvictImage(VkImage Image)
+	{
+		FKey First = { Image };
+		auto It = Views.lower_bound(First);
+		while (It != Views.end() && It->first.Image == Image)
+		{
+			FImageView* View = It->second;
+			auto Delete = [View]()
+			{
+				View->Destroy();
+				delete View;
+			};
+			if (DeferredDeletion)
+			{
+				DeferredDeletion->Enqueue(Delete);
+			}
+			else
+			{
+				Delete();
+			}
+			It = Views.erase(It);
+		}
+	}
+
+	void Destroy()
+	{
+		for (auto& Pair : Views)
+		{
+			Pair.second->Destroy();
+			delete Pair.second;
+		}
+		Views.clear();
+		DeferredDeletion = nullptr;
+	}
+
+	uint32 GetNumViews() const
+	{
+		return (uint32)Views.size();
+	}
+
+protected:
+	// Image first, so EvictImage() finds all of an image's views together
+	struct FKey
+	{
+		VkImage Image;
+		VkImageViewType ViewType;
+		VkFormat Format;
+		VkImageAspectFlags Aspect;
+		uint32 StartMip;
+		uint32 NumMips;
+		uint32 StartLayer;
+		uint32 NumLayers;
+
+		friend inline bool operator < (const FKey& A, const FKey& B)
+		{
+			return std::tie(A.Image, A.ViewType, A.Format, A.Aspect, A.StartMip, A.NumMips, A.StartLayer, A.NumLayers) <
+				std::tie(B.Image, B.ViewType, B.Format, B.Aspect, B.StartMip, B.NumMips, B.StartLayer, B.NumLayers);
+		}
+	};
+
+	VkDevice Device = VK_NULL_HANDLE;
+	FDeferredDeletionQueue* DeferredDeletion = nullptr;
+	std::map<FKey, FImageView*> Views;
+};
+
+extern FImageViewCache GImageViewCache;
+
+inline void FImage::Destroy(VkDevice Device)
+{
+	GImageViewCache.EvictImage(Image);
+
+	vkDestroyImage(Device, Image, nullptr);
+	Image = VK_NULL_HANDLE;
+
+	SubAlloc->Release();
+}
+
 struct FDescriptorSetInfo
 {
 	uint32 DescriptorSetIndex;
@@ -540,33 +762,46 @@ struct FShader : public IShader
 	{
 		Device = InDevice;
 
-		if (SpirV.empty())
+		if (!Code || CodeSize == 0)
 		{
 			return false;
 		}
 
-		check(SpirV.size() % 4 == 0);
+		check(CodeSize % 4 == 0);
 
 		VkShaderModuleCreateInfo CreateInfo;
 		MemZero(CreateInfo);
 		CreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		CreateInfo.codeSize = SpirV.size();
-		CreateInfo.pCode = (uint32*)&SpirV[0];
+		CreateInfo.codeSize = CodeSize;
+		CreateInfo.pCode = (const uint32*)Code;
 
 		checkVk(vkCreateShaderModule(Device, &CreateInfo, nullptr, &ShaderModule));
 
 		return true;
 	}
 
-	bool Create(std::vector<char>& InSpirV, VkDevice Device)
+	// Without bPersistent the code is copied into SpirV, otherwise it has to outlive the shader (eg the mapped archive)
+	bool Create(const char* InCode, size_t InCodeSize, bool bPersistent, VkDevice Device)
 	{
-		SpirV = InSpirV;
+		if (bPersistent)
+		{
+			Code = InCode;
+			CodeSize = InCodeSize;
+		}
+		else
+		{
+			SpirV.assign(InCode, InCode + InCodeSize);
+			Code = SpirV.empty() ? nullptr : &SpirV[0];
+			CodeSize = SpirV.size();
+		}
 		return Create(Device);
 	}
 
 	bool Create(const char* Filename, VkDevice Device)
 	{
 		SpirV = LoadFile(Filename);
+		Code = SpirV.empty() ? nullptr : &SpirV[0];
+		CodeSize = SpirV.size();
 		return Create(Device);
 	}
 
@@ -581,7 +816,10 @@ struct FShader : public IShader
 
 	void GenerateReflection(std::map<uint32, FDescriptorSetInfo>& DescriptorSets);
 
+	// Code points either into SpirV or into memory owned by the collection
 	std::vector<char> SpirV;
+	const char* Code = nullptr;
+	size_t CodeSize = 0;
 	VkShaderModule ShaderModule = VK_NULL_HANDLE;
 };
 
@@ -632,7 +870,7 @@ struct FPSO
 
 	VkDescriptorSetLayout DSLayout = VK_NULL_HANDLE;
 
-	virtual void SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages) const
+	virtual void SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages, uint32 PermutationKey) const
 	{
 	}
 
@@ -649,11 +887,45 @@ struct FPSO
 	std::map<std::string, std::vector<FReflection>> ReflectionInfo;
 };
 
+// Values for [[vk::constant_id(N)]] constants, baked in when a pipeline is created
+struct FSpecializationConstants
+{
+	std::vector<VkSpecializationMapEntry> Entries;
+	std::vector<uint32> Data;
+
+	void Add(uint32 ConstantID, uint32 Value)
+	{
+		VkSpecializationMapEntry Entry;
+		MemZero(Entry);
+		Entry.constantID = ConstantID;
+		Entry.offset = (uint32)(Data.size() * sizeof(uint32));
+		Entry.size = sizeof(uint32);
+		Entries.push_back(Entry);
+		Data.push_back(Value);
+	}
+
+	bool IsEmpty() const
+	{
+		return Entries.empty();
+	}
+};
+
+// A variant of a gfx PSO; all permutations of a PSO share its descriptor set layout
+struct FGfxPSOPermutation
+{
+	FShaderHandle VS;
+	FShaderHandle PS;
+	FSpecializationConstants Constants;
+};
+
 struct FGfxPSO : public FPSO
 {
 	FShaderHandle VS;
 	FShaderHandle PS;
 
+	// Key 0 is VS/PS without any specialization constants
+	std::map<uint32, FGfxPSOPermutation> Permutations;
+
 	FGfxPSO(FVulkanShaderCollection& InCollection)
 		: FPSO(InCollection)
 	{
@@ -661,7 +933,7 @@ struct FGfxPSO : public FPSO
 
 	virtual void Destroy(VkDevice Device) override;
 
-	bool CreateVSPS(VkDevice Device, FShaderHandle InVS, FShaderHandle InPS);
+	bool CreateVSPS(VkDevice Device, FShaderHandle InVS, FShaderHandle InPS, const std::map<uint32, FGfxPSOPermutation>& InPermutations);
 
 	inline void AddBinding(std::vector<VkDescriptorSetLayoutBinding>& OutBindings, VkShaderStageFlags Stage, int32 Binding, VkDescriptorType DescType, uint32 NumDescriptors = 1)
 	{
@@ -674,7 +946,11 @@ struct FGfxPSO : public FPSO
 		OutBindings.push_back(NewBinding);
 	}
 
-	virtual void SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages) const override;
+	virtual void SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages, uint32 PermutationKey) const override;
+
+protected:
+	// Filled in SetupShaderStages(); points into Permutations
+	mutable VkSpecializationInfo SpecializationInfo;
 };
 
 struct FVertexFormat
@@ -720,19 +996,21 @@ struct FVertexFormat
 
 struct FGfxPSOLayout
 {
-	FGfxPSOLayout(FGfxPSO* InGfxPSO, FVertexFormat* InVF, uint32 InWidth, uint32 InHeight, struct FRenderPass* InRenderPass, bool bInWireframe)
+	FGfxPSOLayout(FGfxPSO* InGfxPSO, FVertexFormat* InVF, uint32 InWidth, uint32 InHeight, struct FRenderPass* InRenderPass, bool bInWireframe, uint32 InPermutationKey = 0)
 		: GfxPSO(InGfxPSO)
 		, VF(InVF)
 		, Width(InWidth)
 		, Height(InHeight)
 		, RenderPass(InRenderPass)
+		, PermutationKey(InPermutationKey)
 		, bWireframe(bInWireframe)
 	{
 	}
 
+	// Compare members instead of memcmp'ing the struct, the padding bytes are uninitialized
 	friend inline bool operator < (const FGfxPSOLayout& A, const FGfxPSOLayout& B)
 	{
-		return memcmp(&A, &B, sizeof(A)) < 0;
+		return std::tie(A.GfxPSO, A.VF, A.Width, A.Height, A.RenderPass, A.PermutationKey, A.bWireframe, A.Blend) < std::tie(B.GfxPSO, B.VF, B.Width, B.Height, B.RenderPass, B.PermutationKey, B.bWireframe, B.Blend);
 	}
 
 	FGfxPSO* GfxPSO;
@@ -740,6 +1018,7 @@ struct FGfxPSOLayout
 	uint32 Width;
 	uint32 Height;
 	struct FRenderPass* RenderPass;
+	uint32 PermutationKey;
 	bool bWireframe;
 	enum class EBlend
 	{
@@ -773,7 +1052,7 @@ struct FComputePSO : public FPSO
 		OutBindings.push_back(NewBinding);
 	}
 
-	void SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages) const override;
+	void SetupShaderStages(std::vector<VkPipelineShaderStageCreateInfo>& OutShaderStages, uint32 PermutationKey) const override;
 };
 
 struct FBasePipeline
@@ -897,6 +1176,26 @@ public:
 		return AllocateDescriptorSet(Pipeline->PSO->DSLayout);
 	}
 
+	// Layout handles can get recycled, so drop the sets before destroying one; the GPU has to be done with them
+	void FreeSets(VkDescriptorSetLayout DSLayout)
+	{
+		auto Found = Sets.find(DSLayout);
+		if (Found == Sets.end())
+		{
+			return;
+		}
+
+		for (auto* List : { &Found->second.Used, &Found->second.Free })
+		{
+			for (auto* Set : *List)
+			{
+				vkFreeDescriptorSets(Device, Pool, 1, &Set->Set);
+				delete Set;
+			}
+		}
+		Sets.erase(Found);
+	}
+
 	void UpdateDescriptors(FWriteDescriptors& InWriteDescriptors);
 	void RefreshFences();
 
@@ -1063,7 +1362,7 @@ struct FGfxPipeline : public FBasePipeline
 	VkPipelineDynamicStateCreateInfo DynamicInfo;
 
 	FGfxPipeline();
-	void Create(VkDevice Device, const FGfxPSO* InPSO, const FVertexFormat* VertexFormat, uint32 Width, uint32 Height, const FRenderPass* RenderPass);	
+	void Create(VkDevice Device, const FGfxPSO* InPSO, const FVertexFormat* VertexFormat, uint32 Width, uint32 Height, const FRenderPass* RenderPass, uint32 PermutationKey = 0);	
 };
 
 struct FComputePipeline : public FBasePipeline
@@ -1074,7 +1373,7 @@ struct FComputePipeline : public FBasePipeline
 		PSO->Pipelines.push_back(this);
 
 		std::vector<VkPipelineShaderStageCreateInfo> ShaderStages;
-		PSO->SetupShaderStages(ShaderStages);
+		PSO->SetupShaderStages(ShaderStages, 0);
 		check(ShaderStages.size() == 1);
 
 		VkPipelineLayoutCreateInfo CreateInfo;
@@ -1119,7 +1418,8 @@ public:
 		VkDescriptorBufferInfo* BufferInfo = new VkDescriptorBufferInfo;
 		MemZero(*BufferInfo);
 		BufferInfo->buffer = Buffer.Buffer;
-		BufferInfo->offset = Buffer.GetBindOffset();
+		// Relative to the buffer, which is already bound at its memory offset
+		BufferInfo->offset = 0;
 		BufferInfo->range = Buffer.GetSize();
 		BufferInfos.push_back(BufferInfo);
 
@@ -1152,7 +1452,7 @@ public:
 		VkDescriptorBufferInfo* BufferInfo = new VkDescriptorBufferInfo;
 		MemZero(*BufferInfo);
 		BufferInfo->buffer = Buffer.Buffer;
-		BufferInfo->offset = Buffer.GetBindOffset();
+		BufferInfo->offset = 0;
 		BufferInfo->range = Buffer.GetSize();
 		BufferInfos.push_back(BufferInfo);
 
@@ -1260,7 +1560,7 @@ protected:
 };
 
 
-inline void ImageBarrier(FCmdBuffer* CmdBuffer, VkPipelineStageFlags SrcStage, VkPipelineStageFlags DestStage, VkImage Image, VkImageLayout SrcLayout, VkAccessFlags SrcMask, VkImageLayout DestLayout, VkAccessFlags DstMask, VkImageAspectFlags AspectMask, uint32 NumMips = 1, uint32 StartMip = 0)
+inline void ImageBarrier(FCmdBuffer* CmdBuffer, VkPipelineStageFlags SrcStage, VkPipelineStageFlags DestStage, VkImage Image, VkImageLayout SrcLayout, VkAccessFlags SrcMask, VkImageLayout DestLayout, VkAccessFlags DstMask, VkImageAspectFlags AspectMask, uint32 NumMips = 1, uint32 StartMip = 0, uint32 NumLayers = 1, uint32 StartLayer = 0)
 {
 	VkImageMemoryBarrier Barrier;
 	MemZero(Barrier);
@@ -1273,7 +1573,8 @@ inline void ImageBarrier(FCmdBuffer* CmdBuffer, VkPipelineStageFlags SrcStage, V
 	Barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	Barrier.image = Image;
 	Barrier.subresourceRange.aspectMask = AspectMask;;
-	Barrier.subresourceRange.layerCount = 1;
+	Barrier.subresourceRange.baseArrayLayer = StartLayer;
+	Barrier.subresourceRange.layerCount = NumLayers;
 	Barrier.subresourceRange.baseMipLevel = StartMip;
 	Barrier.subresourceRange.levelCount = NumMips;
 	vkCmdPipelineBarrier(CmdBuffer->CmdBuffer, SrcStage, DestStage, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
@@ -1296,7 +1597,7 @@ inline void BufferBarrier(FCmdBuffer* CmdBuffer, VkPipelineStageFlags SrcStage,
 
 inline void BufferBarrier(FCmdBuffer* CmdBuffer, VkPipelineStageFlags SrcStage, VkPipelineStageFlags DestStage, FBuffer* Buffer, VkAccessFlags SrcMask, VkAccessFlags DstMask)
 {
-	BufferBarrier(CmdBuffer, SrcStage, DestStage, Buffer->Buffer, Buffer->GetBindOffset(), Buffer->GetSize(), SrcMask, DstMask);
+	BufferBarrier(CmdBuffer, SrcStage, DestStage, Buffer->Buffer, 0, Buffer->GetSize(), SrcMask, DstMask);
 }
 
 struct FSwapchain
@@ -1426,9 +1727,9 @@ inline void CopyBuffer(FPrimaryCmdBuffer* CmdBuffer, FBuffer* SrcBuffer, FBuffer
 {
 	VkBufferCopy Region;
 	MemZero(Region);
-	Region.srcOffset = SrcBuffer->GetBindOffset();
+	Region.srcOffset = 0;
 	Region.size = SrcBuffer->GetSize();
-	Region.dstOffset = DestBuffer->GetBindOffset();
+	Region.dstOffset = 0;
 	vkCmdCopyBuffer(CmdBuffer->CmdBuffer, SrcBuffer->Buffer, DestBuffer->Buffer, 1, &Region);
 }
 
@@ -1474,30 +1775,59 @@ void MapAndFillBufferSyncOneShotCmdBuffer(FDevice* Device, FCmdBufferMgr* CmdBuf
 	FlushMappedBuffer(Device->Device, StagingBuffer);
 }
 
-template <typename TFillLambda>
-inline void MapAndFillImageSync(FStagingBuffer* StagingBuffer, FPrimaryCmdBuffer* CmdBuffer, FImage* DestImage, TFillLambda Fill)
+// One region per subresource, all in one copy; offsets are relative to BaseOffset. The subresources have to be in
+// TRANSFER_DST
+inline void CopyBufferToImage(FCmdBuffer* CmdBuffer, VkBuffer Buffer, uint64 BaseOffset, FImage* DestImage, const std::vector<FImageSubresource>& Subresources)
 {
-	void* Data = StagingBuffer->GetMappedData();
-	check(Data);
-	Fill(CmdBuffer, Data, DestImage->Width, DestImage->Height);
-
+	std::vector<VkBufferImageCopy> Regions(Subresources.size());
+	for (size_t Index = 0; Index < Subresources.size(); ++Index)
 	{
-		VkBufferImageCopy Region;
+		const FImageSubresource& Subresource = Subresources[Index];
+		VkBufferImageCopy& Region = Regions[Index];
 		MemZero(Region);
-		Region.bufferOffset = StagingBuffer->GetBindOffset();
-		Region.bufferRowLength = DestImage->Width;
-		Region.bufferImageHeight = DestImage->Height;
-		Region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		Region.bufferOffset = BaseOffset + Subresource.Offset;
+		// Row length and height of 0 mean tightly packed, which for compressed formats is whole blocks
+		Region.imageSubresource.aspectMask = GetImageAspectFlags(DestImage->Format);
+		Region.imageSubresource.mipLevel = Subresource.Mip;
+		Region.imageSubresource.baseArrayLayer = Subresource.Layer;
 		Region.imageSubresource.layerCount = 1;
-		Region.imageExtent.width = DestImage->Width;
-		Region.imageExtent.height = DestImage->Height;
+		Region.imageExtent.width = Subresource.Width;
+		Region.imageExtent.height = Subresource.Height;
 		Region.imageExtent.depth = 1;
-		vkCmdCopyBufferToImage(CmdBuffer->CmdBuffer, StagingBuffer->Buffer, DestImage->Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region);
+	}
+	vkCmdCopyBufferToImage(CmdBuffer->CmdBuffer, Buffer, DestImage->Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32)Regions.size(), &Regions[0]);
+}
+
+// Fill gets called once per subresource with where its texels go: Fill(CmdBuffer, Data, Subresource). The staging buffer
+// has to come from RequestUploadBufferForImage() with the same Subresources
+template <typename TFillLambda>
+inline void MapAndFillImageSync(FStagingBuffer* StagingBuffer, FPrimaryCmdBuffer* CmdBuffer, FImage* DestImage, const std::vector<FImageSubresource>& Subresources, TFillLambda Fill)
+{
+	auto* Data = (uint8*)StagingBuffer->GetMappedData();
+	check(Data);
+	for (const FImageSubresource& Subresource : Subresources)
+	{
+		Fill(CmdBuffer, Data + Subresource.Offset, Subresource);
 	}
 
+	CopyBufferToImage(CmdBuffer, StagingBuffer->Buffer, 0, DestImage, Subresources);
+
 	StagingBuffer->SetFence(CmdBuffer);
 }
 
+// Mip 0 of layer 0 only
+template <typename TFillLambda>
+inline void MapAndFillImageSync(FStagingBuffer* StagingBuffer, FPrimaryCmdBuffer* CmdBuffer, FImage* DestImage, TFillLambda Fill)
+{
+	std::vector<FImageSubresource> Subresources;
+	GetImageSubresources(DestImage, Subresources, 0, 1, 0, 1);
+	MapAndFillImageSync(StagingBuffer, CmdBuffer, DestImage, Subresources,
+		[&](FPrimaryCmdBuffer* InCmdBuffer, void* Data, const FImageSubresource& Subresource)
+		{
+			Fill(InCmdBuffer, Data, Subresource.Width, Subresource.Height);
+		});
+}
+
 template <typename TFillLambda>
 void MapAndFillImageSyncOneShotCmdBuffer(FDevice* Device, FCmdBufferMgr* CmdBufferMgr, FStagingManager* StagingMgr, FImage* DestImage, TFillLambda Fill, uint32 Size, const char* InFile, int32 InLine)
 {
@@ -1561,10 +1891,17 @@ inline void BlitColorImage(FPrimaryCmdBuffer* CmdBuffer, uint32 Width, uint32 He
 struct FVulkanShaderCollection : FShaderCollection
 {
 	VkDevice Device = VK_NULL_HANDLE;
+	FDeferredDeletionQueue* DeferredDeletion = nullptr;
+	FDescriptorPool* DescriptorPool = nullptr;
 
-	void Create(VkDevice InDevice)
+	// Writes the disassembly of every shader compiled to its AsmFile
+	bool bDumpDebugFiles = false;
+
+	void Create(VkDevice InDevice, FDeferredDeletionQueue* InDeferredDeletion, FDescriptorPool* InDescriptorPool)
 	{
 		Device = InDevice;
+		DeferredDeletion = InDeferredDeletion;
+		DescriptorPool = InDescriptorPool;
 	}
 
 	void DestroyShader(FShaderHandle Handle)
@@ -1583,6 +1920,7 @@ struct FVulkanShaderCollection : FShaderCollection
 	{
 		FShaderHandle VertexHandle;
 		FShaderHandle PixelHandle;
+		std::map<uint32, FGfxPSOPermutation> Permutations;
 	};
 	std::map<std::string, FGfxPSOInfo> GfxPSOInfo;
 	struct FComputePSOInfo
@@ -1591,12 +1929,21 @@ struct FVulkanShaderCollection : FShaderCollection
 	};
 	std::map<std::string, FComputePSOInfo> ComputePSOInfo;
 
-	void RegisterGfxPSO(const char* Name, FShaderHandle VertexHandle, FShaderHandle PixelHandle)
+	// Permutations are selected with FGfxPSOLayout::PermutationKey; key 0 is reserved for VertexHandle/PixelHandle
+	void RegisterGfxPSO(const char* Name, FShaderHandle VertexHandle, FShaderHandle PixelHandle, const std::map<uint32, FGfxPSOPermutation>& Permutations = std::map<uint32, FGfxPSOPermutation>())
 	{
-		GfxPSOInfo[Name] = { VertexHandle, PixelHandle };
+		check(Permutations.find(0) == Permutations.end());
+		GfxPSOInfo[Name] = { VertexHandle, PixelHandle, Permutations };
 		FGfxPSO* PSO = new FGfxPSO(*this);
-		PSO->CreateVSPS(Device, VertexHandle, PixelHandle);
+		PSO->CreateVSPS(Device, VertexHandle, PixelHandle, Permutations);
 		FShaderCollection::RegisterGfxPSO(Name, PSO, GetVulkanShader(VertexHandle), GetVulkanShader(PixelHandle));
+
+		// Reloading any of the variants has to recreate the PSO too
+		for (auto& Pair : Permutations)
+		{
+			AddShaderToPSO(GetVulkanShader(Pair.second.VS), PSO);
+			AddShaderToPSO(GetVulkanShader(Pair.second.PS), PSO);
+		}
 	}
 
 	void RegisterComputePSO(const char* Name, FShaderHandle ComputeHandle)
@@ -1607,33 +1954,94 @@ struct FVulkanShaderCollection : FShaderCollection
 		FShaderCollection::RegisterComputePSO(Name, PSO, GetVulkanShader(ComputeHandle));
 	}
 
+	// Only the PSOs using a shader that changed get recreated; callers need to evict InvalidatedPSOs from their caches
 	virtual bool ReloadShaders() override
 	{
 		bool bRebuild = FShaderCollection::ReloadShaders();
 		if (bRebuild)
 		{
-			for (auto Pair : GfxPSOInfo)
+			for (auto& Name : InvalidatedGfxPSOs)
 			{
-				RegisterGfxPSO(Pair.first.c_str(), Pair.second.VertexHandle, Pair.second.PixelHandle);
+				auto& Info = GfxPSOInfo[Name];
+				RegisterGfxPSO(Name.c_str(), Info.VertexHandle, Info.PixelHandle, Info.Permutations);
 			}
 
-			for (auto Pair : ComputePSOInfo)
+			for (auto& Name : InvalidatedComputePSOs)
 			{
-				RegisterComputePSO(Pair.first.c_str(), Pair.second.ComputeHandle);
+				RegisterComputePSO(Name.c_str(), ComputePSOInfo[Name].ComputeHandle);
 			}
 		}
+
+		WriteStatsReport();
 		return bRebuild;
 	}
 
-	virtual void DestroyAndDelete(FPSO* PSO) override
+	// Writes out/ShaderStats.txt with the cost of every loaded shader, so changes in them show up in diffs
+	void WriteStatsReport()
 	{
-		for (auto* Pipeline : PSO->Pipelines)
+		std::string OutDir;
+		std::vector<std::string> Lines;
+		for (auto& Info : ShaderInfos)
+		{
+			FShader* Shader = (FShader*)Info.Shader;
+			ShaderCompiler::FSpirVStats Stats;
+			if (!Shader || !ShaderCompiler::GetStats(Shader->Code, Shader->CodeSize, Stats))
+			{
+				continue;
+			}
+
+			OutDir = FileUtils::GetPath(Info.AsmFile, true);
+			std::string Name = FileUtils::GetBaseName(Info.SourceFile, true) + " " + Info.Entry;
+			for (auto& Define : Info.Defines)
+			{
+				Name += " " + Define.first + "=" + Define.second;
+			}
+
+			char Line[512];
+			sprintf_s(Line, "%-40s %12u %8u %11u %5u\n", Name.c_str(), Stats.NumInstructions, Stats.SizeInBytes, Stats.NumDescriptors, Stats.NumLoops);
+			Lines.push_back(Line);
+		}
+
+		if (Lines.empty())
+		{
+			return;
+		}
+
+		std::sort(Lines.begin(), Lines.end());
+		char Header[512];
+		sprintf_s(Header, "// %s\n%-40s %12s %8s %11s %5s\n", GetCompilerFlags().c_str(), "Shader", "Instructions", "Bytes", "Descriptors", "Loops");
+		std::string Report = Header;
+		for (auto& Line : Lines)
 		{
-			Pipeline->Destroy(Device);
-			delete Pipeline;
+			Report += Line;
 		}
-		PSO->Destroy(Device);
-		delete PSO;
+
+		::OutputDebugStringA(Report.c_str());
+		std::string Filename = FileUtils::MakePath(OutDir, "ShaderStats.txt");
+		SaveFile(Filename.c_str(), Report.data(), Report.size());
+	}
+
+	virtual void DestroyAndDelete(FPSO* PSO) override
+	{
+		// Its pipelines and descriptor sets might still be used by frames in flight
+		DeferredDeletion->Enqueue([this, PSO]()
+		{
+			for (auto* Pipeline : PSO->Pipelines)
+			{
+				Pipeline->Destroy(Device);
+				delete Pipeline;
+			}
+			DescriptorPool->FreeSets(PSO->DSLayout);
+			PSO->Destroy(Device);
+			delete PSO;
+		});
+	}
+
+	virtual void DestroyAndDelete(IShader* Shader) override
+	{
+		// Pipelines don't need their shader modules after creation
+		Shader->Destroy();
+		delete Shader;
 	}
 
 	void Destroy()
@@ -1646,68 +2054,46 @@ struct FVulkanShaderCollection : FShaderCollection
 			}
 		}
 		ProcessPendingDeletions();
+		CloseArchive();
 		ShaderInfos.clear();
+		GfxPSOInfo.clear();
+		ComputePSOInfo.clear();
+		SourceWatcher.Destroy();
 	}
 
-	virtual bool DoCompileFromSource(FShaderInfo& Info) override
+	virtual bool DoCompileToBinary(const FShaderInfo& Info, std::vector<char>& OutBinary, std::string& OutErrors) override
 	{
-		static const std::string GlslangProlog = GetGlslangCommandLine();
+		if (!ShaderCompiler::CompileHLSL(Info.PreprocessedSource, Info.SourceFile, Info.Entry, Info.Stage, OutBinary, OutErrors))
+		{
+			return false;
+		}
 
-		std::string Compile = GlslangProlog;
-		Compile += " -e " + Info.Entry;
-		Compile += " -o " + FileUtils::AddQuotes(Info.BinaryFile);
-		Compile += " -S " + GetStageName(Info.Stage);
-		Compile += " " + FileUtils::AddQuotes(Info.SourceFile);
-		Compile += " > " + FileUtils::AddQuotes(Info.AsmFile);
-		int ReturnCode = system(Compile.c_str());
-		if (ReturnCode)
+		if (bDumpDebugFiles)
 		{
-			std::vector<char> File = LoadFile(Info.AsmFile.c_str());
-			if (File.empty())
+			std::string Assembly;
+			std::string Errors;
+			if (ShaderCompiler::CompileHLSLToAssembly(Info.PreprocessedSource, Info.SourceFile, Info.Entry, Info.Stage, Assembly, Errors))
 			{
-				std::string Error = "Compile error: No output for file ";
-				Error += Info.SourceFile;
-				::OutputDebugStringA(Error.c_str());
+				SaveFile(Info.AsmFile.c_str(), Assembly.data(), Assembly.size());
 			}
-			else
-			{
-				std::string FileString = &File[0];
-				FileString.resize(File.size());
-				std::string Error = "Compile error:\n";
-				Error += FileString;
-				Error += "\n";
-				::OutputDebugStringA(Error.c_str());
-
-				int DialogResult = ::MessageBoxA(nullptr, Error.c_str(), Info.SourceFile.c_str(), MB_CANCELTRYCONTINUE);
-				if (DialogResult == IDTRYAGAIN)
-				{
-					return DoCompileFromSource(Info);
-				}				
-			}
-
-			return false;
 		}
 
-		return DoCompileFromBinary(Info);
+		return true;
 	}
 
-	virtual bool DoCompileFromBinary(FShaderInfo& Info) override
+	virtual std::string GetCompilerFlags() override
 	{
-		std::vector<char> File = LoadFile(Info.BinaryFile.c_str());
-		if (File.empty())
-		{
-			check(0);
-			return false;
-		}
+		return ShaderCompiler::GetFlags();
+	}
 
-		//#todo: Destroy old; sync with rendering
-		if (Info.Shader)
-		{
-			ShadersToDestroy.push_back(Info.Shader);
-		}
-		Info.Shader = CreateShader(Info, File);
+	virtual bool ReportCompileErrors(const std::string& Errors) override
+	{
+		std::string Error = "Compile error:\n";
+		Error += Errors;
+		::OutputDebugStringA(Error.c_str());
 
-		return Info.Shader != nullptr;
+		int DialogResult = ::MessageBoxA(nullptr, Error.c_str(), "Shader compile errors", MB_CANCELTRYCONTINUE);
+		return DialogResult == IDTRYAGAIN;
 	}
 
 	virtual void SetupFilenames(const std::string& OriginalFilename, FShaderInfo& Info) override
@@ -1718,43 +2104,23 @@ struct FVulkanShaderCollection : FShaderCollection
 
 		std::string OutDir = FileUtils::MakePath(RootDir, "out");
 		_mkdir(OutDir.c_str());
+		Info.CacheDir = FileUtils::MakePath(OutDir, "cache");
+		_mkdir(Info.CacheDir.c_str());
 
 		Info.SourceFile = FileUtils::MakePath(RootDir, BaseFilename + "." + Extension);
-		Info.BinaryFile = FileUtils::MakePath(OutDir, BaseFilename + "." + Info.Entry + ".spv");
-		Info.AsmFile = FileUtils::MakePath(OutDir, BaseFilename + "." + Info.Entry + ".spvasm");
-	}
-
-	static std::string GetGlslangCommandLine()
-	{
-		std::string Out;
-		char Glslang[MAX_PATH];
-		char SDKDir[MAX_PATH];
-		::GetEnvironmentVariableA("VULKAN_SDK", SDKDir, MAX_PATH - 1);
-		sprintf_s(Glslang, "%s\\Bin\\glslangValidator.exe", SDKDir);
-		Out = Glslang;
-		Out += " -V -r -l -H -D --hlsl-iomap --auto-map-bindings";
-		return Out;
-	}
-
-	static std::string GetStageName(EShaderStage Stage)
-	{
-		switch (Stage)
+		std::string Permutation;
+		for (auto& Define : Info.Defines)
 		{
-		case EShaderStage::Compute: return "comp";
-		case EShaderStage::Vertex:	return "vert";
-		case EShaderStage::Pixel:	return "frag";
-		default:
-			break;
+			Permutation += "." + Define.first + "=" + Define.second;
 		}
-
-		return "INVALID";
+		Info.AsmFile = FileUtils::MakePath(OutDir, BaseFilename + "." + Info.Entry + Permutation + ".spvasm");
 	}
 
-	virtual IShader* CreateShader(FShaderInfo& Info, std::vector<char>& Data) override
+	virtual IShader* CreateShader(FShaderInfo& Info, const char* Code, size_t CodeSize, bool bPersistent) override
 	{
 		FShader* Shader = new FShader(Info);
 		Shader->Stage = Info.Stage;
-		if (Shader->Create(Data, Device))
+		if (Shader->Create(Code, CodeSize, bPersistent, Device))
 		{
 			return Shader;
 		}
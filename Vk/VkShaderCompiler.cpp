@@ -0,0 +1,196 @@
+// VkShaderCompiler.cpp
+
+#include "VkShaderCompiler.h"
+#include <shaderc/shaderc.hpp>
+
+namespace ShaderCompiler
+{
+	// Matches what we used to pass to glslangValidator: -V -D --hlsl-iomap --auto-map-bindings.
+	// Release runs the spirv-opt performance passes (inlining, constant folding, dead code elimination...). Debug info is
+	// on in both: without it shaderc strips every OpName, and descriptors are bound by their reflected names (see
+	// FBasePipeline::SetUniformBuffer() and friends). Release then drops only the line and source info, see StripLineInfo()
+	static void SetupOptions(shaderc::CompileOptions& Options)
+	{
+		Options.SetSourceLanguage(shaderc_source_language_hlsl);
+		Options.SetTargetEnvironment(shaderc_target_env_vulkan, 0);
+		Options.SetHlslIoMapping(true);
+		Options.SetAutoBindUniforms(true);
+		Options.SetGenerateDebugInfo();
+#if defined(NDEBUG)
+		Options.SetOptimizationLevel(shaderc_optimization_level_performance);
+#else
+		Options.SetOptimizationLevel(shaderc_optimization_level_zero);
+#endif
+	}
+
+	enum
+	{
+		SpirVMagic = 0x07230203,
+		HeaderWords = 5,
+	};
+
+	// Removes OpSource, OpSourceContinued, OpString, OpLine and OpNoLine, which carry the file names, the whole HLSL
+	// source and the line of every instruction; OpName and OpMemberName stay
+	static void StripLineInfo(std::vector<char>& SpirV)
+	{
+		enum
+		{
+			OpSourceContinued = 2,
+			OpSource = 3,
+			OpString = 7,
+			OpLine = 8,
+			OpNoLine = 317,
+		};
+
+		const uint32* Words = (const uint32*)SpirV.data();
+		size_t NumWords = SpirV.size() / 4;
+		if (SpirV.size() % 4 != 0 || NumWords < HeaderWords || Words[0] != SpirVMagic)
+		{
+			return;
+		}
+
+		std::vector<uint32> Stripped(Words, Words + HeaderWords);
+		size_t Index = HeaderWords;
+		while (Index < NumWords)
+		{
+			uint32 WordCount = Words[Index] >> 16;
+			uint32 OpCode = Words[Index] & 0xffff;
+			if (WordCount == 0 || Index + WordCount > NumWords)
+			{
+				// Leave anything we can't walk as it came
+				return;
+			}
+
+			bool bStrip = OpCode == OpSourceContinued || OpCode == OpSource || OpCode == OpString || OpCode == OpLine || OpCode == OpNoLine;
+			if (!bStrip)
+			{
+				Stripped.insert(Stripped.end(), Words + Index, Words + Index + WordCount);
+			}
+			Index += WordCount;
+		}
+		SpirV.assign((const char*)Stripped.data(), (const char*)(Stripped.data() + Stripped.size()));
+	}
+
+	static shaderc_shader_kind GetShaderKind(EShaderStage Stage)
+	{
+		switch (Stage)
+		{
+		case EShaderStage::Vertex:	return shaderc_vertex_shader;
+		case EShaderStage::Pixel:	return shaderc_fragment_shader;
+		case EShaderStage::Compute:	return shaderc_compute_shader;
+		default:
+			check(0);
+			break;
+		}
+
+		return shaderc_glsl_infer_from_source;
+	}
+
+	const std::string& GetFlags()
+	{
+		static const std::string Flags = []()
+		{
+			unsigned int Version = 0;
+			unsigned int Revision = 0;
+			shaderc_get_spv_version(&Version, &Revision);
+			std::string Result = "shaderc spv " + std::to_string(Version) + "." + std::to_string(Revision) + " vulkan hlsl-iomap auto-map-bindings";
+#if defined(NDEBUG)
+			Result += " O names";
+#else
+			Result += " O0 g";
+#endif
+			return Result;
+		}();
+		return Flags;
+	}
+
+	bool CompileHLSL(const std::string& Source, const std::string& SourceName, const std::string& Entry, EShaderStage Stage, std::vector<char>& OutSpirV, std::string& OutErrors)
+	{
+		// A compiler per call keeps this trivially thread safe; creating one is cheap
+		shaderc::Compiler Compiler;
+		shaderc::CompileOptions Options;
+		SetupOptions(Options);
+
+		shaderc::SpvCompilationResult Result = Compiler.CompileGlslToSpv(Source.c_str(), Source.size(), GetShaderKind(Stage), SourceName.c_str(), Entry.c_str(), Options);
+		if (Result.GetCompilationStatus() != shaderc_compilation_status_success)
+		{
+			OutErrors = Result.GetErrorMessage();
+			return false;
+		}
+
+		OutSpirV.assign((const char*)Result.cbegin(), (const char*)Result.cend());
+#if defined(NDEBUG)
+		StripLineInfo(OutSpirV);
+#endif
+		return true;
+	}
+
+	bool CompileHLSLToAssembly(const std::string& Source, const std::string& SourceName, const std::string& Entry, EShaderStage Stage, std::string& OutAssembly, std::string& OutErrors)
+	{
+		shaderc::Compiler Compiler;
+		shaderc::CompileOptions Options;
+		SetupOptions(Options);
+
+		shaderc::AssemblyCompilationResult Result = Compiler.CompileGlslToSpvAssembly(Source.c_str(), Source.size(), GetShaderKind(Stage), SourceName.c_str(), Entry.c_str(), Options);
+		if (Result.GetCompilationStatus() != shaderc_compilation_status_success)
+		{
+			OutErrors = Result.GetErrorMessage();
+			return false;
+		}
+
+		OutAssembly.assign(Result.cbegin(), Result.cend());
+		return true;
+	}
+
+	bool GetStats(const char* Code, size_t CodeSize, FSpirVStats& OutStats)
+	{
+		enum
+		{
+			OpVariable = 59,
+			OpLoopMerge = 246,
+
+			StorageClassUniformConstant = 0,
+			StorageClassUniform = 2,
+			StorageClassStorageBuffer = 12,
+		};
+
+		OutStats = FSpirVStats();
+		const uint32* Words = (const uint32*)Code;
+		size_t NumWords = CodeSize / 4;
+		if (!Code || CodeSize % 4 != 0 || NumWords < HeaderWords || Words[0] != SpirVMagic)
+		{
+			return false;
+		}
+
+		OutStats.SizeInBytes = (uint32)CodeSize;
+		size_t Index = HeaderWords;
+		while (Index < NumWords)
+		{
+			uint32 WordCount = Words[Index] >> 16;
+			uint32 OpCode = Words[Index] & 0xffff;
+			if (WordCount == 0 || Index + WordCount > NumWords)
+			{
+				return false;
+			}
+
+			++OutStats.NumInstructions;
+			if (OpCode == OpLoopMerge)
+			{
+				++OutStats.NumLoops;
+			}
+			else if (OpCode == OpVariable && WordCount >= 4)
+			{
+				// OpVariable ResultType Result StorageClass [Initializer]
+				uint32 StorageClass = Words[Index + 3];
+				if (StorageClass == StorageClassUniformConstant || StorageClass == StorageClassUniform || StorageClass == StorageClassStorageBuffer)
+				{
+					++OutStats.NumDescriptors;
+				}
+			}
+
+			Index += WordCount;
+		}
+
+		return true;
+	}
+}
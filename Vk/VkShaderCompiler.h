@@ -0,0 +1,30 @@
+// VkShaderCompiler.h
+
+#pragma once
+
+#include "../Utils/Shaders.h"
+
+// HLSL to SPIR-V through the shaderc library, all in memory. Doesn't need Windows or the Vulkan headers so it can
+// be built (and benchmarked) on Linux too
+namespace ShaderCompiler
+{
+	// Compiler version and options; part of the shader cache key
+	const std::string& GetFlags();
+
+	// Safe to call from several threads at once
+	bool CompileHLSL(const std::string& Source, const std::string& SourceName, const std::string& Entry, EShaderStage Stage, std::vector<char>& OutSpirV, std::string& OutErrors);
+
+	// Human readable SPIR-V for debug dumps
+	bool CompileHLSLToAssembly(const std::string& Source, const std::string& SourceName, const std::string& Entry, EShaderStage Stage, std::string& OutAssembly, std::string& OutErrors);
+
+	struct FSpirVStats
+	{
+		uint32 NumInstructions = 0;
+		uint32 SizeInBytes = 0;
+		uint32 NumDescriptors = 0;
+		uint32 NumLoops = 0;
+	};
+
+	// Walks the instruction stream of a SPIR-V module; returns false if it doesn't look like one
+	bool GetStats(const char* Code, size_t CodeSize, FSpirVStats& OutStats);
+}